@@ -0,0 +1,383 @@
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include "server.h"
+#include "client.h"
+#include "file_logic.h"
+#include "common_file_logic.h"
+#include "latency_histogram.h"
+#include "socket_tuning.h"
+#include "logger.h"
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/chrono/include.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace perf
+{
+
+struct bench_settings
+{
+	bench_settings()
+		: repeats( 3 )
+		, clients_count( 1 )
+		, requests_count( 1000 )
+		, pipeline_depth( 1 )
+		, mode( protocol::copy_reply_mode )
+		, format( protocol::ascii_header_format )
+		, verbose( false )
+	{
+	}
+
+	// swept, every combination is run
+	std::vector< size_t > file_sizes;
+	std::vector< size_t > files_counts;
+	std::vector< size_t > threads_counts;
+	std::vector< size_t > connections_counts;
+
+	size_t repeats;
+	size_t clients_count;
+	// files every client receives in a run
+	size_t requests_count;
+	size_t pipeline_depth;
+	protocol::reply_mode mode;
+	filelogic::cache_settings cache;
+	protocol::header_format format;
+	// for the server and the clients alike
+	socket_settings sockets;
+	// output of the servers and clients is dropped unless set
+	bool verbose;
+};
+
+// one combination of the sweep
+struct bench_point
+{
+	size_t file_size;
+	size_t files_count;
+	size_t threads_count;
+	size_t connections_count;
+};
+
+// what one run of a point has measured over all its clients
+struct bench_run
+{
+	double seconds;
+	boost::uint64_t bytes;
+	size_t files;
+	double p50_us;
+	double p99_us;
+};
+
+namespace detail
+{
+
+// sample standard deviation, 0 for a single sample
+inline void get_mean_stddev( const std::vector< double >& values, double& mean, double& stddev )
+{
+	mean = 0.0;
+	stddev = 0.0;
+	if ( values.empty() )
+	{
+		return;
+	}
+
+	for ( size_t idx = 0; idx < values.size(); ++idx )
+	{
+		mean += values[ idx ];
+	}
+	mean /= values.size();
+
+	if ( values.size() < 2 )
+	{
+		return;
+	}
+
+	for ( size_t idx = 0; idx < values.size(); ++idx )
+	{
+		stddev += ( values[ idx ] - mean ) * ( values[ idx ] - mean );
+	}
+	stddev = std::sqrt( stddev / ( values.size() - 1 ) );
+}
+
+// the server stops once its last connection is closed; a connection which has got a
+// reply is checked in, held open it keeps the server up between the clients of a run
+inline void hold_server(
+	boost::asio::ip::tcp::socket& socket
+	, const boost::asio::ip::tcp::endpoint& endpoint
+	, protocol::header_format format )
+{
+	socket.connect( endpoint );
+
+	const protocol::request req( "GET" );
+	protocol::variable_record request_record;
+	request_record.set_header_format( format );
+	const size_t request_length = request_record.serialize_data( req );
+	boost::asio::write( socket, boost::asio::buffer( request_record.get_data_buff(), request_length ) );
+
+	protocol::variable_record reply_record;
+	protocol::reply_header header;
+	boost::asio::read( socket, boost::asio::buffer( reply_record.get_header_buff(), protocol::variable_record::header_length ) );
+	if ( !reply_record.deserialize_header() )
+	{
+		throw std::runtime_error( "bench server: bad reply header" );
+	}
+
+	boost::asio::read( socket, boost::asio::buffer( reply_record.get_body_buff(), reply_record.get_body_length() ) );
+	if ( !reply_record.deserialize_body( header ) )
+	{
+		throw std::runtime_error( "bench server: bad reply header" );
+	}
+
+	std::vector< char > body( header.file_size );
+	boost::asio::read( socket, boost::asio::buffer( body ) );
+}
+
+// std::cout goes nowhere while it lives, the stream is whole again afterwards; the
+// logger's flusher writes to std::cout as well, so it is stopped meanwhile and the
+// records logged wait in their rings
+class cout_silencer
+	: private boost::noncopyable
+{
+public:
+
+	explicit cout_silencer( bool silence )
+		: buffer_( 0 )
+		, silenced_( silence )
+	{
+		if ( silenced_ )
+		{
+			get_logger().stop();
+			buffer_ = std::cout.rdbuf( 0 );
+		}
+	}
+
+	~cout_silencer()
+	{
+		if ( silenced_ )
+		{
+			std::cout.rdbuf( buffer_ );
+			std::cout.clear();
+			get_logger().start();
+		}
+	}
+
+private:
+	std::streambuf* buffer_;
+	const bool silenced_;
+};
+
+}
+
+// perf::server and clients_count perf::client in this process talking over loopback;
+// files are generated per file size and count into work_dir and every combination
+// of the sweep is run repeats times, its row has the mean and stddev over the runs
+class bench
+	: private boost::noncopyable
+{
+public:
+
+	bench( const bench_settings& settings, const boost::filesystem::path& work_dir )
+		: settings_( settings )
+		, work_dir_( work_dir )
+	{
+	}
+
+	// rows go to results and std::cout as their points finish, a sweep stopped early
+	// leaves what it has done
+	void run( std::ostream& results )
+	{
+		write_line( results, get_header() );
+
+		for ( size_t size_idx = 0; size_idx < settings_.file_sizes.size(); ++size_idx )
+		{
+			for ( size_t count_idx = 0; count_idx < settings_.files_counts.size(); ++count_idx )
+			{
+				bench_point point = { settings_.file_sizes[ size_idx ], settings_.files_counts[ count_idx ], 0, 0 };
+
+				std::ostringstream dir_name;
+				dir_name << "files-" << point.file_size << "-" << point.files_count;
+				const boost::filesystem::path files_dir = work_dir_ / dir_name.str();
+				const filelogic::raii_directory_holder<> files_dir_holder( files_dir );
+
+				filelogic::file_generator generator( files_dir );
+				generator.generate_files( "test string", point.file_size, point.files_count );
+
+				for ( size_t threads_idx = 0; threads_idx < settings_.threads_counts.size(); ++threads_idx )
+				{
+					for ( size_t connections_idx = 0; connections_idx < settings_.connections_counts.size(); ++connections_idx )
+					{
+						point.threads_count = settings_.threads_counts[ threads_idx ];
+						point.connections_count = settings_.connections_counts[ connections_idx ];
+
+						std::vector< bench_run > runs;
+						for ( size_t repeat = 0; repeat < settings_.repeats; ++repeat )
+						{
+							runs.push_back( run_once( point, files_dir ) );
+						}
+
+						write_line( results, get_row( point, runs ) );
+					}
+				}
+			}
+		}
+	}
+
+private:
+
+	bench_run run_once( const bench_point& point, const boost::filesystem::path& files_dir )
+	{
+		namespace ip = boost::asio::ip;
+
+		const detail::cout_silencer silencer( !settings_.verbose );
+
+		server srv(
+			ip::tcp::endpoint( ip::address_v4::loopback(), 0 )
+			, files_dir
+			, point.threads_count
+			, settings_.mode
+			, settings_.cache
+			, false
+			, 0
+			, 0
+			, std::string()
+			, false
+			, settings_.sockets );
+		const ip::tcp::endpoint endpoint = srv.get_local_endpoint();
+		boost::thread server_thread( boost::bind( &server::run, &srv ) );
+
+		boost::asio::io_service io_service;
+		ip::tcp::socket holder( io_service );
+		detail::hold_server( holder, endpoint, settings_.format );
+
+		// bodies are dropped as they come, the disk is not measured
+		sink_settings sink( discard_sink_type );
+		sink.buffers_count = point.connections_count * 2 + sink.writer_threads;
+
+		boost::ptr_vector< filelogic::raii_directory_holder<> > client_dirs;
+		boost::ptr_vector< client > clients;
+		for ( size_t idx = 0; idx < settings_.clients_count; ++idx )
+		{
+			std::ostringstream dir_name;
+			dir_name << "client-" << idx;
+			const boost::filesystem::path client_dir = work_dir_ / dir_name.str();
+			client_dirs.push_back( new filelogic::raii_directory_holder<>( client_dir ) );
+
+			clients.push_back( new client(
+				endpoint
+				, client_dir
+				, settings_.requests_count
+				, settings_.pipeline_depth
+				, point.connections_count
+				, 1
+				, settings_.format
+				, sink
+				, std::vector< std::string >()
+				, range_settings()
+				, settings_.sockets ) );
+		}
+
+		const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+
+		boost::thread_group client_threads;
+		for ( size_t idx = 0; idx < clients.size(); ++idx )
+		{
+			client_threads.create_thread( boost::bind( &client::run, &clients[ idx ] ) );
+		}
+		client_threads.join_all();
+
+		const boost::chrono::duration< double > elapsed = boost::chrono::steady_clock::now() - start;
+
+		boost::system::error_code non_err_code;
+		holder.close( non_err_code );
+		server_thread.join();
+
+		bench_run result = { elapsed.count(), 0, 0, 0.0, 0.0 };
+		latency_histogram latency;
+		for ( size_t idx = 0; idx < clients.size(); ++idx )
+		{
+			result.bytes += clients[ idx ].get_received_bytes();
+			result.files += clients[ idx ].get_received_files_count();
+			latency.merge( clients[ idx ].get_latency().get_merged() );
+		}
+
+		const size_t expected_files = settings_.requests_count * settings_.clients_count;
+		if ( result.files != expected_files )
+		{
+			std::ostringstream error;
+			error << "run of " << point.file_size << " byte files got " << result.files <<
+				" of " << expected_files << " files";
+			throw std::runtime_error( error.str() );
+		}
+
+		const double ns_in_us = 1000.0;
+		result.p50_us = latency.get_value_at_percentile( 50.0 ) / ns_in_us;
+		result.p99_us = latency.get_value_at_percentile( 99.0 ) / ns_in_us;
+
+		return result;
+	}
+
+	static void write_line( std::ostream& results, const std::string& line )
+	{
+		results << line << std::endl;
+		std::cout << line << std::endl;
+	}
+
+	static std::string get_header()
+	{
+		return "file_size,files,threads,connections,clients,repeats"
+			",mb_per_s_mean,mb_per_s_stddev,files_per_s_mean,files_per_s_stddev"
+			",p50_us_mean,p50_us_stddev,p99_us_mean,p99_us_stddev";
+	}
+
+	std::string get_row( const bench_point& point, const std::vector< bench_run >& runs ) const
+	{
+		const double bytes_in_mb = 1024.0 * 1024.0;
+
+		std::vector< double > mb_per_s;
+		std::vector< double > files_per_s;
+		std::vector< double > p50_us;
+		std::vector< double > p99_us;
+		for ( size_t idx = 0; idx < runs.size(); ++idx )
+		{
+			mb_per_s.push_back( runs[ idx ].bytes / bytes_in_mb / runs[ idx ].seconds );
+			files_per_s.push_back( runs[ idx ].files / runs[ idx ].seconds );
+			p50_us.push_back( runs[ idx ].p50_us );
+			p99_us.push_back( runs[ idx ].p99_us );
+		}
+
+		std::ostringstream row;
+		row << point.file_size << "," << point.files_count << "," << point.threads_count <<
+			"," << point.connections_count << "," << settings_.clients_count << "," << runs.size();
+
+		const std::vector< double >* columns[] = { &mb_per_s, &files_per_s, &p50_us, &p99_us };
+		for ( size_t idx = 0; idx < sizeof( columns ) / sizeof( columns[ 0 ] ); ++idx )
+		{
+			double mean = 0.0;
+			double stddev = 0.0;
+			detail::get_mean_stddev( *columns[ idx ], mean, stddev );
+			row << "," << mean << "," << stddev;
+		}
+
+		return row.str();
+	}
+
+private:
+	const bench_settings settings_;
+	const boost::filesystem::path work_dir_;
+};
+
+}
+
+#endif // BENCH_BENCH_H_
@@ -0,0 +1,159 @@
+#ifndef BENCH_BENCH_PROGRAM_OPTIONS_H_
+#define BENCH_BENCH_PROGRAM_OPTIONS_H_
+
+#include "program_options.h"
+#include "bench.h"
+#include "reply.h"
+#include "file_cache.h"
+#include "logger.h"
+#include "variable_record_header.h"
+#include "socket_tuning.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace perf
+{
+
+class bench_program_options
+{
+public:
+
+	bench_program_options(
+		int argc
+		, char* argv[]
+		, size_t file_size = 1024
+		, size_t files_count = 100
+		, size_t threads_count = 1
+		, size_t connections_count = 1
+		, size_t repeats = 3
+		, size_t clients_count = 1
+		, size_t requests_count = 1000
+		, const std::string& results_file = "perf-bench.csv"
+		, const std::string& reply_mode = "copy"
+		, size_t cache_size = 256 * 1024 * 1024
+		, size_t pipeline_depth = 1
+		, const std::string& header_format = "ascii"
+		, const std::string& log_level = "error" )
+		: help_()
+		, sweep_(
+			std::vector< size_t >( 1, file_size )
+			, std::vector< size_t >( 1, files_count )
+			, std::vector< size_t >( 1, threads_count )
+			, std::vector< size_t >( 1, connections_count ) )
+		, runs_( repeats, clients_count, requests_count, results_file )
+		, reply_mode_( reply_mode )
+		, cache_size_( cache_size )
+		, pipeline_depth_( pipeline_depth )
+		, header_format_( header_format )
+		, log_level_( log_level )
+		, socket_tuning_()
+	{
+		po::options_description desc( "Allowed options" );
+
+		desc << help_;
+		desc << sweep_;
+		desc << runs_;
+		desc << reply_mode_;
+		desc << cache_size_;
+		desc << pipeline_depth_;
+		desc << header_format_;
+		desc << log_level_;
+		desc << socket_tuning_;
+
+		help_.process( argc, argv, desc );
+		sweep_.process( argc, argv, desc );
+		runs_.process( argc, argv, desc );
+		reply_mode_.process( argc, argv, desc );
+		cache_size_.process( argc, argv, desc );
+		pipeline_depth_.process( argc, argv, desc );
+		header_format_.process( argc, argv, desc );
+		log_level_.process( argc, argv, desc );
+		socket_tuning_.process( argc, argv, desc );
+
+		check_connections();
+	}
+
+	// a run has one client and one repeat at least
+	bench_settings get_bench_settings() const
+	{
+		bench_settings settings;
+		settings.file_sizes = sweep_.get_file_sizes();
+		settings.files_counts = sweep_.get_files_counts();
+		settings.threads_counts = sweep_.get_threads_counts();
+		settings.connections_counts = sweep_.get_connections_counts();
+		settings.repeats = std::max< size_t >( runs_.get_repeats(), 1 );
+		settings.clients_count = std::max< size_t >( runs_.get_clients_count(), 1 );
+		settings.requests_count = runs_.get_requests_count();
+		settings.pipeline_depth = pipeline_depth_.get_pipeline_depth();
+		settings.mode = protocol::reply_mode_from_string( reply_mode_.get_reply_mode() );
+		settings.cache = filelogic::cache_settings( cache_size_.get_cache_size() );
+		settings.format = protocol::header_format_from_string( header_format_.get_header_format() );
+		settings.sockets = get_socket_settings();
+		settings.verbose = runs_.is_verbose();
+
+		return settings;
+	}
+
+	const std::string& get_results_file() const
+	{
+		return runs_.get_results_file();
+	}
+
+	log_level get_log_level() const
+	{
+		return log_level_from_string( log_level_.get_log_level() );
+	}
+
+	socket_settings get_socket_settings() const
+	{
+		socket_settings settings;
+		settings.send_buffer = socket_tuning_.get_send_buffer();
+		settings.receive_buffer = socket_tuning_.get_receive_buffer();
+		settings.no_delay = socket_tuning_.is_no_delay();
+		settings.quick_ack = socket_tuning_.is_quick_ack();
+		settings.busy_poll_us = socket_tuning_.get_busy_poll();
+		settings.not_sent_lowat = socket_tuning_.get_not_sent_lowat();
+		settings.zerocopy = socket_tuning_.is_zerocopy();
+
+		return settings;
+	}
+
+private:
+
+	// every connection of a client needs a file of its own to receive, the client
+	// would open fewer than the row says otherwise
+	void check_connections() const
+	{
+		const std::vector< size_t >& connections_counts = sweep_.get_connections_counts();
+		for ( size_t idx = 0; idx < connections_counts.size(); ++idx )
+		{
+			if ( connections_counts[ idx ] > runs_.get_requests_count() )
+			{
+				std::ostringstream error;
+				error << "--connections " << connections_counts[ idx ] <<
+					" is more than --requests " << runs_.get_requests_count();
+				throw std::invalid_argument( error.str() );
+			}
+		}
+	}
+
+private:
+
+	po_help help_;
+	po_bench_sweep sweep_;
+	po_bench_runs runs_;
+	po_reply_mode reply_mode_;
+	po_cache_size cache_size_;
+	po_pipeline_depth pipeline_depth_;
+	po_header_format header_format_;
+	po_log_level log_level_;
+	po_socket_tuning socket_tuning_;
+};
+
+}
+
+#endif /* BENCH_BENCH_PROGRAM_OPTIONS_H_ */
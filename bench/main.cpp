@@ -0,0 +1,48 @@
+#include <fstream>
+#include <iostream>
+#include <exception>
+#include <boost/filesystem.hpp>
+
+#include "bench_program_options.h"
+#include "common_file_logic.h"
+#include "bench.h"
+
+int main( int argc, char* argv[] )
+try
+{
+	namespace fs = boost::filesystem;
+
+	perf::bench_program_options options( argc, argv );
+
+	perf::get_logger().set_level( options.get_log_level() );
+	perf::get_logger().start();
+
+	std::ofstream results( options.get_results_file().c_str() );
+	if ( !results )
+	{
+		throw std::runtime_error( "can not open results file: " + options.get_results_file() );
+	}
+
+	// served files and client directories live here for the run only
+	const fs::path work_dir = fs::temp_directory_path() / fs::unique_path( "perf-bench-%%%%-%%%%-%%%%" );
+	const perf::filelogic::raii_directory_holder<> work_dir_holder( work_dir );
+
+	perf::bench bench( options.get_bench_settings(), work_dir );
+	bench.run( results );
+
+	perf::get_logger().stop();
+
+	return 0;
+}
+catch( perf::program_options_help& e )
+{
+	std::cout << e.what() << std::endl;
+
+	return 0;
+}
+catch( const std::exception& e )
+{
+	std::cerr << "Error occurred: " << e.what() << std::endl;
+
+	return -1;
+}
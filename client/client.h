@@ -2,8 +2,14 @@
 #define CLIENT_CLIENT_H_
 
 #include "connection.h"
+#include "range_download.h"
+#include "latency_histogram.h"
+#include "socket_tuning.h"
 
 #include <iostream>
+#include <vector>
+#include <limits>
+#include <sstream>
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
@@ -12,24 +18,122 @@
 #include <boost/thread.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/chrono/include.hpp>
 
 namespace perf
 {
+namespace detail
+{
+
+inline void print_connection_stats( const connection_stats& stats )
+{
+	std::cout << "connection " << stats.id << ( stats.failed ? " failed" : " finished" ) <<
+		" : " << stats.received_files_count << " files, " <<
+		stats.received_bytes << " bytes in " << stats.duration;
+
+	if ( stats.missing_files_count )
+	{
+		std::cout << ", " << stats.missing_files_count << " files not served";
+	}
+	std::cout << std::endl;
+}
+
+// "GET" alone when there are no names, the server picks files at random then
+inline std::vector< std::vector< char > > serialize_requests(
+	const std::vector< std::string >& file_names
+	, protocol::header_format format )
+{
+	std::vector< std::vector< char > > requests;
+
+	protocol::request req;
+	req.method = "GET";
+	protocol::variable_record request_record;
+	request_record.set_header_format( format );
+
+	for ( size_t idx = 0; idx < std::max< size_t >( file_names.size(), 1 ); ++idx )
+	{
+		if ( !file_names.empty() )
+		{
+			req.file_name = file_names[ idx ];
+		}
 
+		const size_t data_len = request_record.serialize_data( req );
+		requests.push_back( std::vector< char >(
+			request_record.get_data_buff(), request_record.get_data_buff() + data_len ) );
+	}
+
+	return requests;
+}
+
+inline void print_receive_rate(
+	size_t files_count
+	, boost::uint64_t received_data_b
+	, const boost::chrono::duration< double >& interval_sec )
+{
+	const boost::uint64_t bytes_in_mb = 1024 * 1024;
+	const boost::uint64_t received_data_bits = received_data_b * std::numeric_limits< char >::digits;
+	const double received_data_mb = double( received_data_b ) / bytes_in_mb;
+
+	std::cout << "Received " << files_count << " files, " << received_data_b << " bytes" <<
+		" : " << received_data_mb << " MB. " << std::endl;
+
+	std::cout << "Used time: " << interval_sec << std::endl;
+
+	std::cout << "Transfer rate " <<
+		double( received_data_bits ) / ( bytes_in_mb * interval_sec.count() ) << " Mbit/s" <<
+		" : " << received_data_mb / interval_sec.count() << " MB/s" <<
+		" : " << files_count / interval_sec.count() << " files/s" << std::endl;
+}
+
+}
+
+// opens connections_count connections sharing one io_service run by threads_count threads,
+// files_count_to_receive is split between the connections; with file_names given the
+// connections request those files in turn, otherwise files picked by the server. With
+// a ranged file given the connections fetch its missing ranges instead, each taking
+// every connections_count-th range
 class client
 {
 public:
+	typedef client_connection< client > connection_type;
+
 	client(
 		const boost::asio::ip::tcp::endpoint& endpoint
 		, const boost::filesystem::path& file_dir
 		, size_t files_count_to_receive
-		, unsigned int threads_count = /*boost::thread::hardware_concurrency() * 2*/1)
-		: io_service_()
+		, size_t pipeline_depth = 1
+		, size_t connections_count = 1
+		, unsigned int threads_count = /*boost::thread::hardware_concurrency() * 2*/1
+		, protocol::header_format format = protocol::ascii_header_format
+		, const sink_settings& sink = sink_settings()
+		, const std::vector< std::string >& file_names = std::vector< std::string >()
+		, const range_settings& ranges = range_settings()
+		, const socket_settings& sockets = socket_settings() )
+		: sink_( sink )
+		, io_service_()
 		, file_dir_( file_dir )
 		, files_count_to_receive_( files_count_to_receive )
+		, pipeline_depth_( pipeline_depth )
+		, connections_count_( std::max< size_t >( connections_count, 1 ) )
 		, signals_( io_service_ )
-		, threads_count_( threads_count )
+		, threads_count_( std::max< unsigned int >( threads_count, 1 ) )
+		, socket_tuner_( sockets )
 	{
+		if ( ranges.file_name.empty() )
+		{
+			requests_ = detail::serialize_requests( file_names, format );
+			// a connection left without files would wait for a reply forever
+			connections_count_ = std::min( connections_count_, files_count_to_receive_ );
+		}
+		else
+		{
+			range_download_.reset( new range_download( endpoint, ranges, format, sink_ ) );
+			requests_ = range_download_->get_requests();
+			files_count_to_receive_ = requests_.size();
+			connections_count_ = std::min( connections_count_, requests_.size() );
+		}
+
 		// system signals
 		signals_.add(SIGINT);
 		signals_.add(SIGTERM);
@@ -41,6 +145,15 @@ public:
 
 	void run()
 	{
+		start_ = boost::chrono::steady_clock::now();
+
+		if ( !connections_count_ )
+		{
+			// no files asked for or every range is there already
+			finish_ranges();
+			return;
+		}
+
 		for ( unsigned int idx = 0;  idx < threads_count_; idx++ )
 		{
 			threads_.create_thread(
@@ -48,35 +161,212 @@ public:
 		}
 
 		threads_.join_all();
+
+		// received data may be still on its way to disk
+		sink_.stop();
+		finish_ranges();
+
+		print_stats();
+		latency_.get_merged().print( std::cout );
+	}
+
+	// called by connection once it has received all its files or failed
+	void connection_finished( const connection_stats& stats )
+	{
+		boost::lock_guard< boost::mutex > lock( stats_mutex_ );
+
+		finished_connections_.push_back( stats );
+		if ( finished_connections_.size() == connections_count_ )
+		{
+			stop_ = boost::chrono::steady_clock::now();
+			io_service_.stop();
+		}
+	}
+
+	// file a reply body is written to, the ranged file is shared by all connections
+	file_sink::file_ptr open_file( const boost::filesystem::path& dir, const protocol::reply_header& header )
+	{
+		if ( range_download_ )
+		{
+			if ( !range_download_->is_range( header ) )
+			{
+				std::ostringstream error;
+				error << "reply range at " << header.offset << " is not in the file";
+				throw std::runtime_error( error.str() );
+			}
+
+			return range_download_->get_file();
+		}
+
+		boost::filesystem::path file_path( dir );
+		file_path /= header.file_name;
+
+		return sink_.open( file_path.string(), header.file_size );
+	}
+
+	void file_received( const protocol::reply_header& header )
+	{
+		if ( range_download_ )
+		{
+			range_download_->range_received( header );
+		}
+	}
+
+	// called by connection before it connects, the buffer sizes count for the window
+	// scale then; the options the first socket has got are printed
+	const socket_settings& tune_socket( int fd )
+	{
+		std::string report;
+		if ( socket_tuner_.apply( fd, report ) )
+		{
+			std::cout << "socket options " << report << std::endl;
+		}
+
+		return socket_tuner_.get_settings();
+	}
+
+	void record_latency( const boost::chrono::nanoseconds& latency )
+	{
+		latency_.record( latency );
+	}
+
+	const latency_recorder& get_latency() const
+	{
+		return latency_;
+	}
+
+	// totals of the connections which have finished, all of them once run has returned
+	size_t get_received_files_count() const
+	{
+		boost::lock_guard< boost::mutex > lock( stats_mutex_ );
+
+		size_t files_count = 0;
+		for ( size_t idx = 0; idx < finished_connections_.size(); ++idx )
+		{
+			files_count += finished_connections_[ idx ].received_files_count;
+		}
+
+		return files_count;
+	}
+
+	boost::uint64_t get_received_bytes() const
+	{
+		boost::lock_guard< boost::mutex > lock( stats_mutex_ );
+
+		boost::uint64_t received_bytes = 0;
+		for ( size_t idx = 0; idx < finished_connections_.size(); ++idx )
+		{
+			received_bytes += finished_connections_[ idx ].received_bytes;
+		}
+
+		return received_bytes;
 	}
 
 private:
 
 	void start_connect( const boost::asio::ip::tcp::endpoint& endpoint )
 	{
-		std::cout << "start connect to server" << std::endl;
+		// ranges are dealt to the connections, the named or random requests are cycled
+		const size_t requests_step = range_download_ ? connections_count_ : 1;
+
+		std::cout << "start " << connections_count_ << " connections to server" << std::endl;
+
+		for ( size_t id = 0; id < connections_count_; ++id )
+		{
+			// the remainder goes to the first connections; this is also the count of
+			// ranges dealt to the connection
+			const size_t files_count = files_count_to_receive_ / connections_count_ +
+				( id < files_count_to_receive_ % connections_count_ ? 1 : 0 );
 
-		connection::ptr new_connection(
-			new connection(
-				io_service_
-				, file_dir_
-				, files_count_to_receive_ ) );
+			// every connection saves into its own directory, so equal file names do not clash
+			std::ostringstream dir_name;
+			dir_name << "connection-" << id;
+			boost::filesystem::path connection_dir( file_dir_ );
+			connection_dir /= dir_name.str();
+			boost::filesystem::create_directory( connection_dir );
+
+			connection_type::ptr new_connection(
+				new connection_type(
+					io_service_
+					, *this
+					, sink_
+					, id
+					, connection_dir
+					, files_count
+					, requests_
+					, requests_step
+					, pipeline_depth_ ) );
+
+			new_connection->start( endpoint );
+		}
+	}
 
-		new_connection->start( endpoint );
+	void finish_ranges()
+	{
+		if ( range_download_ )
+		{
+			range_download_->save_progress( !sink_.get_write_errors() );
+		}
 	}
 
 	void handle_stop()
 	{
+		boost::lock_guard< boost::mutex > lock( stats_mutex_ );
+
+		stop_ = boost::chrono::steady_clock::now();
 		io_service_.stop();
 	}
 
+	void print_stats()
+	{
+		boost::lock_guard< boost::mutex > lock( stats_mutex_ );
+
+		size_t files_count = 0;
+		boost::uint64_t received_bytes = 0;
+
+		for ( size_t idx = 0; idx < finished_connections_.size(); ++idx )
+		{
+			const connection_stats& stats = finished_connections_[ idx ];
+			detail::print_connection_stats( stats );
+
+			files_count += stats.received_files_count;
+			received_bytes += stats.received_bytes;
+		}
+
+		if ( finished_connections_.size() < connections_count_ )
+		{
+			std::cout << connections_count_ - finished_connections_.size() <<
+				" connections have not finished" << std::endl;
+		}
+
+		detail::print_receive_rate( files_count, received_bytes, stop_ - start_ );
+
+		if ( sink_.get_settings().type != discard_sink_type )
+		{
+			std::cout << "Written " << sink_.get_written_bytes() << " bytes, " <<
+				sink_.get_write_errors() << " write errors" << std::endl;
+		}
+	}
+
 private:
+	// connections left in io_service_ give their buffers back on destruction
+	file_sink sink_;
 	boost::asio::io_service io_service_;
 	boost::filesystem::path file_dir_;
 	size_t files_count_to_receive_;
+	size_t pipeline_depth_;
+	size_t connections_count_;
 	boost::asio::signal_set signals_;
 	unsigned int threads_count_;
+	socket_tuner socket_tuner_;
+	boost::scoped_ptr< range_download > range_download_;
+	std::vector< std::vector< char > > requests_;
 	boost::thread_group threads_;
+	mutable boost::mutex stats_mutex_;
+	std::vector< connection_stats > finished_connections_;
+	boost::chrono::steady_clock::time_point start_;
+	boost::chrono::steady_clock::time_point stop_;
+	latency_recorder latency_;
 };
 
 }
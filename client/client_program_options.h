@@ -2,6 +2,15 @@
 #define CLIENT_CLIENT_PROGRAM_OPTIONS_H_
 
 #include "program_options.h"
+#include "variable_record_header.h"
+#include "file_sink.h"
+#include "range_download.h"
+#include "socket_tuning.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
 
 namespace perf
 {
@@ -15,11 +24,31 @@ public:
 		, char* argv[]
 		, const std::string& ip_address = "127.0.0.1"
 		, unsigned short port = 12345
-		, size_t file_count_to_receive = 1000 )
+		, size_t file_count_to_receive = 1000
+		, size_t pipeline_depth = 1
+		, size_t connections_count = 1
+		, size_t threads_count = 1
+		, const std::string& header_format = "ascii"
+		, const std::string& sink = "file"
+		, size_t writer_threads = 2
+		, size_t range_size = range_settings::default_range_size )
 		: help_()
 		, host_( ip_address )
 		, port_( port )
 		, file_count_to_receive_( file_count_to_receive )
+		, pipeline_depth_( pipeline_depth )
+		, connections_count_( connections_count )
+		, threads_count_( threads_count )
+		, latency_csv_()
+		, header_format_( header_format )
+		, sink_( sink )
+		, writer_threads_( writer_threads )
+		, fallocate_()
+		, request_names_()
+		, range_file_()
+		, range_size_( range_size )
+		, range_output_()
+		, socket_tuning_()
 	{
 		po::options_description desc( "Allowed options" );
 
@@ -27,11 +56,37 @@ public:
 		desc << host_;
 		desc << port_;
 		desc << file_count_to_receive_;
+		desc << pipeline_depth_;
+		desc << connections_count_;
+		desc << threads_count_;
+		desc << latency_csv_;
+		desc << header_format_;
+		desc << sink_;
+		desc << writer_threads_;
+		desc << fallocate_;
+		desc << request_names_;
+		desc << range_file_;
+		desc << range_size_;
+		desc << range_output_;
+		desc << socket_tuning_;
 
 		help_.process( argc, argv, desc );
 		host_.process( argc, argv, desc );
 		port_.process( argc, argv, desc );
 		file_count_to_receive_.process( argc, argv, desc );
+		pipeline_depth_.process( argc, argv, desc );
+		connections_count_.process( argc, argv, desc );
+		threads_count_.process( argc, argv, desc );
+		latency_csv_.process( argc, argv, desc );
+		header_format_.process( argc, argv, desc );
+		sink_.process( argc, argv, desc );
+		writer_threads_.process( argc, argv, desc );
+		fallocate_.process( argc, argv, desc );
+		request_names_.process( argc, argv, desc );
+		range_file_.process( argc, argv, desc );
+		range_size_.process( argc, argv, desc );
+		range_output_.process( argc, argv, desc );
+		socket_tuning_.process( argc, argv, desc );
 	}
 
 	boost::asio::ip::address get_ip_appdress() const
@@ -49,12 +104,118 @@ public:
 		return file_count_to_receive_.get_files_count();
 	}
 
+	size_t get_pipeline_depth() const
+	{
+		return pipeline_depth_.get_pipeline_depth();
+	}
+
+	size_t get_connections_count() const
+	{
+		return connections_count_.get_connections_count();
+	}
+
+	size_t get_threads_count() const
+	{
+		return threads_count_.get_threads_size();
+	}
+
+	const std::string& get_latency_csv() const
+	{
+		return latency_csv_.get_file_name();
+	}
+
+	protocol::header_format get_header_format() const
+	{
+		return protocol::header_format_from_string( header_format_.get_header_format() );
+	}
+
+	// two buffers per connection, one filling and one being written, plus one per writer
+	sink_settings get_sink_settings() const
+	{
+		sink_settings settings(
+			sink_type_from_string( sink_.get_sink() )
+			, writer_threads_.get_writer_threads()
+			, fallocate_.is_fallocate() );
+		settings.buffers_count = connections_count_.get_connections_count() * 2 + settings.writer_threads;
+
+		return settings;
+	}
+
+	// empty lines are skipped
+	std::vector< std::string > get_request_names() const
+	{
+		std::vector< std::string > names;
+		if ( request_names_.get_file_name().empty() )
+		{
+			return names;
+		}
+
+		std::ifstream file( request_names_.get_file_name().c_str() );
+		if ( !file )
+		{
+			throw std::runtime_error( "can not open " + request_names_.get_file_name() );
+		}
+
+		std::string name;
+		while ( std::getline( file, name ) )
+		{
+			if ( !name.empty() )
+			{
+				names.push_back( name );
+			}
+		}
+
+		return names;
+	}
+
+	// the file goes into default_dir unless an output is given
+	range_settings get_range_settings( const boost::filesystem::path& default_dir ) const
+	{
+		range_settings settings;
+		settings.file_name = range_file_.get_file_name();
+		settings.range_size = range_size_.get_range_size();
+		settings.output = range_output_.get_file_name();
+		if ( settings.output.empty() && !settings.file_name.empty() )
+		{
+			settings.output = default_dir / settings.file_name;
+		}
+
+		return settings;
+	}
+
+	socket_settings get_socket_settings() const
+	{
+		socket_settings settings;
+		settings.send_buffer = socket_tuning_.get_send_buffer();
+		settings.receive_buffer = socket_tuning_.get_receive_buffer();
+		settings.no_delay = socket_tuning_.is_no_delay();
+		settings.quick_ack = socket_tuning_.is_quick_ack();
+		settings.busy_poll_us = socket_tuning_.get_busy_poll();
+		settings.not_sent_lowat = socket_tuning_.get_not_sent_lowat();
+		settings.zerocopy = socket_tuning_.is_zerocopy();
+
+		return settings;
+	}
+
 private:
 
 	po_help help_;
 	po_host_client host_;
 	po_port_client port_;
 	po_receiver_file_count file_count_to_receive_;
+	po_pipeline_depth pipeline_depth_;
+	po_connections_count connections_count_;
+	po_threads_count threads_count_;
+	po_latency_csv latency_csv_;
+	po_header_format header_format_;
+	po_sink sink_;
+	po_writer_threads writer_threads_;
+	po_fallocate fallocate_;
+	po_request_names request_names_;
+	po_range_file range_file_;
+	po_range_size range_size_;
+	po_range_output range_output_;
+	po_socket_tuning socket_tuning_;
 };
 
 }
@@ -1,8 +1,11 @@
-#ifndef CONNECTION_H
-#define CONNECTION_H
+#ifndef CLIENT_CONNECTION_H_
+#define CLIENT_CONNECTION_H_
 
 #include "protocol_structs.h"
 #include "variable_record.h"
+#include "file_sink.h"
+#include "handler_allocator.h"
+#include "socket_tuning.h"
 
 #include <boost/bind.hpp>
 #include <boost/noncopyable.hpp>
@@ -10,9 +13,13 @@
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/chrono/include.hpp>
+#include <boost/circular_buffer.hpp>
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 namespace perf
 {
@@ -32,41 +39,103 @@ void log_error( const char* err_msg, const boost::system::error_code& err )
 	std::cout << "error: " << err_msg << ". asio error : " << err.message() << std::endl;
 }
 
-class connection
-	: public boost::enable_shared_from_this< connection >
+struct connection_stats
+{
+	size_t id;
+	// files the server has served, the missing ones are not among them
+	size_t received_files_count;
+	// requests the server has no file for
+	size_t missing_files_count;
+	boost::uint64_t received_bytes;
+	boost::chrono::duration< double > duration;
+	bool failed;
+};
+
+template< class observer >
+class client_connection
+	: public boost::enable_shared_from_this< client_connection< observer > >
 	, private boost::noncopyable
 {
 public:
-	typedef boost::shared_ptr< connection > ptr;
+	typedef boost::shared_ptr< client_connection< observer > > ptr;
 
 public:
-	connection( boost::asio::io_service& io_service
+	client_connection( boost::asio::io_service& io_service
+		, observer& observ
+		, file_sink& sink
+		, size_t id
 		, const boost::filesystem::path& file_dir
-		, size_t files_count_to_receive )
+		, size_t files_count_to_receive
+		, const std::vector< std::vector< char > >& requests
+		, size_t requests_step = 1
+		, size_t pipeline_depth = 1 )
 		: socket_( io_service )
+		, strand_( io_service )
+		, observer_( observ )
+		, stopped_( false )
+		, quick_ack_( false )
 		, file_dir_( file_dir )
 		, files_count_to_receive_( files_count_to_receive )
-		, received_files_count_()
-		, buffer_( buffer_length )
+		, pipeline_depth_( std::max< size_t >( pipeline_depth, 1 ) )
+		, sent_requests_count_()
+		, due_requests_count_()
+		, request_writing_( false )
+		, request_times_( pipeline_depth_ )
+		, requests_( requests )
+		, requests_step_( std::max< size_t >( requests_step, 1 ) )
+		, next_request_( id )
+		, sink_( sink )
+		, buffer_( 0 )
+		, file_left_( 0 )
+		, file_offset_( 0 )
 	{
 		log( "connection constructed" );
+
+		stats_.id = id;
+		stats_.received_files_count = 0;
+		stats_.missing_files_count = 0;
+		stats_.received_bytes = 0;
+		stats_.failed = false;
 	}
 
-	~connection()
+	~client_connection()
 	{
+		if ( buffer_ )
+		{
+			sink_.release_buffer( buffer_ );
+		}
+
 		log( "connection destroyed" );
 	}
 
 	void start( const boost::asio::ip::tcp::endpoint& endpoint )
 	{
+		start_ = boost::chrono::steady_clock::now();
+
+		boost::system::error_code err;
+		socket_.open( endpoint.protocol(), err );
+		if ( err )
+		{
+			log_error( "can not open socket", err );
+			stop();
+			return;
+		}
+		quick_ack_ = observer_.tune_socket( socket_.native_handle() ).quick_ack;
+
 		socket_.async_connect( endpoint
-			, boost::bind(
-					&connection::handle_connect, shared_from_this()
-			  	    , boost::asio::placeholders::error ) );
+			, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+					&client_connection::handle_connect, this->shared_from_this()
+			  	    , boost::asio::placeholders::error ) ) ) );
 	}
 
-	void stop()
+	void stop( bool failed = true )
 	{
+		if ( stopped_ )
+		{
+			return;
+		}
+		stopped_ = true;
+
 		boost::system::error_code non_err_code;
 
 		socket_.shutdown(
@@ -76,7 +145,9 @@ public:
 		socket_.close();
 		log( "connection stopped" );
 
-		socket_.get_io_service().stop();
+		stats_.duration = boost::chrono::steady_clock::now() - start_;
+		stats_.failed = failed;
+		observer_.connection_finished( stats_ );
 	}
 
 private:
@@ -85,7 +156,22 @@ private:
 		if ( !err )
 		{
 			log( "conection esteblished" );
-			do_request_write();
+
+			// no reply would ever come to wait for
+			if ( !files_count_to_receive_ )
+			{
+				stop( false );
+				return;
+			}
+
+			// fill the in-flight window, replies are read as they come
+			const size_t window = std::min( pipeline_depth_, files_count_to_receive_ );
+			for ( size_t idx = 0; idx < window; ++idx )
+			{
+				queue_request();
+			}
+
+			do_read_reply_header_length();
 		}
 		else
 		{
@@ -94,26 +180,49 @@ private:
 		}
 	}
 
+	void queue_request()
+	{
+		request_times_.push_back( boost::chrono::steady_clock::now() );
+		++sent_requests_count_;
+		++due_requests_count_;
+
+		if ( !request_writing_ )
+		{
+			do_request_write();
+		}
+	}
+
+	// requests that became due while previous write was in flight go in one write
 	void do_request_write()
 	{
-		protocol::request req;
-		req.method = "GET";
+		request_buffer_.clear();
+		for ( ; due_requests_count_; --due_requests_count_ )
+		{
+			const std::vector< char >& request = requests_[ next_request_ % requests_.size() ];
+			next_request_ += requests_step_;
+			request_buffer_.insert( request_buffer_.end(), request.begin(), request.end() );
+		}
 
-		const size_t data_len = variable_record_.serialize_data( req );
+		request_writing_ = true;
 
 		async_write(
 			socket_
-			, boost::asio::buffer( variable_record_.get_data_buff(), data_len )
-			, boost::bind(
-				&connection::handle_request_write, this->shared_from_this()
-				, boost::asio::placeholders::error ) );
+			, boost::asio::buffer( request_buffer_ )
+			, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+				&client_connection::handle_request_write, this->shared_from_this()
+				, boost::asio::placeholders::error ) ) ) );
 	}
 
 	void handle_request_write( const boost::system::error_code& err )
 	{
+		request_writing_ = false;
+
 		if ( !err )
 		{
-			do_read_reply_header_length();
+			if ( due_requests_count_ )
+			{
+				do_request_write();
+			}
 		}
 		else if ( err != boost::asio::error::operation_aborted )
 		{
@@ -130,29 +239,37 @@ private:
 			socket_
 			, boost::asio::buffer( variable_record_.get_header_buff()
 					, protocol::variable_record::header_length )
-			, boost::bind(
-					&connection::handle_read_reply_header_length, this->shared_from_this()
-					, boost::asio::placeholders::error ) );
+			, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+					&client_connection::handle_read_reply_header_length, this->shared_from_this()
+					, boost::asio::placeholders::error ) ) ) );
 	}
 
 	void handle_read_reply_header_length( const boost::system::error_code& err )
 	{
-		if ( err && err != boost::asio::error::operation_aborted )
+		if ( err )
 		{
-			log_error( "read reply header body failed", err );
+			if ( err != boost::asio::error::operation_aborted )
+			{
+				log_error( "read reply header body failed", err );
+			}
 			stop();
 			return;
 		}
 
+		if ( quick_ack_ )
+		{
+			detail::rearm_quick_ack( socket_.native_handle() );
+		}
+
 		if ( variable_record_.deserialize_header() )
 		{
 			boost::asio::async_read(
 				socket_
 				, boost::asio::buffer( variable_record_.get_body_buff()
 						, variable_record_.get_body_length() )
-				, boost::bind(
-						&connection::handle_read_reply_header_body, this->shared_from_this()
-						, boost::asio::placeholders::error ) );
+				, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+						&client_connection::handle_read_reply_header_body, this->shared_from_this()
+						, boost::asio::placeholders::error ) ) ) );
 		}
 		else
 		{
@@ -163,9 +280,12 @@ private:
 
 	void handle_read_reply_header_body( const boost::system::error_code& err )
 	{
-		if ( err && err != boost::asio::error::operation_aborted )
+		if ( err )
 		{
-			log_error( "read reply header body failed", err );
+			if ( err != boost::asio::error::operation_aborted )
+			{
+				log_error( "read reply header body failed", err );
+			}
 			stop();
 			return;
 		}
@@ -183,62 +303,161 @@ private:
 
 	void do_read_file()
 	{
-		buffer_.resize( reply_header_.file_size );
+		// a file the server does not have, nothing follows the header
+		if ( reply_header_.file_name.empty() )
+		{
+			++stats_.missing_files_count;
+			file_left_ = 0;
+			do_read_chunk();
+			return;
+		}
+
+		try
+		{
+			sink_file_ = observer_.open_file( file_dir_, reply_header_ );
+		}
+		catch ( const std::exception& e )
+		{
+			log_error( e.what() );
+			stop();
+			return;
+		}
+
+		file_left_ = reply_header_.file_size;
+		file_offset_ = reply_header_.offset;
+
+		do_read_chunk();
+	}
+
+	// file body is received into sink buffers, every full one is handed to the
+	// sink writers while receiving goes on into the next
+	void do_read_chunk()
+	{
+		if ( !file_left_ )
+		{
+			flush_buffer();
+			handle_read_file();
+			return;
+		}
+
+		if ( !buffer_ )
+		{
+			buffer_ = sink_.acquire_buffer();
+		}
+
+		const size_t length = std::min< boost::uint64_t >( file_left_, buffer_->capacity() - buffer_->size() );
 
 		boost::asio::async_read(
 			socket_
-			, boost::asio::buffer( buffer_
-					, buffer_.size() )
-			, boost::bind(
-					&connection::handle_read_file, this->shared_from_this()
-					, boost::asio::placeholders::error ) );
+			, boost::asio::buffer( buffer_->data() + buffer_->size(), length )
+			, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+					&client_connection::handle_read_chunk, this->shared_from_this()
+					, boost::asio::placeholders::error
+					, boost::asio::placeholders::bytes_transferred ) ) ) );
 	}
 
-	void handle_read_file( const boost::system::error_code& err )
+	void handle_read_chunk( const boost::system::error_code& err, size_t bytes_transferred )
 	{
-		if ( err && err != boost::asio::error::operation_aborted )
+		if ( err )
 		{
-			log_error( "read file failed", err );
+			if ( err != boost::asio::error::operation_aborted )
+			{
+				log_error( "read file failed", err );
+			}
 			stop();
 			return;
 		}
 
-		save_file();
+		buffer_->set_size( buffer_->size() + bytes_transferred );
+		file_left_ -= bytes_transferred;
+		stats_.received_bytes += bytes_transferred;
 
-		received_files_count_++;
-		if ( received_files_count_ >= files_count_to_receive_ )
+		if ( buffer_->size() == buffer_->capacity() )
 		{
-			stop();
-
-			std::cout << received_files_count_ << " files have been received" << std::endl;
+			flush_buffer();
 		}
-		else
+
+		do_read_chunk();
+	}
+
+	void flush_buffer()
+	{
+		if ( !buffer_ )
 		{
-			do_request_write();
+			return;
 		}
+
+		const size_t size = buffer_->size();
+		sink_.write( sink_file_, buffer_, file_offset_ );
+		file_offset_ += size;
+		buffer_ = 0;
 	}
 
-	void save_file()
+	void handle_read_file()
 	{
-		boost::filesystem::path f_path( file_dir_ );
-		f_path /= reply_header_.file_name;
-		std::ofstream out_file( f_path.string().c_str() );
-		out_file << std::noskipws;
-		std::ostream_iterator< char > dst( out_file );
-		std::copy( buffer_.begin(), buffer_.end(), dst );
+		observer_.record_latency( boost::chrono::steady_clock::now() - request_times_.front() );
+		request_times_.pop_front();
+
+		// file is closed by the writer which finishes last
+		sink_file_.reset();
+
+		// a file not served is counted as missing only, it is not in the received totals
+		if ( !reply_header_.file_name.empty() )
+		{
+			observer_.file_received( reply_header_ );
+			stats_.received_files_count++;
+		}
+
+		if ( stats_.received_files_count + stats_.missing_files_count >= files_count_to_receive_ )
+		{
+			stop( false );
+		}
+		else
+		{
+			if ( sent_requests_count_ < files_count_to_receive_ )
+			{
+				queue_request();
+			}
+
+			do_read_reply_header_length();
+		}
 	}
 
 private:
-	enum { buffer_length = 8192 };
 	boost::asio::ip::tcp::socket socket_;
+	boost::asio::io_service::strand strand_;
+	observer& observer_;
+	bool stopped_;
+	// TCP_QUICKACK is set again after every reply header
+	bool quick_ack_;
+	connection_stats stats_;
+	boost::chrono::steady_clock::time_point start_;
 	boost::filesystem::path file_dir_;
 	const size_t files_count_to_receive_;
-	size_t received_files_count_;
+	const size_t pipeline_depth_;
+	size_t sent_requests_count_;
+	// requested but not written to the socket yet
+	size_t due_requests_count_;
+	bool request_writing_;
+	// issue time of every request in flight, replies come in the same order
+	boost::circular_buffer< boost::chrono::steady_clock::time_point > request_times_;
+	// serialized once by the client, sent from the one at the connection id on,
+	// every requests_step_ one
+	const std::vector< std::vector< char > >& requests_;
+	const size_t requests_step_;
+	size_t next_request_;
+	std::vector< char > request_buffer_;
 	protocol::variable_record variable_record_;
 	protocol::reply_header reply_header_;
-	std::vector< char > buffer_;
+	file_sink& sink_;
+	file_sink::file_ptr sink_file_;
+	sink_buffer* buffer_;
+	boost::uint64_t file_left_;
+	boost::uint64_t file_offset_;
+	// memory of the socket operations in flight
+	handler_allocator handler_allocator_;
 };
 
 }
 
-#endif // CONNECTION_H
+#endif // CLIENT_CONNECTION_H_
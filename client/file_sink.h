@@ -0,0 +1,376 @@
+#ifndef CLIENT_FILE_SINK_H_
+#define CLIENT_FILE_SINK_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace perf
+{
+
+enum sink_type
+{
+	// received files are written with pwrite through the page cache
+	file_sink_type,
+	// as file_sink_type, but opened with O_DIRECT, page cache is bypassed
+	direct_sink_type,
+	// received data is dropped, measures the network alone
+	discard_sink_type
+};
+
+inline sink_type sink_type_from_string( const std::string& type )
+{
+	if ( type == "file" )
+	{
+		return file_sink_type;
+	}
+	else if ( type == "direct" )
+	{
+		return direct_sink_type;
+	}
+	else if ( type == "discard" )
+	{
+		return discard_sink_type;
+	}
+
+	throw std::invalid_argument( "unknown sink: " + type );
+}
+
+struct sink_settings
+{
+	// buffers are aligned and sized for O_DIRECT
+	enum { alignment = 4096 };
+
+	sink_settings(
+		sink_type sink = file_sink_type
+		, size_t writers_count = 1
+		, bool preallocate = false
+		, size_t buffer_bytes = 1024 * 1024
+		, size_t buffers = 8 )
+		: type( sink )
+		, writer_threads( writers_count )
+		, fallocate( preallocate )
+		, buffer_size( buffer_bytes )
+		, buffers_count( buffers )
+	{
+	}
+
+	sink_type type;
+	size_t writer_threads;
+	// reserve the whole file before the first write
+	bool fallocate;
+	size_t buffer_size;
+	size_t buffers_count;
+};
+
+namespace detail
+{
+
+inline void throw_errno( const std::string& what )
+{
+	throw std::runtime_error( what + ": " + strerror( errno ) );
+}
+
+}
+
+// buffer a connection fills from the socket and a writer thread writes out
+class sink_buffer
+	: private boost::noncopyable
+{
+public:
+
+	explicit sink_buffer( size_t capacity )
+		: data_( 0 )
+		, capacity_( capacity )
+		, size_( 0 )
+	{
+		void* data = 0;
+		if ( ::posix_memalign( &data, sink_settings::alignment, capacity_ ) )
+		{
+			throw std::bad_alloc();
+		}
+		data_ = static_cast< char* >( data );
+	}
+
+	~sink_buffer()
+	{
+		::free( data_ );
+	}
+
+	char* data()
+	{
+		return data_;
+	}
+
+	size_t capacity() const
+	{
+		return capacity_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	void set_size( size_t size )
+	{
+		size_ = size;
+	}
+
+private:
+
+	char* data_;
+	const size_t capacity_;
+	size_t size_;
+};
+
+// file being received; closed when the last pending write releases it
+class sink_file
+	: private boost::noncopyable
+{
+public:
+
+	sink_file( const std::string& path, boost::uint64_t file_size, bool direct, bool preallocate, bool truncate = true )
+		: fd_( -1 )
+		, file_size_( file_size )
+		, direct_( direct )
+	{
+		fd_ = ::open( path.c_str(), O_WRONLY | O_CREAT | ( truncate ? O_TRUNC : 0 ) | ( direct_ ? O_DIRECT : 0 ), 0644 );
+		if ( fd_ < 0 )
+		{
+			detail::throw_errno( "can not open " + path );
+		}
+
+		if ( preallocate && file_size_ && ::fallocate( fd_, 0, 0, file_size_ ) )
+		{
+			// not every file system supports it, writes do without
+			std::cout << "error: fallocate " << path << ": " << strerror( errno ) << std::endl;
+		}
+	}
+
+	~sink_file()
+	{
+		if ( direct_ )
+		{
+			// the last block was written padded up to the alignment
+			if ( ::ftruncate( fd_, file_size_ ) )
+			{
+				std::cout << "error: ftruncate: " << strerror( errno ) << std::endl;
+			}
+		}
+
+		::close( fd_ );
+	}
+
+	bool is_direct() const
+	{
+		return direct_;
+	}
+
+	void write( const char* data, size_t length, boost::uint64_t offset )
+	{
+		while ( length )
+		{
+			const ssize_t written = ::pwrite( fd_, data, length, offset );
+			if ( written < 0 )
+			{
+				if ( errno == EINTR )
+				{
+					continue;
+				}
+
+				detail::throw_errno( "pwrite" );
+			}
+
+			data += written;
+			length -= written;
+			offset += written;
+		}
+	}
+
+private:
+
+	int fd_;
+	const boost::uint64_t file_size_;
+	const bool direct_;
+};
+
+// write-behind stage: connections hand filled buffers over and go on receiving,
+// writer threads put them to disk with pwrite at the buffer's file offset, so
+// buffers of one file may be written in any order
+class file_sink
+	: private boost::noncopyable
+{
+public:
+
+	typedef boost::shared_ptr< sink_file > file_ptr;
+
+	explicit file_sink( const sink_settings& settings )
+		: settings_( settings )
+		, work_( new boost::asio::io_service::work( io_service_ ) )
+		, written_bytes_( 0 )
+		, write_errors_( 0 )
+	{
+		if ( settings_.buffer_size % sink_settings::alignment )
+		{
+			throw std::invalid_argument( "sink buffer size is not aligned" );
+		}
+
+		for ( size_t idx = 0; idx < std::max< size_t >( settings_.buffers_count, 1 ); ++idx )
+		{
+			buffers_.push_back( new sink_buffer( settings_.buffer_size ) );
+			free_buffers_.push_back( &buffers_.back() );
+		}
+
+		if ( settings_.type != discard_sink_type )
+		{
+			for ( size_t idx = 0; idx < std::max< size_t >( settings_.writer_threads, 1 ); ++idx )
+			{
+				writers_.create_thread(
+					boost::bind( &boost::asio::io_service::run, &io_service_ ) );
+			}
+		}
+	}
+
+	~file_sink()
+	{
+		stop();
+	}
+
+	const sink_settings& get_settings() const
+	{
+		return settings_;
+	}
+
+	// returns empty pointer for discard sink; a file opened without truncate keeps
+	// its data, parts of it are written over
+	file_ptr open( const std::string& path, boost::uint64_t file_size, bool truncate = true )
+	{
+		if ( settings_.type == discard_sink_type )
+		{
+			return file_ptr();
+		}
+
+		return file_ptr( new sink_file( path, file_size, settings_.type == direct_sink_type, settings_.fallocate, truncate ) );
+	}
+
+	// waits while all buffers are being written, this is what holds receiving back
+	// when the disk is slower than the network
+	sink_buffer* acquire_buffer()
+	{
+		boost::unique_lock< boost::mutex > lock( buffers_mutex_ );
+
+		while ( free_buffers_.empty() )
+		{
+			buffer_released_.wait( lock );
+		}
+
+		sink_buffer* buffer = free_buffers_.back();
+		free_buffers_.pop_back();
+		buffer->set_size( 0 );
+
+		return buffer;
+	}
+
+	void release_buffer( sink_buffer* buffer )
+	{
+		{
+			boost::lock_guard< boost::mutex > lock( buffers_mutex_ );
+			free_buffers_.push_back( buffer );
+		}
+
+		buffer_released_.notify_one();
+	}
+
+	// takes the buffer over, it is released once written
+	void write( const file_ptr& file, sink_buffer* buffer, boost::uint64_t offset )
+	{
+		if ( !file )
+		{
+			release_buffer( buffer );
+			return;
+		}
+
+		io_service_.post(
+			boost::bind( &file_sink::write_buffer, this, file, buffer, offset ) );
+	}
+
+	// waits for queued writes to finish
+	void stop()
+	{
+		work_.reset();
+		writers_.join_all();
+	}
+
+	boost::uint64_t get_written_bytes() const
+	{
+		return written_bytes_.load();
+	}
+
+	size_t get_write_errors() const
+	{
+		return write_errors_.load();
+	}
+
+private:
+
+	void write_buffer( file_ptr file, sink_buffer* buffer, boost::uint64_t offset )
+	{
+		size_t length = buffer->size();
+		if ( file->is_direct() )
+		{
+			// O_DIRECT takes whole blocks only, the tail is padded and cut off on close
+			const size_t aligned = ( length + sink_settings::alignment - 1 ) / sink_settings::alignment * sink_settings::alignment;
+			memset( buffer->data() + length, 0, aligned - length );
+			length = aligned;
+		}
+
+		try
+		{
+			file->write( buffer->data(), length, offset );
+			written_bytes_ += buffer->size();
+		}
+		catch ( const std::exception& e )
+		{
+			std::cout << "error: " << e.what() << std::endl;
+			++write_errors_;
+		}
+
+		release_buffer( buffer );
+	}
+
+private:
+
+	const sink_settings settings_;
+	boost::asio::io_service io_service_;
+	boost::scoped_ptr< boost::asio::io_service::work > work_;
+	boost::thread_group writers_;
+	boost::ptr_vector< sink_buffer > buffers_;
+	boost::mutex buffers_mutex_;
+	boost::condition_variable buffer_released_;
+	std::vector< sink_buffer* > free_buffers_;
+	boost::atomic< boost::uint64_t > written_bytes_;
+	boost::atomic< size_t > write_errors_;
+};
+
+}
+
+#endif // CLIENT_FILE_SINK_H_
@@ -29,9 +29,25 @@ try
 		options.get_ip_appdress()
 		, options.get_port() );
 
-	perf::client client( endpoint, file_working_dir, options.get_files_count_to_receive() );
+	perf::client client(
+		endpoint
+		, file_working_dir
+		, options.get_files_count_to_receive()
+		, options.get_pipeline_depth()
+		, options.get_connections_count()
+		, options.get_threads_count()
+		, options.get_header_format()
+		, options.get_sink_settings()
+		, options.get_request_names()
+		, options.get_range_settings( client_base_path )
+		, options.get_socket_settings() );
 	client.run();
 
+	if ( !options.get_latency_csv().empty() )
+	{
+		save_latency_csv( client.get_latency().get_merged(), options.get_latency_csv() );
+	}
+
 	return 0;
 }
 catch( perf::program_options_help& e )
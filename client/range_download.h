@@ -0,0 +1,272 @@
+#ifndef CLIENT_RANGE_DOWNLOAD_H_
+#define CLIENT_RANGE_DOWNLOAD_H_
+
+#include "protocol_structs.h"
+#include "variable_record.h"
+#include "file_sink.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+
+namespace perf
+{
+
+struct range_settings
+{
+	enum { default_range_size = 8 * 1024 * 1024 };
+
+	range_settings()
+		: range_size( default_range_size )
+	{
+	}
+
+	// no ranged download when empty
+	std::string file_name;
+	boost::uint64_t range_size;
+	boost::filesystem::path output;
+};
+
+namespace detail
+{
+
+// asks for a range past the end of the file, the reply has no body and tells
+// the size of the file
+inline protocol::reply_header probe_file(
+	boost::asio::ip::tcp::socket& socket
+	, const boost::asio::ip::tcp::endpoint& endpoint
+	, const std::string& file_name
+	, protocol::header_format format )
+{
+	socket.connect( endpoint );
+
+	protocol::request req( "GET" );
+	req.file_name = file_name;
+	req.offset = boost::uint64_t( -1 );
+
+	protocol::variable_record request_record;
+	request_record.set_header_format( format );
+	const size_t request_length = request_record.serialize_data( req );
+	boost::asio::write( socket, boost::asio::buffer( request_record.get_data_buff(), request_length ) );
+
+	protocol::variable_record reply_record;
+	protocol::reply_header header;
+	boost::asio::read( socket, boost::asio::buffer( reply_record.get_header_buff(), protocol::variable_record::header_length ) );
+	if ( !reply_record.deserialize_header() )
+	{
+		throw std::runtime_error( "probe of " + file_name + ": bad reply header" );
+	}
+
+	boost::asio::read( socket, boost::asio::buffer( reply_record.get_body_buff(), reply_record.get_body_length() ) );
+	if ( !reply_record.deserialize_body( header ) )
+	{
+		throw std::runtime_error( "probe of " + file_name + ": bad reply header" );
+	}
+
+	if ( header.file_name.empty() )
+	{
+		throw std::runtime_error( file_name + " is not served" );
+	}
+
+	return header;
+}
+
+}
+
+// one file fetched as ranges of range_size bytes, spread over the connections and
+// written into one output file at their offsets. Received ranges are recorded in
+// <output>.ranges when the run ends unfinished, a later run with the same output
+// asks only for the ranges missing; the record is dropped once the file is whole
+class range_download
+	: private boost::noncopyable
+{
+public:
+
+	range_download(
+		const boost::asio::ip::tcp::endpoint& endpoint
+		, const range_settings& settings
+		, protocol::header_format format
+		, file_sink& sink )
+		: settings_( settings )
+		, probe_socket_( io_service_ )
+		, total_size_( 0 )
+		, progress_path_( settings.output.string() + ".ranges" )
+	{
+		// O_DIRECT writes go whole blocks at block aligned offsets
+		settings_.range_size = std::max< boost::uint64_t >( settings_.range_size, sink_settings::alignment );
+		settings_.range_size = ( settings_.range_size + sink_settings::alignment - 1 ) / sink_settings::alignment * sink_settings::alignment;
+
+		// the server stops once its last connection is closed, the probe connection
+		// is held until the download is over
+		total_size_ = detail::probe_file( probe_socket_, endpoint, settings_.file_name, format ).total_size;
+
+		const size_t ranges_count = size_t( ( total_size_ + settings_.range_size - 1 ) / settings_.range_size );
+		received_.assign( ranges_count, false );
+		const bool resumed = load_progress();
+
+		size_t pending_count = 0;
+		protocol::request req( "GET" );
+		req.file_name = settings_.file_name;
+		protocol::variable_record request_record;
+		request_record.set_header_format( format );
+		for ( size_t idx = 0; idx < ranges_count; ++idx )
+		{
+			if ( received_[ idx ] )
+			{
+				continue;
+			}
+
+			req.offset = idx * settings_.range_size;
+			req.length = std::min( settings_.range_size, total_size_ - req.offset );
+			const size_t data_len = request_record.serialize_data( req );
+			requests_.push_back( std::vector< char >(
+				request_record.get_data_buff(), request_record.get_data_buff() + data_len ) );
+			++pending_count;
+		}
+
+		std::cout << settings_.file_name << ": " << total_size_ << " bytes in " << ranges_count <<
+			" ranges, " << pending_count << " to fetch" << std::endl;
+
+		// a resumed file keeps what it has
+		file_ = sink.open( settings_.output.string(), total_size_, !resumed );
+	}
+
+	// serialized requests of the ranges still missing
+	const std::vector< std::vector< char > >& get_requests() const
+	{
+		return requests_;
+	}
+
+	const file_sink::file_ptr& get_file() const
+	{
+		return file_;
+	}
+
+	// the offset comes from the server, a range which is not one of the file's is
+	// neither written nor marked
+	bool is_range( const protocol::reply_header& header ) const
+	{
+		return header.offset < total_size_ && !( header.offset % settings_.range_size );
+	}
+
+	void range_received( const protocol::reply_header& header )
+	{
+		if ( !is_range( header ) )
+		{
+			std::cout << "error: no range at " << header.offset << std::endl;
+			return;
+		}
+
+		if ( header.file_size != std::min( settings_.range_size, total_size_ - header.offset ) )
+		{
+			// file has changed on the server, the range is fetched again next time
+			std::cout << "error: range at " << header.offset << " came short" << std::endl;
+			return;
+		}
+
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+		received_[ size_t( header.offset / settings_.range_size ) ] = true;
+	}
+
+	// after the sink has written everything out; nothing is recorded when writes failed
+	void save_progress( bool written )
+	{
+		file_.reset();
+
+		boost::system::error_code non_err_code;
+		probe_socket_.close( non_err_code );
+
+		if ( !written )
+		{
+			return;
+		}
+
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		size_t received_count = 0;
+		for ( size_t idx = 0; idx < received_.size(); ++idx )
+		{
+			received_count += received_[ idx ];
+		}
+
+		if ( received_count == received_.size() )
+		{
+			boost::system::error_code err;
+			boost::filesystem::remove( progress_path_, err );
+			std::cout << settings_.output.string() << " is complete" << std::endl;
+			return;
+		}
+
+		std::ofstream progress( progress_path_.string().c_str() );
+		progress << total_size_ << " " << settings_.range_size << "\n";
+		for ( size_t idx = 0; idx < received_.size(); ++idx )
+		{
+			if ( received_[ idx ] )
+			{
+				progress << idx << "\n";
+			}
+		}
+
+		std::cout << settings_.output.string() << ": " << received_count << " of " << received_.size() <<
+			" ranges received, run again to fetch the rest" << std::endl;
+	}
+
+private:
+
+	// false when there is nothing to resume from
+	bool load_progress()
+	{
+		if ( !boost::filesystem::exists( settings_.output ) )
+		{
+			return false;
+		}
+
+		std::ifstream progress( progress_path_.string().c_str() );
+		boost::uint64_t total_size = 0;
+		boost::uint64_t range_size = 0;
+		if ( !( progress >> total_size >> range_size ) )
+		{
+			return false;
+		}
+
+		// the file or the split has changed, start over
+		if ( total_size != total_size_ || range_size != settings_.range_size )
+		{
+			return false;
+		}
+
+		size_t idx = 0;
+		while ( progress >> idx )
+		{
+			if ( idx < received_.size() )
+			{
+				received_[ idx ] = true;
+			}
+		}
+
+		return true;
+	}
+
+private:
+	range_settings settings_;
+	boost::asio::io_service io_service_;
+	boost::asio::ip::tcp::socket probe_socket_;
+	boost::uint64_t total_size_;
+	const boost::filesystem::path progress_path_;
+	std::vector< std::vector< char > > requests_;
+	file_sink::file_ptr file_;
+	boost::mutex mutex_;
+	std::vector< bool > received_;
+};
+
+}
+
+#endif // CLIENT_RANGE_DOWNLOAD_H_
@@ -16,17 +16,106 @@ namespace perf
 namespace protocol
 {
 
+// body is the method alone, "GET" asks for a file picked at random, or the method,
+// a space and a file name, "GET <name>"; a part of the file is asked for with a range
+// between the two, "GET range=<offset>,<length> <name>", length 0 is up to the end
 struct request
 {
+     // { "GET" } still reads as a request of the whole file
+     request( const std::string& request_method = std::string() )
+          : method( request_method )
+          , offset( 0 )
+          , length( 0 )
+     {
+     }
+
+     bool has_range() const
+     {
+          return offset || length;
+     }
+
      std::string method;
+     std::string file_name;
+     boost::uint64_t offset;
+     boost::uint64_t length;
 };
 
+// file_size bytes of the file starting from offset follow the header, the file
+// itself is total_size long; a range past the end gets no bytes and the total size
 struct reply_header
 {
-	boost::uint32_t file_size;
+	boost::uint64_t file_size;
 	std::string file_name;
+	boost::uint64_t offset;
+	boost::uint64_t total_size;
 };
 
+namespace detail
+{
+
+// 64 bit value in network byte order
+inline void write_uint64( boost::uint64_t value, char* buffer )
+{
+	for ( int idx = 7; idx >= 0; --idx, value >>= 8 )
+	{
+		buffer[ idx ] = char( value & 0xff );
+	}
+}
+
+inline boost::uint64_t read_uint64( const char* buffer )
+{
+	boost::uint64_t value = 0;
+	for ( int idx = 0; idx < 8; ++idx )
+	{
+		value = ( value << 8 ) | static_cast< unsigned char >( buffer[ idx ] );
+	}
+
+	return value;
+}
+
+// decimal digits up to end or the first other character; false when there are none
+// or the value does not fit
+inline bool parse_uint64( const char*& pos, const char* end, boost::uint64_t& value )
+{
+	const char* const start = pos;
+	value = 0;
+	for ( ; pos != end && *pos >= '0' && *pos <= '9'; ++pos )
+	{
+		const boost::uint64_t digit = *pos - '0';
+		if ( value > ( boost::uint64_t( -1 ) - digit ) / 10 )
+		{
+			return false;
+		}
+		value = value * 10 + digit;
+	}
+
+	return pos != start;
+}
+
+inline char* format_uint64( boost::uint64_t value, char* buffer )
+{
+	char digits[ 20 ];
+	size_t count = 0;
+	do
+	{
+		digits[ count++ ] = char( '0' + value % 10 );
+		value /= 10;
+	}
+	while ( value );
+
+	while ( count )
+	{
+		*buffer++ = digits[ --count ];
+	}
+
+	return buffer;
+}
+
+const char range_prefix[] = "range=";
+const size_t range_prefix_length = sizeof( range_prefix ) - 1;
+
+}
+
 template < class T >
 size_t deserialize( T& data, const char* buffer, size_t buff_length )
 {
@@ -43,10 +132,40 @@ size_t serialize( const T& data, char* buffer, size_t buff_length )
 	return 0;
 }
 
+// strings of a request kept between requests keep their capacity; a malformed
+// range gives 0
 template <>
 size_t deserialize< request >( request& data, const char* buffer, size_t buff_length )
 {
-	data.method.assign( buffer, buffer + buff_length );
+	const char* const end = buffer + buff_length;
+	const char* pos = std::find( buffer, end, ' ' );
+
+	data.method.assign( buffer, pos );
+	data.offset = 0;
+	data.length = 0;
+
+	if ( pos != end
+		&& size_t( end - pos - 1 ) >= detail::range_prefix_length
+		&& !memcmp( pos + 1, detail::range_prefix, detail::range_prefix_length ) )
+	{
+		pos += 1 + detail::range_prefix_length;
+		if ( !detail::parse_uint64( pos, end, data.offset )
+			|| pos == end || *pos++ != ','
+			|| !detail::parse_uint64( pos, end, data.length )
+			|| ( pos != end && *pos != ' ' ) )
+		{
+			return 0;
+		}
+	}
+
+	if ( pos != end )
+	{
+		data.file_name.assign( pos + 1, end );
+	}
+	else
+	{
+		data.file_name.clear();
+	}
 
 	return buff_length;
 }
@@ -54,28 +173,49 @@ size_t deserialize< request >( request& data, const char* buffer, size_t buff_le
 template <>
 size_t serialize< request >( const request& data, char* buffer, size_t buff_length )
 {
-	if ( data.method.length() > buff_length )
+	// longest range token: a space, the prefix, two 20 digit numbers and a comma
+	const size_t range_length = data.has_range() ? 1 + detail::range_prefix_length + 20 + 1 + 20 : 0;
+	const size_t name_length = data.file_name.empty() ? 0 : data.file_name.length() + 1;
+	if ( data.method.length() + range_length + name_length > buff_length )
 	{
 		throw std::invalid_argument( "buffer too small" );
 	}
 
-	std::copy( data.method.begin(), data.method.end(), buffer );
+	char* pos = std::copy( data.method.begin(), data.method.end(), buffer );
+	if ( data.has_range() )
+	{
+		*pos++ = ' ';
+		pos = std::copy( detail::range_prefix, detail::range_prefix + detail::range_prefix_length, pos );
+		pos = detail::format_uint64( data.offset, pos );
+		*pos++ = ',';
+		pos = detail::format_uint64( data.length, pos );
+	}
+
+	if ( name_length )
+	{
+		*pos++ = ' ';
+		pos = std::copy( data.file_name.begin(), data.file_name.end(), pos );
+	}
 
-	return data.method.length();
+	return pos - buffer;
 }
 
 template <>
 size_t deserialize< reply_header >( reply_header& data, const char* buffer, size_t buff_length )
 {
-	size_t left_length = buff_length;
-	const size_t f_size_len = sizeof( data.file_size );
+	const size_t sizes_len = sizeof( data.file_size ) + sizeof( data.offset ) + sizeof( data.total_size );
+
+	if ( buff_length < sizes_len )
+	{
+		return 0;
+	}
 
-	memcpy( &data.file_size, buffer, f_size_len );
-	data.file_size = ntohl( data.file_size );
-	left_length -= f_size_len;
+	data.file_size = detail::read_uint64( buffer );
+	data.offset = detail::read_uint64( buffer + 8 );
+	data.total_size = detail::read_uint64( buffer + 16 );
 
-	const char* file_name_buff = buffer + sizeof( data.file_size );
-	data.file_name.assign( file_name_buff, file_name_buff + left_length );
+	const char* file_name_buff = buffer + sizes_len;
+	data.file_name.assign( file_name_buff, buffer + buff_length );
 
 	return buff_length;
 }
@@ -83,20 +223,21 @@ size_t deserialize< reply_header >( reply_header& data, const char* buffer, size
 template <>
 size_t serialize< reply_header >( const reply_header& data, char* buffer, size_t buff_length )
 {
-	const size_t f_size_len = sizeof( data.file_size );
+	const size_t sizes_len = sizeof( data.file_size ) + sizeof( data.offset ) + sizeof( data.total_size );
 
-	if ( f_size_len + data.file_name.length() > buff_length )
+	if ( sizes_len + data.file_name.length() > buff_length )
 	{
 		throw std::invalid_argument( "buffer too small" );
 	}
 
-	const uint32_t f_size = htonl( data.file_size );
-	memcpy( buffer, &f_size, f_size_len );
-	buffer += f_size_len;
+	detail::write_uint64( data.file_size, buffer );
+	detail::write_uint64( data.offset, buffer + 8 );
+	detail::write_uint64( data.total_size, buffer + 16 );
+	buffer += sizes_len;
 
 	std::copy( data.file_name.begin(), data.file_name.end(), buffer );
 
-	return f_size_len + data.file_name.length();
+	return sizes_len + data.file_name.length();
 }
 
 }
@@ -43,6 +43,17 @@ public:
 		return header_.deserialize( buffer_, header_length );
 	}
 
+	// format of the last deserialized header, used for serialization as well
+	header_format get_header_format() const
+	{
+		return header_.get_format();
+	}
+
+	void set_header_format( header_format format )
+	{
+		header_.set_format( format );
+	}
+
 	size_t get_body_length() const
 	{
 	    return header_.get_body_length();
@@ -110,6 +121,16 @@ public:
 		return impl_.deserialize_header();
 	}
 
+	header_format get_header_format() const
+	{
+		return impl_.get_header_format();
+	}
+
+	void set_header_format( header_format format )
+	{
+		impl_.set_header_format( format );
+	}
+
 	size_t get_body_length() const
 	{
 	    return impl_.get_body_length();
@@ -1,123 +1,236 @@
-#ifndef variable_record_header_h__
-#define variable_record_header_h__
-
-#include <memory.h>
-#include <string>
-#include <vector>
-#include <sstream>
-#include <stdexcept>
-#include <boost/logic/tribool.hpp>
-
-namespace perf
-{
-namespace protocol
-{
-
-class variable_record_header
-{
-public:
-
-     enum { prefix_length = 4, size_length = 4, full_length = 8 };
-
-     variable_record_header( size_t max_body_length )
-          : max_body_length_( max_body_length )
-          , body_length_()
-     {
-     }
-
-     size_t get_body_length() const
-     {
-          return body_length_;
-     }
-
-     boost::tribool deserialize( const char* data, size_t data_length )
-     {         
-          clean();
-          
-          if ( data_length < full_length )
-          {
-               // need some data
-               return boost::indeterminate;
-          }
-
-          const std::string header( data, data + full_length );
-
-          const std::string& prefix = header.substr( 0, prefix_length );
-
-          if ( prefix != prefix_ )
-          {
-               return false;
-          }
-
-          const std::string& str_len = header.substr( prefix_length, size_length );
-
-          unsigned short int body_len = 0;
-          
-          std::stringstream sstream;
-          sstream << str_len;
-          sstream >> body_len;
-          
-          if ( body_len > max_body_length_ )
-          {
-               return false;
-          }
-
-          body_length_ = body_len;
-
-          return true;
-     }
-     
-     bool serialize( size_t body_len, char* buff, size_t buff_length )
-     {
-          clean();
-
-    	  if ( buff_length < full_length ||
-    		   !check_body_length( body_len ) )
-          {
-               false;
-          }
-
-          std::stringstream sstream;
-          sstream << prefix_;
-          sstream.width( size_length );
-          sstream << body_len;
-
-          memcpy( buff, sstream.str().c_str(), full_length );
-          
-          return true;
-     }
-
-     std::vector< char > serialize( size_t body_len )
-     {
-          std::vector< char > buff( full_length );
-
-          serialize( body_len, &buff[ 0 ], buff.size() );
-
-          return buff;
-     }
-
-private:
-
-     bool check_body_length( size_t body_len )
-     {
-    	 return body_len <= max_body_length_;
-     }
-
-     void clean()
-     {
-          body_length_ = 0;
-     }
-
-private:
-
-     const size_t max_body_length_;
-     size_t body_length_;
-     static std::string prefix_;
-};
-
-std::string variable_record_header::prefix_( "MSGN" );
-
-}
-}
-
-#endif // variable_record_header_h__
+#ifndef variable_record_header_h__
+#define variable_record_header_h__
+
+#include <memory.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <boost/cstdint.hpp>
+#include <boost/logic/tribool.hpp>
+
+namespace perf
+{
+namespace protocol
+{
+
+enum header_format
+{
+     // "MSGN" followed by the body length as four ascii digits padded with spaces
+     ascii_header_format,
+     // magic, version, flags and the body length as 32 bit integer in network byte order
+     binary_header_format
+};
+
+inline header_format header_format_from_string( const std::string& format )
+{
+     if ( format == "ascii" )
+     {
+          return ascii_header_format;
+     }
+     else if ( format == "binary" )
+     {
+          return binary_header_format;
+     }
+
+     throw std::invalid_argument( "unknown header format: " + format );
+}
+
+// both formats are full_length bytes long, deserialize recognises the format by
+// the leading bytes and keeps it, so a reply can be written the way the request came
+class variable_record_header
+{
+public:
+
+     enum { prefix_length = 4, size_length = 4, full_length = 8 };
+
+     enum { binary_magic_0 = 'P', binary_magic_1 = 'F', binary_version = 1 };
+
+     variable_record_header( size_t max_body_length, header_format format = ascii_header_format )
+          : max_body_length_( max_body_length )
+          , body_length_()
+          , format_( format )
+     {
+     }
+
+     size_t get_body_length() const
+     {
+          return body_length_;
+     }
+
+     header_format get_format() const
+     {
+          return format_;
+     }
+
+     void set_format( header_format format )
+     {
+          format_ = format;
+     }
+
+     boost::tribool deserialize( const char* data, size_t data_length )
+     {
+          clean();
+
+          if ( data_length < full_length )
+          {
+               // need some data
+               return boost::indeterminate;
+          }
+
+          if ( !memcmp( data, prefix_, prefix_length ) )
+          {
+               format_ = ascii_header_format;
+               return deserialize_ascii( data );
+          }
+
+          if ( data[ 0 ] == binary_magic_0 && data[ 1 ] == binary_magic_1 )
+          {
+               format_ = binary_header_format;
+               return deserialize_binary( data );
+          }
+
+          return false;
+     }
+
+     bool serialize( size_t body_len, char* buff, size_t buff_length )
+     {
+          clean();
+
+          if ( buff_length < full_length ||
+               !check_body_length( body_len ) )
+          {
+               return false;
+          }
+
+          if ( format_ == binary_header_format )
+          {
+               serialize_binary( body_len, buff );
+          }
+          else
+          {
+               serialize_ascii( body_len, buff );
+          }
+
+          return true;
+     }
+
+     std::vector< char > serialize( size_t body_len )
+     {
+          std::vector< char > buff( full_length );
+
+          serialize( body_len, &buff[ 0 ], buff.size() );
+
+          return buff;
+     }
+
+private:
+
+     bool deserialize_ascii( const char* data )
+     {
+          const char* pos = data + prefix_length;
+          const char* const end = pos + size_length;
+
+          while ( pos != end && *pos == ' ' )
+          {
+               ++pos;
+          }
+
+          if ( pos == end )
+          {
+               return false;
+          }
+
+          size_t body_len = 0;
+          for ( ; pos != end && *pos >= '0' && *pos <= '9'; ++pos )
+          {
+               body_len = body_len * 10 + ( *pos - '0' );
+          }
+
+          // the digits run to the end of the field, "MSGN 12x" is no header
+          if ( pos != end || !check_body_length( body_len ) )
+          {
+               return false;
+          }
+
+          body_length_ = body_len;
+
+          return true;
+     }
+
+     bool deserialize_binary( const char* data )
+     {
+          if ( data[ 2 ] != binary_version )
+          {
+               return false;
+          }
+
+          // data[ 3 ] holds flags, none is defined yet
+          boost::uint32_t body_len = 0;
+          memcpy( &body_len, data + 4, sizeof( body_len ) );
+          body_len = ntohl( body_len );
+
+          if ( !check_body_length( body_len ) )
+          {
+               return false;
+          }
+
+          body_length_ = body_len;
+
+          return true;
+     }
+
+     void serialize_ascii( size_t body_len, char* buff )
+     {
+          memcpy( buff, prefix_, prefix_length );
+
+          // right aligned as std::setw would do
+          char* pos = buff + full_length;
+          do
+          {
+               *--pos = char( '0' + body_len % 10 );
+               body_len /= 10;
+          }
+          while ( body_len && pos != buff + prefix_length );
+
+          while ( pos != buff + prefix_length )
+          {
+               *--pos = ' ';
+          }
+     }
+
+     void serialize_binary( size_t body_len, char* buff )
+     {
+          buff[ 0 ] = binary_magic_0;
+          buff[ 1 ] = binary_magic_1;
+          buff[ 2 ] = binary_version;
+          buff[ 3 ] = 0;
+
+          const boost::uint32_t len = htonl( boost::uint32_t( body_len ) );
+          memcpy( buff + 4, &len, sizeof( len ) );
+     }
+
+     bool check_body_length( size_t body_len )
+     {
+    	 return body_len <= max_body_length_;
+     }
+
+     void clean()
+     {
+          body_length_ = 0;
+     }
+
+private:
+
+     const size_t max_body_length_;
+     size_t body_length_;
+     header_format format_;
+     static const char prefix_[ prefix_length + 1 ];
+};
+
+const char variable_record_header::prefix_[ prefix_length + 1 ] = "MSGN";
+
+}
+}
+
+#endif // variable_record_header_h__
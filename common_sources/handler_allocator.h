@@ -0,0 +1,136 @@
+#ifndef COMMON_HANDLER_ALLOCATOR_H_
+#define COMMON_HANDLER_ALLOCATOR_H_
+
+#include <cstddef>
+#include <new>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/aligned_storage.hpp>
+
+namespace perf
+{
+
+// fixed arena for the operations in flight on one connection; asio takes the memory
+// for every async operation and strand dispatch through the handler allocation hooks,
+// so with handlers made by make_custom_alloc_handler steady state I/O does not touch
+// the heap. A slot is freed before its handler runs, so a read, a write and a strand
+// dispatch fit at once; anything larger or beyond that goes to operator new
+class handler_allocator
+	: private boost::noncopyable
+{
+public:
+
+	enum { slots_count = 4, slot_size = 512 };
+
+	handler_allocator()
+		: fallbacks_( 0 )
+	{
+		for ( size_t idx = 0; idx < slots_count; ++idx )
+		{
+			in_use_[ idx ].store( false, boost::memory_order_relaxed );
+		}
+	}
+
+	// operations of one connection complete on any io thread
+	void* allocate( std::size_t size )
+	{
+		if ( size <= slot_size )
+		{
+			for ( size_t idx = 0; idx < slots_count; ++idx )
+			{
+				if ( !in_use_[ idx ].exchange( true, boost::memory_order_acquire ) )
+				{
+					return storage_[ idx ].address();
+				}
+			}
+		}
+
+		fallbacks_.fetch_add( 1, boost::memory_order_relaxed );
+
+		return ::operator new( size );
+	}
+
+	void deallocate( void* pointer )
+	{
+		for ( size_t idx = 0; idx < slots_count; ++idx )
+		{
+			if ( pointer == storage_[ idx ].address() )
+			{
+				in_use_[ idx ].store( false, boost::memory_order_release );
+				return;
+			}
+		}
+
+		::operator delete( pointer );
+	}
+
+	// allocations that did not fit the arena
+	boost::uint64_t get_fallbacks() const
+	{
+		return fallbacks_.load( boost::memory_order_relaxed );
+	}
+
+private:
+
+	boost::aligned_storage< slot_size > storage_[ slots_count ];
+	boost::atomic< bool > in_use_[ slots_count ];
+	boost::atomic< boost::uint64_t > fallbacks_;
+};
+
+// passes calls through to the wrapped handler and points asio's allocation hooks
+// at the allocator; has to be inside strand wrap, which forwards the hooks
+template< class handler >
+class custom_alloc_handler
+{
+public:
+
+	custom_alloc_handler( handler_allocator& allocator, const handler& h )
+		: allocator_( &allocator )
+		, handler_( h )
+	{
+	}
+
+	void operator()()
+	{
+		handler_();
+	}
+
+	template< class arg1 >
+	void operator()( const arg1& a1 )
+	{
+		handler_( a1 );
+	}
+
+	template< class arg1, class arg2 >
+	void operator()( const arg1& a1, const arg2& a2 )
+	{
+		handler_( a1, a2 );
+	}
+
+	friend void* asio_handler_allocate( std::size_t size, custom_alloc_handler< handler >* this_handler )
+	{
+		return this_handler->allocator_->allocate( size );
+	}
+
+	friend void asio_handler_deallocate( void* pointer, std::size_t, custom_alloc_handler< handler >* this_handler )
+	{
+		this_handler->allocator_->deallocate( pointer );
+	}
+
+private:
+
+	handler_allocator* allocator_;
+	handler handler_;
+};
+
+template< class handler >
+inline custom_alloc_handler< handler > make_custom_alloc_handler( handler_allocator& allocator, const handler& h )
+{
+	return custom_alloc_handler< handler >( allocator, h );
+}
+
+}
+
+#endif // COMMON_HANDLER_ALLOCATOR_H_
@@ -0,0 +1,274 @@
+#ifndef COMMON_LATENCY_HISTOGRAM_H_
+#define COMMON_LATENCY_HISTOGRAM_H_
+
+#include <vector>
+#include <limits>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/chrono/include.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace perf
+{
+
+// log-linear histogram of nanosecond values in the manner of HdrHistogram: every power
+// of two range is split into sub_bucket_half_count linear buckets, so a reported value
+// is off by less than 1 / sub_bucket_half_count of itself; not thread safe
+class latency_histogram
+{
+public:
+
+	enum
+	{
+		sub_bucket_bits = 7
+		, sub_bucket_count = 1 << sub_bucket_bits
+		, sub_bucket_half_count = sub_bucket_count / 2
+		// larger values are clamped, 2^44 ns is almost five hours
+		, max_value_bits = 44
+		, buckets_count = ( max_value_bits - sub_bucket_bits + 2 ) * sub_bucket_half_count
+	};
+
+	latency_histogram()
+		: counts_( buckets_count )
+		, total_count_( 0 )
+		, min_( std::numeric_limits< boost::uint64_t >::max() )
+		, max_( 0 )
+	{
+	}
+
+	void record( boost::uint64_t value_ns )
+	{
+		const boost::uint64_t max_trackable = ( boost::uint64_t( 1 ) << max_value_bits ) - 1;
+		value_ns = std::min( value_ns, max_trackable );
+
+		++counts_[ bucket_index( value_ns ) ];
+		++total_count_;
+		min_ = std::min( min_, value_ns );
+		max_ = std::max( max_, value_ns );
+	}
+
+	void merge( const latency_histogram& other )
+	{
+		for ( size_t idx = 0; idx < counts_.size(); ++idx )
+		{
+			counts_[ idx ] += other.counts_[ idx ];
+		}
+
+		total_count_ += other.total_count_;
+		min_ = std::min( min_, other.min_ );
+		max_ = std::max( max_, other.max_ );
+	}
+
+	boost::uint64_t get_total_count() const
+	{
+		return total_count_;
+	}
+
+	boost::uint64_t get_min() const
+	{
+		return total_count_ ? min_ : 0;
+	}
+
+	boost::uint64_t get_max() const
+	{
+		return max_;
+	}
+
+	// highest value of the bucket holding the percentile, never above the recorded max
+	boost::uint64_t get_value_at_percentile( double percentile ) const
+	{
+		if ( !total_count_ )
+		{
+			return 0;
+		}
+
+		const double requested = std::min( std::max( percentile, 0.0 ), 100.0 ) / 100.0;
+		const boost::uint64_t target =
+			std::max< boost::uint64_t >( boost::uint64_t( requested * total_count_ + 0.5 ), 1 );
+
+		boost::uint64_t cumulative = 0;
+		for ( size_t idx = 0; idx < counts_.size(); ++idx )
+		{
+			cumulative += counts_[ idx ];
+			if ( cumulative >= target )
+			{
+				return std::min( bucket_highest( idx ), max_ );
+			}
+		}
+
+		return max_;
+	}
+
+	void print( std::ostream& out ) const
+	{
+		const double ns_in_us = 1000.0;
+
+		out << "Latency of " << total_count_ << " requests, us:" <<
+			" p50 " << get_value_at_percentile( 50.0 ) / ns_in_us <<
+			" p90 " << get_value_at_percentile( 90.0 ) / ns_in_us <<
+			" p99 " << get_value_at_percentile( 99.0 ) / ns_in_us <<
+			" p99.9 " << get_value_at_percentile( 99.9 ) / ns_in_us <<
+			" max " << get_max() / ns_in_us << std::endl;
+	}
+
+	// one line per non-empty bucket: its highest value, count and cumulative percentile
+	void write_csv( std::ostream& out ) const
+	{
+		out << "value_ns,count,percentile\n";
+
+		boost::uint64_t cumulative = 0;
+		for ( size_t idx = 0; idx < counts_.size(); ++idx )
+		{
+			if ( !counts_[ idx ] )
+			{
+				continue;
+			}
+
+			cumulative += counts_[ idx ];
+			out << std::min( bucket_highest( idx ), max_ ) << "," << counts_[ idx ] << "," <<
+				100.0 * cumulative / total_count_ << "\n";
+		}
+	}
+
+	static size_t bucket_index( boost::uint64_t value )
+	{
+		if ( value < sub_bucket_count )
+		{
+			return value;
+		}
+
+		const unsigned msb = std::numeric_limits< unsigned long long >::digits - 1 - __builtin_clzll( value );
+		const unsigned shift = msb - ( sub_bucket_bits - 1 );
+
+		return shift * sub_bucket_half_count + ( value >> shift );
+	}
+
+	static boost::uint64_t bucket_lowest( size_t idx )
+	{
+		if ( idx < sub_bucket_count )
+		{
+			return idx;
+		}
+
+		const unsigned shift = idx / sub_bucket_half_count - 1;
+
+		return boost::uint64_t( idx - shift * sub_bucket_half_count ) << shift;
+	}
+
+	static boost::uint64_t bucket_highest( size_t idx )
+	{
+		if ( idx < sub_bucket_count )
+		{
+			return idx;
+		}
+
+		const unsigned shift = idx / sub_bucket_half_count - 1;
+
+		return bucket_lowest( idx ) + ( boost::uint64_t( 1 ) << shift ) - 1;
+	}
+
+private:
+
+	std::vector< boost::uint64_t > counts_;
+	boost::uint64_t total_count_;
+	boost::uint64_t min_;
+	boost::uint64_t max_;
+};
+
+inline void save_latency_csv( const latency_histogram& histogram, const std::string& file_name )
+{
+	std::ofstream out( file_name.c_str() );
+	if ( !out )
+	{
+		throw std::runtime_error( "can not open latency csv file: " + file_name );
+	}
+
+	histogram.write_csv( out );
+}
+
+// gives every recording thread a histogram of its own, so record takes neither lock
+// nor atomic; get_merged is meant to be called after the recording threads are done
+class latency_recorder
+	: private boost::noncopyable
+{
+public:
+
+	latency_recorder()
+		: id_( next_id() )
+	{
+	}
+
+	void record( const boost::chrono::nanoseconds& latency )
+	{
+		thread_slot* slot = slot_.get();
+		if ( !slot || slot->owner_id != id_ )
+		{
+			slot = register_thread();
+		}
+
+		slot->histogram->record( latency.count() > 0 ? latency.count() : 0 );
+	}
+
+	latency_histogram get_merged() const
+	{
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		latency_histogram merged;
+		for ( size_t idx = 0; idx < histograms_.size(); ++idx )
+		{
+			merged.merge( histograms_[ idx ] );
+		}
+
+		return merged;
+	}
+
+private:
+
+	// histogram is owned by the recorder, the slot by the thread; a slot left by a destroyed
+	// recorder is recognised by its id even if a new recorder reuses the address
+	struct thread_slot
+	{
+		boost::uint64_t owner_id;
+		latency_histogram* histogram;
+	};
+
+	static boost::uint64_t next_id()
+	{
+		static boost::atomic< boost::uint64_t > id( 0 );
+
+		return ++id;
+	}
+
+	thread_slot* register_thread()
+	{
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		histograms_.push_back( new latency_histogram() );
+
+		thread_slot* slot = new thread_slot;
+		slot->owner_id = id_;
+		slot->histogram = &histograms_.back();
+		slot_.reset( slot );
+
+		return slot;
+	}
+
+private:
+
+	const boost::uint64_t id_;
+	boost::thread_specific_ptr< thread_slot > slot_;
+	mutable boost::mutex mutex_;
+	boost::ptr_vector< latency_histogram > histograms_;
+};
+
+}
+
+#endif // COMMON_LATENCY_HISTOGRAM_H_
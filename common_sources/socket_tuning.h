@@ -0,0 +1,208 @@
+#ifndef COMMON_SOCKET_TUNING_H_
+#define COMMON_SOCKET_TUNING_H_
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <string>
+#include <sstream>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+namespace perf
+{
+
+// options set on every connection of a run, 0 or false keeps what the kernel gives
+struct socket_settings
+{
+	socket_settings()
+		: send_buffer( 0 )
+		, receive_buffer( 0 )
+		, no_delay( false )
+		, quick_ack( false )
+		, busy_poll_us( 0 )
+		, not_sent_lowat( 0 )
+		, zerocopy( false )
+	{
+	}
+
+	// SO_SNDBUF and SO_RCVBUF, the kernel doubles them and caps by net.core.[wr]mem_max
+	int send_buffer;
+	int receive_buffer;
+	// TCP_NODELAY
+	bool no_delay;
+	// TCP_QUICKACK does not stick, it is set again after every read
+	bool quick_ack;
+	// SO_BUSY_POLL, raising it above net.core.busy_read takes CAP_NET_ADMIN
+	int busy_poll_us;
+	// TCP_NOTSENT_LOWAT, the socket is writable while less than this is unsent
+	int not_sent_lowat;
+	// SO_ZEROCOPY, lets sends pass MSG_ZEROCOPY
+	bool zerocopy;
+};
+
+namespace detail
+{
+
+enum { socket_options_count = 7 };
+
+struct socket_option
+{
+	const char* name;
+	int level;
+	int option;
+};
+
+// in the order of the report
+inline const socket_option* get_socket_options()
+{
+	static const socket_option options[ socket_options_count ] = {
+		{ "SO_SNDBUF", SOL_SOCKET, SO_SNDBUF }
+		, { "SO_RCVBUF", SOL_SOCKET, SO_RCVBUF }
+		, { "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY }
+		, { "TCP_QUICKACK", IPPROTO_TCP, TCP_QUICKACK }
+		, { "SO_BUSY_POLL", SOL_SOCKET, SO_BUSY_POLL }
+		, { "TCP_NOTSENT_LOWAT", IPPROTO_TCP, TCP_NOTSENT_LOWAT }
+		, { "SO_ZEROCOPY", SOL_SOCKET, SO_ZEROCOPY } };
+
+	return options;
+}
+
+// values asked for by settings in the order of get_socket_options, 0 is not set
+inline void get_socket_values( const socket_settings& settings, int* values )
+{
+	values[ 0 ] = settings.send_buffer;
+	values[ 1 ] = settings.receive_buffer;
+	values[ 2 ] = settings.no_delay;
+	values[ 3 ] = settings.quick_ack;
+	values[ 4 ] = settings.busy_poll_us;
+	values[ 5 ] = settings.not_sent_lowat;
+	values[ 6 ] = settings.zerocopy;
+}
+
+// returns the options the kernel refused with their errors, empty when all are set
+inline std::string set_socket_options( int fd, const socket_settings& settings )
+{
+	const socket_option* options = get_socket_options();
+	int values[ socket_options_count ];
+	get_socket_values( settings, values );
+
+	std::string errors;
+	for ( size_t idx = 0; idx < socket_options_count; ++idx )
+	{
+		if ( !values[ idx ] )
+		{
+			continue;
+		}
+
+		if ( ::setsockopt( fd, options[ idx ].level, options[ idx ].option, &values[ idx ], sizeof( int ) ) )
+		{
+			errors += std::string( errors.empty() ? "" : ", " ) + options[ idx ].name + ": " + strerror( errno );
+		}
+	}
+
+	return errors;
+}
+
+inline void rearm_quick_ack( int fd )
+{
+	const int one = 1;
+	::setsockopt( fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof( one ) );
+}
+
+}
+
+// sets socket_settings on the sockets of a run; the first socket tells what the kernel
+// has made of them, later ones get the same
+class socket_tuner
+	: private boost::noncopyable
+{
+public:
+
+	explicit socket_tuner( const socket_settings& settings )
+		: settings_( settings )
+		, reported_( false )
+	{
+	}
+
+	const socket_settings& get_settings() const
+	{
+		return settings_;
+	}
+
+	// for listening sockets, accepted ones take the buffer sizes from them before
+	// the window scale is agreed on
+	void apply_listening( int fd ) const
+	{
+		detail::set_socket_options( fd, settings_ );
+	}
+
+	// true for the first socket, report has the values it has got then
+	bool apply( int fd, std::string& report )
+	{
+		const std::string errors = detail::set_socket_options( fd, settings_ );
+		if ( reported_.exchange( true ) )
+		{
+			return false;
+		}
+
+		report = describe( fd );
+		if ( !errors.empty() )
+		{
+			report += "; not set " + errors;
+		}
+
+		return true;
+	}
+
+	// every option with the value the socket has, the asked one in parentheses
+	std::string describe( int fd ) const
+	{
+		const detail::socket_option* options = detail::get_socket_options();
+		int values[ detail::socket_options_count ];
+		detail::get_socket_values( settings_, values );
+
+		std::ostringstream out;
+		for ( size_t idx = 0; idx < detail::socket_options_count; ++idx )
+		{
+			int value = 0;
+			socklen_t length = sizeof( value );
+			out << ( idx ? " " : "" ) << options[ idx ].name << " ";
+			if ( ::getsockopt( fd, options[ idx ].level, options[ idx ].option, &value, &length ) )
+			{
+				out << "?";
+			}
+			else
+			{
+				out << value;
+			}
+
+			if ( values[ idx ] )
+			{
+				out << " (" << values[ idx ] << ")";
+			}
+		}
+
+		return out.str();
+	}
+
+private:
+	const socket_settings settings_;
+	boost::atomic< bool > reported_;
+};
+
+}
+
+#endif // COMMON_SOCKET_TUNING_H_
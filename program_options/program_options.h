@@ -2,6 +2,7 @@
 #define PROGRAM_OPTIONS_H_
 
 #include <string>
+#include <vector>
 #include <exception>
 #include <sstream>
 #include <iterator>
@@ -426,6 +427,1095 @@ private:
 	size_t threads_count_;
 };
 
+class po_reply_mode : public i_po_item
+{
+public:
+
+	explicit po_reply_mode( const std::string& reply_mode )
+		: reply_mode_( reply_mode )
+	{
+	}
+
+	const std::string& get_reply_mode() const
+	{
+		return reply_mode_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "reply_mode,r", po::value< std::string >(), "how file body is sent: copy | sendfile | cache | mmap | chunked" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "reply_mode" ) )
+		{
+			reply_mode_ = vm[ "reply_mode" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string reply_mode_;
+};
+
+class po_cache_size : public i_po_item
+{
+public:
+
+	explicit po_cache_size( size_t cache_size )
+		: cache_size_( cache_size )
+	{
+	}
+
+	size_t get_cache_size() const
+	{
+		return cache_size_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "cache_size", po::value< size_t >(), "file content cache budget in bytes" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "cache_size" ) )
+		{
+			cache_size_ = vm[ "cache_size" ].as< size_t >();
+		}
+	}
+
+private:
+
+	size_t cache_size_;
+};
+
+class po_cache_policy : public i_po_item
+{
+public:
+
+	explicit po_cache_policy( const std::string& cache_policy )
+		: cache_policy_( cache_policy )
+	{
+	}
+
+	const std::string& get_cache_policy() const
+	{
+		return cache_policy_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "cache_policy", po::value< std::string >(), "file content cache eviction policy: lru | fifo" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "cache_policy" ) )
+		{
+			cache_policy_ = vm[ "cache_policy" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string cache_policy_;
+};
+
+class po_engine : public i_po_item
+{
+public:
+
+	explicit po_engine( const std::string& engine )
+		: engine_( engine )
+	{
+	}
+
+	const std::string& get_engine() const
+	{
+		return engine_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "engine,e", po::value< std::string >(), "server io engine: asio | uring" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "engine" ) )
+		{
+			engine_ = vm[ "engine" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string engine_;
+};
+
+class po_sharded : public i_po_item
+{
+public:
+
+	po_sharded()
+		: sharded_( false )
+	{
+	}
+
+	bool is_sharded() const
+	{
+		return sharded_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "sharded", "io_service, SO_REUSEPORT acceptor and pinned thread per each of threads_count" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		sharded_ = vm.count( "sharded" ) != 0;
+	}
+
+private:
+
+	bool sharded_;
+};
+
+class po_pipeline_depth : public i_po_item
+{
+public:
+
+	explicit po_pipeline_depth( size_t pipeline_depth )
+		: pipeline_depth_( pipeline_depth )
+	{
+	}
+
+	size_t get_pipeline_depth() const
+	{
+		return pipeline_depth_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "pipeline_depth,d", po::value< size_t >(), "number of requests kept in flight" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "pipeline_depth" ) )
+		{
+			pipeline_depth_ = vm[ "pipeline_depth" ].as< size_t >();
+		}
+	}
+
+private:
+
+	size_t pipeline_depth_;
+};
+
+class po_connections_count : public i_po_item
+{
+public:
+
+	explicit po_connections_count( size_t connections_count )
+		: connections_count_( connections_count )
+	{
+	}
+
+	size_t get_connections_count() const
+	{
+		return connections_count_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "connections,c", po::value< size_t >(), "number of concurrent connections" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "connections" ) )
+		{
+			connections_count_ = vm[ "connections" ].as< size_t >();
+		}
+	}
+
+private:
+
+	size_t connections_count_;
+};
+
+class po_latency_csv : public i_po_item
+{
+public:
+
+	explicit po_latency_csv( const std::string& file_name = std::string() )
+		: file_name_( file_name )
+	{
+	}
+
+	// empty if latency histogram is not to be saved
+	const std::string& get_file_name() const
+	{
+		return file_name_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "latency_csv", po::value< std::string >(), "file to save latency histogram to as csv" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "latency_csv" ) )
+		{
+			file_name_ = vm[ "latency_csv" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string file_name_;
+};
+
+class po_header_format : public i_po_item
+{
+public:
+
+	explicit po_header_format( const std::string& header_format )
+		: header_format_( header_format )
+	{
+	}
+
+	const std::string& get_header_format() const
+	{
+		return header_format_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "header_format", po::value< std::string >(), "message header format: ascii | binary" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "header_format" ) )
+		{
+			header_format_ = vm[ "header_format" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string header_format_;
+};
+
+class po_sink : public i_po_item
+{
+public:
+
+	explicit po_sink( const std::string& sink )
+		: sink_( sink )
+	{
+	}
+
+	const std::string& get_sink() const
+	{
+		return sink_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "sink", po::value< std::string >(), "where received files go: file | direct | discard" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "sink" ) )
+		{
+			sink_ = vm[ "sink" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string sink_;
+};
+
+class po_writer_threads : public i_po_item
+{
+public:
+
+	explicit po_writer_threads( size_t writer_threads )
+		: writer_threads_( writer_threads )
+	{
+	}
+
+	size_t get_writer_threads() const
+	{
+		return writer_threads_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "writer_threads", po::value< size_t >(), "threads writing received files to disk" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "writer_threads" ) )
+		{
+			writer_threads_ = vm[ "writer_threads" ].as< size_t >();
+		}
+	}
+
+private:
+
+	size_t writer_threads_;
+};
+
+class po_fallocate : public i_po_item
+{
+public:
+
+	po_fallocate()
+		: fallocate_( false )
+	{
+	}
+
+	bool is_fallocate() const
+	{
+		return fallocate_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "fallocate", "reserve disk space for a received file before writing it" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		fallocate_ = vm.count( "fallocate" ) != 0;
+	}
+
+private:
+
+	bool fallocate_;
+};
+
+class po_connection_pool : public i_po_item
+{
+public:
+
+	explicit po_connection_pool( size_t pool_size )
+		: pool_size_( pool_size )
+		, set_( false )
+	{
+	}
+
+	size_t get_pool_size() const
+	{
+		return pool_size_;
+	}
+
+	// given on the command line, the default is kept otherwise
+	bool is_set() const
+	{
+		return set_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "connection_pool", po::value< size_t >(), "connections kept constructed for reuse per acceptor" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "connection_pool" ) )
+		{
+			pool_size_ = vm[ "connection_pool" ].as< size_t >();
+			set_ = true;
+		}
+	}
+
+private:
+
+	size_t pool_size_;
+	bool set_;
+};
+
+class po_stats_port : public i_po_item
+{
+public:
+
+	explicit po_stats_port( unsigned short port = 0 )
+		: port_( port )
+	{
+	}
+
+	unsigned short get_port() const
+	{
+		return port_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "stats_port", po::value< unsigned short >(), "local port serving live stats as text or json, 0 disables" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "stats_port" ) )
+		{
+			port_ = vm[ "stats_port" ].as< unsigned short >();
+		}
+	}
+
+private:
+
+	unsigned short port_;
+};
+
+class po_log_level : public i_po_item
+{
+public:
+
+	explicit po_log_level( const std::string& level )
+		: level_( level )
+	{
+	}
+
+	const std::string& get_log_level() const
+	{
+		return level_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "log_level", po::value< std::string >(), "lowest level logged: debug | info | warning | error | none" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "log_level" ) )
+		{
+			level_ = vm[ "log_level" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string level_;
+};
+
+class po_index_file : public i_po_item
+{
+public:
+
+	explicit po_index_file( const std::string& file_name = std::string() )
+		: file_name_( file_name )
+	{
+	}
+
+	const std::string& get_file_name() const
+	{
+		return file_name_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "index_file", po::value< std::string >(), "file the directory index is kept in between runs" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "index_file" ) )
+		{
+			file_name_ = vm[ "index_file" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string file_name_;
+};
+
+class po_keep_files : public i_po_item
+{
+public:
+
+	po_keep_files()
+		: keep_files_( false )
+	{
+	}
+
+	bool is_keep_files() const
+	{
+		return keep_files_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "keep_files", "serve the files left by the previous run, files are generated only into an empty directory" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		keep_files_ = vm.count( "keep_files" ) != 0;
+	}
+
+private:
+
+	bool keep_files_;
+};
+
+class po_watch_files : public i_po_item
+{
+public:
+
+	po_watch_files()
+		: watch_files_( false )
+	{
+	}
+
+	bool is_watch_files() const
+	{
+		return watch_files_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "watch_files", "apply files added, removed or changed in the directory while serving" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		watch_files_ = vm.count( "watch_files" ) != 0;
+	}
+
+private:
+
+	bool watch_files_;
+};
+
+class po_request_names : public i_po_item
+{
+public:
+
+	explicit po_request_names( const std::string& file_name = std::string() )
+		: file_name_( file_name )
+	{
+	}
+
+	const std::string& get_file_name() const
+	{
+		return file_name_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "request_names", po::value< std::string >(), "file with names of the files to request, one per line; files are picked by the server without it" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "request_names" ) )
+		{
+			file_name_ = vm[ "request_names" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string file_name_;
+};
+
+class po_range_file : public i_po_item
+{
+public:
+
+	explicit po_range_file( const std::string& file_name = std::string() )
+		: file_name_( file_name )
+	{
+	}
+
+	const std::string& get_file_name() const
+	{
+		return file_name_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "range_file", po::value< std::string >(), "file fetched as ranges over all connections; a run left unfinished is resumed by the next one" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "range_file" ) )
+		{
+			file_name_ = vm[ "range_file" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string file_name_;
+};
+
+class po_range_size : public i_po_item
+{
+public:
+
+	explicit po_range_size( size_t range_size )
+		: range_size_( range_size )
+	{
+	}
+
+	size_t get_range_size() const
+	{
+		return range_size_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "range_size", po::value< size_t >(), "bytes asked for in one range request" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "range_size" ) )
+		{
+			range_size_ = vm[ "range_size" ].as< size_t >();
+		}
+	}
+
+private:
+
+	size_t range_size_;
+};
+
+class po_range_output : public i_po_item
+{
+public:
+
+	explicit po_range_output( const std::string& file_name = std::string() )
+		: file_name_( file_name )
+	{
+	}
+
+	const std::string& get_file_name() const
+	{
+		return file_name_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "range_output", po::value< std::string >(), "where the ranged file is put, the client directory by default" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "range_output" ) )
+		{
+			file_name_ = vm[ "range_output" ].as< std::string >();
+		}
+	}
+
+private:
+
+	std::string file_name_;
+};
+
+// socket options of every connection, left out ones keep the kernel defaults
+class po_socket_tuning : public i_po_item
+{
+public:
+
+	po_socket_tuning()
+		: send_buffer_( 0 )
+		, receive_buffer_( 0 )
+		, no_delay_( false )
+		, quick_ack_( false )
+		, busy_poll_( 0 )
+		, not_sent_lowat_( 0 )
+		, zerocopy_( false )
+	{
+	}
+
+	int get_send_buffer() const
+	{
+		return send_buffer_;
+	}
+
+	int get_receive_buffer() const
+	{
+		return receive_buffer_;
+	}
+
+	bool is_no_delay() const
+	{
+		return no_delay_;
+	}
+
+	bool is_quick_ack() const
+	{
+		return quick_ack_;
+	}
+
+	int get_busy_poll() const
+	{
+		return busy_poll_;
+	}
+
+	int get_not_sent_lowat() const
+	{
+		return not_sent_lowat_;
+	}
+
+	bool is_zerocopy() const
+	{
+		return zerocopy_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "sndbuf", po::value< int >(), "SO_SNDBUF of the sockets in bytes" )
+			( "rcvbuf", po::value< int >(), "SO_RCVBUF of the sockets in bytes" )
+			( "tcp_nodelay", "set TCP_NODELAY, small writes are not held back by Nagle" )
+			( "tcp_quickack", "set TCP_QUICKACK again after every read, acks are not delayed" )
+			( "busy_poll", po::value< int >(), "SO_BUSY_POLL in microseconds, reads spin on the device queue" )
+			( "notsent_lowat", po::value< int >(), "TCP_NOTSENT_LOWAT in bytes, unsent data kept in the socket" )
+			( "zerocopy", "set SO_ZEROCOPY, sends may pass MSG_ZEROCOPY" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "sndbuf" ) )
+		{
+			send_buffer_ = vm[ "sndbuf" ].as< int >();
+		}
+
+		if ( vm.count( "rcvbuf" ) )
+		{
+			receive_buffer_ = vm[ "rcvbuf" ].as< int >();
+		}
+
+		if ( vm.count( "busy_poll" ) )
+		{
+			busy_poll_ = vm[ "busy_poll" ].as< int >();
+		}
+
+		if ( vm.count( "notsent_lowat" ) )
+		{
+			not_sent_lowat_ = vm[ "notsent_lowat" ].as< int >();
+		}
+
+		no_delay_ = vm.count( "tcp_nodelay" ) != 0;
+		quick_ack_ = vm.count( "tcp_quickack" ) != 0;
+		zerocopy_ = vm.count( "zerocopy" ) != 0;
+	}
+
+private:
+
+	int send_buffer_;
+	int receive_buffer_;
+	bool no_delay_;
+	bool quick_ack_;
+	int busy_poll_;
+	int not_sent_lowat_;
+	bool zerocopy_;
+};
+
+// values of one benchmark parameter, every combination of them is run
+class po_bench_sweep : public i_po_item
+{
+public:
+
+	po_bench_sweep(
+		const std::vector< size_t >& file_sizes
+		, const std::vector< size_t >& files_counts
+		, const std::vector< size_t >& threads_counts
+		, const std::vector< size_t >& connections_counts )
+		: file_sizes_( file_sizes )
+		, files_counts_( files_counts )
+		, threads_counts_( threads_counts )
+		, connections_counts_( connections_counts )
+	{
+	}
+
+	const std::vector< size_t >& get_file_sizes() const
+	{
+		return file_sizes_;
+	}
+
+	const std::vector< size_t >& get_files_counts() const
+	{
+		return files_counts_;
+	}
+
+	const std::vector< size_t >& get_threads_counts() const
+	{
+		return threads_counts_;
+	}
+
+	const std::vector< size_t >& get_connections_counts() const
+	{
+		return connections_counts_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "sizes,s", po::value< std::vector< size_t > >()->multitoken(), "file sizes in bytes to sweep" )
+			( "files,f", po::value< std::vector< size_t > >()->multitoken(), "counts of files served to sweep" )
+			( "threads,t", po::value< std::vector< size_t > >()->multitoken(), "server thread counts to sweep" )
+			( "connections,c", po::value< std::vector< size_t > >()->multitoken(), "connections of every client to sweep" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "sizes" ) )
+		{
+			file_sizes_ = vm[ "sizes" ].as< std::vector< size_t > >();
+		}
+
+		if ( vm.count( "files" ) )
+		{
+			files_counts_ = vm[ "files" ].as< std::vector< size_t > >();
+		}
+
+		if ( vm.count( "threads" ) )
+		{
+			threads_counts_ = vm[ "threads" ].as< std::vector< size_t > >();
+		}
+
+		if ( vm.count( "connections" ) )
+		{
+			connections_counts_ = vm[ "connections" ].as< std::vector< size_t > >();
+		}
+	}
+
+private:
+
+	std::vector< size_t > file_sizes_;
+	std::vector< size_t > files_counts_;
+	std::vector< size_t > threads_counts_;
+	std::vector< size_t > connections_counts_;
+};
+
+// how every combination of the sweep is run and where the results go
+class po_bench_runs : public i_po_item
+{
+public:
+
+	po_bench_runs(
+		size_t repeats
+		, size_t clients_count
+		, size_t requests_count
+		, const std::string& results_file )
+		: repeats_( repeats )
+		, clients_count_( clients_count )
+		, requests_count_( requests_count )
+		, results_file_( results_file )
+		, verbose_( false )
+	{
+	}
+
+	size_t get_repeats() const
+	{
+		return repeats_;
+	}
+
+	size_t get_clients_count() const
+	{
+		return clients_count_;
+	}
+
+	size_t get_requests_count() const
+	{
+		return requests_count_;
+	}
+
+	const std::string& get_results_file() const
+	{
+		return results_file_;
+	}
+
+	bool is_verbose() const
+	{
+		return verbose_;
+	}
+
+private:
+
+	void insert_impl( po::options_description& desc )
+	{
+		desc.add_options()
+			( "repeats,n", po::value< size_t >(), "runs of every combination, mean and stddev are taken over them" )
+			( "clients", po::value< size_t >(), "clients run side by side, each on an io thread of its own" )
+			( "requests", po::value< size_t >(), "files every client receives in a run" )
+			( "results", po::value< std::string >(), "csv file the results table is written to" )
+			( "verbose", "keep the output of the servers and clients" );
+	}
+
+	void process_impl( int argc, char* argv[], po::options_description& desc )
+	{
+		po::variables_map vm = detail::get_variables_map( argc, argv, desc );
+
+		if ( vm.count( "repeats" ) )
+		{
+			repeats_ = vm[ "repeats" ].as< size_t >();
+		}
+
+		if ( vm.count( "clients" ) )
+		{
+			clients_count_ = vm[ "clients" ].as< size_t >();
+		}
+
+		if ( vm.count( "requests" ) )
+		{
+			requests_count_ = vm[ "requests" ].as< size_t >();
+		}
+
+		if ( vm.count( "results" ) )
+		{
+			results_file_ = vm[ "results" ].as< std::string >();
+		}
+
+		verbose_ = vm.count( "verbose" ) != 0;
+	}
+
+private:
+
+	size_t repeats_;
+	size_t clients_count_;
+	size_t requests_count_;
+	std::string results_file_;
+	bool verbose_;
+};
+
 }
 
 #endif // PROGRAM_OPTIONS_H_
@@ -0,0 +1,116 @@
+#ifndef SERVER_BUFFER_SLAB_H_
+#define SERVER_BUFFER_SLAB_H_
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace perf
+{
+
+// per thread free lists of equally sized I/O buffers; a buffer goes to the list of the
+// thread that releases it, so neither acquire nor release takes a lock. Buffers are
+// moved in and out by swap, the caller's vector keeps no memory of its own
+class buffer_slab
+	: private boost::noncopyable
+{
+public:
+
+	typedef std::vector< char > buffer_type;
+
+	buffer_slab( size_t buffer_size, size_t max_free_per_thread )
+		: buffer_size_( buffer_size )
+		, max_free_per_thread_( max_free_per_thread )
+		, hits_( 0 )
+		, misses_( 0 )
+	{
+	}
+
+	size_t get_buffer_size() const
+	{
+		return buffer_size_;
+	}
+
+	void acquire( buffer_type& buffer )
+	{
+		if ( buffer.size() == buffer_size_ )
+		{
+			return;
+		}
+
+		free_list& list = local_list();
+		if ( !list.empty() )
+		{
+			buffer.swap( list.back() );
+			list.pop_back();
+			hits_.fetch_add( 1, boost::memory_order_relaxed );
+		}
+		else
+		{
+			buffer_type( buffer_size_ ).swap( buffer );
+			misses_.fetch_add( 1, boost::memory_order_relaxed );
+		}
+	}
+
+	void release( buffer_type& buffer )
+	{
+		if ( buffer.size() != buffer_size_ )
+		{
+			return;
+		}
+
+		free_list& list = local_list();
+		if ( list.size() < max_free_per_thread_ )
+		{
+			list.push_back( buffer_type() );
+			list.back().swap( buffer );
+		}
+		else
+		{
+			buffer_type().swap( buffer );
+		}
+	}
+
+	boost::uint64_t get_hits() const
+	{
+		return hits_.load( boost::memory_order_relaxed );
+	}
+
+	boost::uint64_t get_misses() const
+	{
+		return misses_.load( boost::memory_order_relaxed );
+	}
+
+private:
+
+	typedef std::vector< buffer_type > free_list;
+
+	free_list& local_list()
+	{
+		free_list* list = local_.get();
+		if ( !list )
+		{
+			list = new free_list();
+			// release never grows the list past this
+			list->reserve( max_free_per_thread_ );
+			local_.reset( list );
+		}
+
+		return *list;
+	}
+
+private:
+
+	const size_t buffer_size_;
+	const size_t max_free_per_thread_;
+	boost::thread_specific_ptr< free_list > local_;
+	boost::atomic< boost::uint64_t > hits_;
+	boost::atomic< boost::uint64_t > misses_;
+};
+
+}
+
+#endif // SERVER_BUFFER_SLAB_H_
@@ -4,15 +4,31 @@
 #include "protocol_structs.h"
 #include "request_handler.h"
 #include "reply.h"
+#include "sendfile.h"
+#include "buffer_slab.h"
+#include "handler_allocator.h"
+#include "socket_tuning.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <boost/bind.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
-#include <boost/enable_shared_from_this.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/chrono/include.hpp>
+#include <boost/circular_buffer.hpp>
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 namespace perf
 {
@@ -48,60 +64,190 @@ public:
 		observer_.update_sent_data( size );
 	}
 
-	~raii_observer_holder()
+	void record_latency( const boost::chrono::nanoseconds& latency )
+	{
+		observer_.record_latency( latency );
+	}
+
+	void request_received()
+	{
+		observer_.request_received();
+	}
+
+	void parse_failed()
+	{
+		observer_.parse_failed();
+	}
+
+	void record_file_open( const boost::chrono::nanoseconds& latency )
+	{
+		observer_.record_file_open( latency );
+	}
+
+	void replies_dropped( size_t count )
+	{
+		observer_.replies_dropped( count );
+	}
+
+	void record_reply_write()
+	{
+		observer_.record_reply_write();
+	}
+
+	void record_zerocopy_send()
+	{
+		observer_.record_zerocopy_send();
+	}
+
+	void record_zerocopy_copied( size_t count )
+	{
+		observer_.record_zerocopy_copied( count );
+	}
+
+	const socket_settings& tune_socket( int fd )
+	{
+		return observer_.tune_socket( fd );
+	}
+
+	// checks out if the connection has not done it, as the destructor does
+	void release()
 	{
 		if ( checkined_ )
 		{
-			observer_.checkout();
+			checkout();
 		}
 	}
 
+	~raii_observer_holder()
+	{
+		release();
+	}
+
 private:
 	bool checkined_;
 	observer& observer_;
 };
 
+// takes a connection whose last reference is gone instead of deleting it
+template< class connection >
+class connection_recycler
+{
+public:
+	virtual void recycle( connection* conn ) = 0;
+
+protected:
+	~connection_recycler()
+	{
+	}
+};
+
 }
 
 template< class request_handler, class observer >
 class connection
-	: public boost::enable_shared_from_this< connection< request_handler, observer > >
-	, private boost::noncopyable
+	: private boost::noncopyable
 {
 public:
-	typedef boost::shared_ptr< connection< request_handler, observer > > ptr;
+	typedef boost::intrusive_ptr< connection< request_handler, observer > > ptr;
+	typedef detail::connection_recycler< connection< request_handler, observer > > recycler_type;
+
+	// requests read ahead of the replies being written; reading pauses when all are taken.
+	// Requests come in through a buffer which holds at least one of the largest
+	enum
+	{
+		max_pending_replies = 64
+		, read_buffer_size = 2 * ( protocol::variable_record::header_length + protocol::variable_record::max_body_length )
+	};
+
+	// chunked replies go through chunk_ring_size buffers of chunk_size bytes
+	enum { chunk_size = 64 * 1024, chunk_ring_size = 2, max_free_chunk_rings = 16 };
+
+	// in-memory bodies from zerocopy_min_size on go with MSG_ZEROCOPY when the socket has
+	// SO_ZEROCOPY, below it pinning the pages and reaping the completion cost more than the
+	// copy. Up to max_zerocopy_bodies are held until the kernel is done with them, the
+	// file_data buffers it gives back are kept for the replies, max_spare_bodies of them.
+	// A stopped connection waits for them max_linger_count times zerocopy_linger_ms
+	enum
+	{
+		zerocopy_min_size = 16 * 1024
+		, max_zerocopy_bodies = 64
+		, max_spare_bodies = 4
+		, zerocopy_linger_ms = 10
+		, max_linger_count = 100
+	};
 
 public:
 	connection(
 		boost::asio::io_service& io_service
 		, const request_handler& req_handler
 		, observer& observ )
-		: connected_socket_( io_service )
-		, read_buffer_( buffer_len )
-		, write_buffer_( buffer_len )
+		: ref_count_( 0 )
+		, connected_socket_( io_service )
+		, strand_( io_service )
+		, read_begin_( 0 )
+		, read_end_( 0 )
+		, header_parsed_( false )
 		, request_handler_( req_handler )
 		, observer_( observ )
+		, first_pending_( 0 )
+		, pending_count_( 0 )
+		, writing_count_( 0 )
+		, write_iovec_idx_( 0 )
+		, write_flags_( 0 )
+		, request_times_( max_pending_replies )
+		, reading_( false )
+		, read_closed_( false )
+		, stopped_( false )
+		, quick_ack_( false )
+		, file_offset_( 0 )
+		, chunk_head_( 0 )
+		, chunks_ready_( 0 )
+		, zerocopy_( false )
+		, zerocopy_body_( false )
+		, zerocopy_flags_( 0 )
+		, zerocopy_next_id_( 0 )
+		, zerocopy_done_id_( 0 )
+		, zerocopy_body_id_( 0 )
+		, zerocopy_bodies_( max_zerocopy_bodies )
+		, linger_timer_( io_service )
+		, linger_count_( 0 )
 	{
-		std::cout << "connection constructed" << std::endl;
+		write_iovecs_.reserve( max_pending_replies * protocol::reply::max_buffers_count );
+		spare_bodies_.reserve( max_spare_bodies );
+
+		PERF_LOG_DEBUG( "connection constructed" );
 	}
 
 	~connection()
 	{
-		std::cout << "connection destroyed" << std::endl;
+		drop_pending_replies();
+		PERF_LOG_DEBUG( "connection destroyed" );
 	}
 
 	void start()
 	{
 		observer_.checkin();
 
+		// sendfile(2) must not block the io thread, the reactor reports write readiness instead
+		connected_socket_.native_non_blocking( true );
+		const socket_settings& settings = observer_.tune_socket( connected_socket_.native_handle() );
+		quick_ack_ = settings.quick_ack;
+		zerocopy_ = settings.zerocopy && detail::zerocopy_enabled( connected_socket_.native_handle() );
+
 		do_read();
 	}
 
 	void stop()
 	{
-		connected_socket_.close();
+		if ( stopped_ )
+		{
+			return;
+		}
+		stopped_ = true;
+
+		close_socket();
 		observer_.checkout();
-		std::cout << "connection stopped" << std::endl;
+		PERF_LOG_DEBUG( "connection stopped" );
 	}
 
 	boost::asio::ip::tcp::socket& connected_socket()
@@ -109,74 +255,702 @@ public:
 		return connected_socket_;
 	}
 
+	// once the last reference is gone the connection is reset and handed to recycler
+	// instead of being deleted; recycler is dropped then and has to be set again
+	void set_recycler( const boost::shared_ptr< recycler_type >& recycler )
+	{
+		recycler_ = recycler;
+	}
+
+	// chunk rings of all connections of this type, kept per thread
+	static buffer_slab& chunk_slab()
+	{
+		static buffer_slab slab( chunk_size * chunk_ring_size, max_free_chunk_rings );
+
+		return slab;
+	}
+
+	friend void intrusive_ptr_add_ref( connection* conn )
+	{
+		conn->ref_count_.fetch_add( 1, boost::memory_order_relaxed );
+	}
+
+	friend void intrusive_ptr_release( connection* conn )
+	{
+		if ( conn->ref_count_.fetch_sub( 1, boost::memory_order_release ) == 1 )
+		{
+			boost::atomic_thread_fence( boost::memory_order_acquire );
+			conn->dispose();
+		}
+	}
+
 private:
+	void dispose()
+	{
+		if ( !recycler_ )
+		{
+			delete this;
+			return;
+		}
+
+		boost::shared_ptr< recycler_type > recycler;
+		recycler.swap( recycler_ );
+
+		reset();
+		recycler->recycle( this );
+	}
+
+	// brings the connection back to the state it had after construction, keeping the
+	// reply ring and the records allocated; nothing refers to it at this point
+	void reset()
+	{
+		boost::system::error_code non_err_code;
+		connected_socket_.close( non_err_code );
+		drop_pending_replies();
+		observer_.release();
+
+		for ( size_t idx = 0; idx < replies_.size(); ++idx )
+		{
+			replies_[ idx ].reset();
+		}
+
+		read_begin_ = 0;
+		read_end_ = 0;
+		header_parsed_ = false;
+		first_pending_ = 0;
+		pending_count_ = 0;
+		writing_count_ = 0;
+		write_iovecs_.clear();
+		write_iovec_idx_ = 0;
+		request_times_.clear();
+		reading_ = false;
+		read_closed_ = false;
+		stopped_ = false;
+		quick_ack_ = false;
+		file_offset_ = 0;
+		chunk_head_ = 0;
+		chunks_ready_ = 0;
+		zerocopy_ = false;
+		zerocopy_body_ = false;
+		zerocopy_flags_ = 0;
+		zerocopy_next_id_ = 0;
+		zerocopy_done_id_ = 0;
+		zerocopy_body_id_ = 0;
+		zerocopy_bodies_.clear();
+		linger_count_ = 0;
+
+		chunk_slab().release( chunk_ring_ );
+	}
+
+	// the kernel sends from the memory of the bodies given with MSG_ZEROCOPY until it
+	// reports them done, even after close(2); the socket is held open and the bodies
+	// with it until then, so the memory is not reused under data still queued. A peer
+	// which stops acking keeps them queued, after max_linger_count waits the socket is
+	// closed and the completions left are not waited for
+	void close_socket()
+	{
+		reap_zerocopy();
+
+		boost::system::error_code non_err_code;
+		if ( zerocopy_bodies_.empty() || linger_count_ >= size_t( max_linger_count ) )
+		{
+			if ( !zerocopy_bodies_.empty() )
+			{
+				PERF_LOG_WARNING( "closed with " << zerocopy_bodies_.size() << " zerocopy bodies not completed" );
+				zerocopy_bodies_.clear();
+			}
+
+			connected_socket_.close( non_err_code );
+			return;
+		}
+
+		++linger_count_;
+		connected_socket_.cancel( non_err_code );
+		linger_timer_.expires_after( boost::asio::chrono::milliseconds( zerocopy_linger_ms ) );
+		linger_timer_.async_wait(
+			strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+				&connection::handle_linger, ptr( this )
+				, boost::asio::placeholders::error ) ) ) );
+	}
+
+	void handle_linger( const boost::system::error_code& err )
+	{
+		if ( err )
+		{
+			boost::system::error_code non_err_code;
+			connected_socket_.close( non_err_code );
+			return;
+		}
+
+		close_socket();
+	}
+
+	// replies left unsent when the connection goes
+	void drop_pending_replies()
+	{
+		if ( pending_count_ )
+		{
+			observer_.replies_dropped( pending_count_ );
+		}
+	}
+
 	void do_read()
 	{
-		boost::asio::async_read(
-			connected_socket_
-			, boost::asio::buffer( variable_record_.get_header_buff()
-					, protocol::variable_record::header_length )
-			, boost::bind(
-					&connection::handle_read_header, this->shared_from_this()
-					, boost::asio::placeholders::error ) );
+		reading_ = true;
+
+		// a request partly read is moved to the front, the rest of it fits behind
+		if ( read_begin_ )
+		{
+			memmove( read_buffer_, read_buffer_ + read_begin_, read_end_ - read_begin_ );
+			read_end_ -= read_begin_;
+			read_begin_ = 0;
+		}
+
+		connected_socket_.async_read_some(
+			boost::asio::buffer( read_buffer_ + read_end_, read_buffer_size - read_end_ )
+			, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+					&connection::handle_read, ptr( this )
+					, boost::asio::placeholders::error
+					, boost::asio::placeholders::bytes_transferred ) ) ) );
 	}
 
-	void handle_read_header( const boost::system::error_code& err )
+	void handle_read( const boost::system::error_code& err, size_t bytes_transferred )
 	{
-		if ( variable_record_.deserialize_header() )
+		if ( err )
 		{
-			boost::asio::async_read(
-				connected_socket_
-				, boost::asio::buffer( variable_record_.get_body_buff()
-						, variable_record_.get_body_length() )
-				, boost::bind(
-						&connection::handle_read_body, this->shared_from_this()
-						, boost::asio::placeholders::error ) );
+			handle_read_error( err );
+			return;
 		}
-		else
+
+		reading_ = false;
+		read_end_ += bytes_transferred;
+
+		if ( quick_ack_ )
+		{
+			detail::rearm_quick_ack( connected_socket_.native_handle() );
+		}
+
+		process_requests();
+	}
+
+	// replies to the requests read so far in one batch, then reads on while the queue has room
+	void process_requests()
+	{
+		// the socket of a stopped connection may be held open for zerocopy bodies
+		if ( stopped_ || !parse_requests() )
+		{
+			return;
+		}
+
+		if ( pending_count_ && !writing_count_ )
+		{
+			do_write_replies();
+		}
+
+		// replies written at once may have come back here already
+		if ( !reading_ && !read_closed_ && !stopped_ && pending_count_ < max_pending_replies )
+		{
+			do_read();
+		}
+	}
+
+	// queues a reply for every whole request in the read buffer while there is room;
+	// false when a request is malformed, the connection is stopped then
+	bool parse_requests()
+	{
+		const boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+
+		while ( pending_count_ < max_pending_replies
+			&& read_end_ - read_begin_ >= size_t( protocol::variable_record::header_length ) )
+		{
+			if ( !header_parsed_ )
+			{
+				std::copy(
+					read_buffer_ + read_begin_
+					, read_buffer_ + read_begin_ + protocol::variable_record::header_length
+					, variable_record_.get_header_buff() );
+
+				if ( !variable_record_.deserialize_header() )
+				{
+					observer_.parse_failed();
+					PERF_LOG_ERROR( "deserialize header" );
+					stop();
+					return false;
+				}
+
+				header_parsed_ = true;
+				header_read_time_ = now;
+			}
+
+			const size_t body_begin = read_begin_ + protocol::variable_record::header_length;
+			const size_t body_length = variable_record_.get_body_length();
+			if ( read_end_ - body_begin < body_length )
+			{
+				break;
+			}
+
+			std::copy(
+				read_buffer_ + body_begin
+				, read_buffer_ + body_begin + body_length
+				, variable_record_.get_body_buff() );
+			read_begin_ = body_begin + body_length;
+			header_parsed_ = false;
+
+			if ( !variable_record_.deserialize_body( request_ ) )
+			{
+				observer_.parse_failed();
+				PERF_LOG_ERROR( "deserialize body" );
+				stop();
+				return false;
+			}
+
+			observer_.request_received();
+
+			protocol::reply& rep = push_reply();
+			const boost::chrono::steady_clock::time_point lookup_start = boost::chrono::steady_clock::now();
+			request_handler_.make_reply( request_, rep );
+			observer_.record_file_open( boost::chrono::steady_clock::now() - lookup_start );
+			rep.format = variable_record_.get_header_format();
+			request_times_.push_back( header_read_time_ );
+		}
+
+		return true;
+	}
+
+	void handle_read_error( const boost::system::error_code& err )
+	{
+		reading_ = false;
+
+		if ( err == boost::asio::error::operation_aborted )
+		{
+			return;
+		}
+
+		// peer has sent all its requests, write out what is still queued
+		read_closed_ = true;
+		if ( !pending_count_ || err != boost::asio::error::eof )
+		{
+			stop();
+		}
+	}
+
+	protocol::reply& push_reply()
+	{
+		if ( pending_count_ == replies_.size() )
+		{
+			// ring is full, grow it; pending replies are at
+			// [first_pending_, size) and [0, first_pending_)
+			replies_.insert( replies_.begin() + first_pending_, new protocol::reply() );
+			if ( pending_count_ )
+			{
+				++first_pending_;
+			}
+		}
+
+		protocol::reply& rep = replies_[ ( first_pending_ + pending_count_ ) % replies_.size() ];
+		++pending_count_;
+
+		return rep;
+	}
+
+	protocol::reply& pending_reply( size_t idx )
+	{
+		return replies_[ ( first_pending_ + idx ) % replies_.size() ];
+	}
+
+	// gathers queued replies into one sendmsg; a reply which body is sent from the
+	// file ends the batch, its body goes after the gathered header
+	void do_write_replies()
+	{
+		write_iovecs_.clear();
+		write_iovec_idx_ = 0;
+
+		if ( !zerocopy_bodies_.empty() )
+		{
+			reap_zerocopy();
+		}
+
+		bool body_follows = false;
+		zerocopy_body_ = false;
+		writing_count_ = 0;
+		while ( writing_count_ < pending_count_
+			&& write_iovecs_.size() + protocol::reply::max_buffers_count <= size_t( detail::max_iovecs ) )
+		{
+			const protocol::reply& rep = pending_reply( writing_count_ );
+			const protocol::reply_buffers buffers = rep.get_buffers();
+
+			// a body sent with MSG_ZEROCOPY ends the batch as a sendfile body does
+			zerocopy_body_ = is_zerocopy_body( rep );
+			const size_t gathered_count = zerocopy_body_ ? 1 : buffers.size();
+			for ( size_t idx = 0; idx < gathered_count; ++idx )
+			{
+				write_iovecs_.push_back( detail::make_iovec( buffers[ idx ] ) );
+			}
+			++writing_count_;
+
+			if ( zerocopy_body_ )
+			{
+				zerocopy_iov_ = detail::make_iovec( buffers[ 1 ] );
+				body_follows = true;
+				break;
+			}
+
+			if ( rep.has_file_descriptor() )
+			{
+				body_follows = rep.header.file_size != 0;
+				break;
+			}
+		}
+
+		// the kernel holds a partial segment back while the stream goes on right
+		// after: the body of the last reply or the replies left for the next batch
+		write_flags_ = MSG_NOSIGNAL | ( body_follows || writing_count_ < pending_count_ ? MSG_MORE : 0 );
+
+		write_replies();
+	}
+
+	void write_replies()
+	{
+		boost::system::error_code err;
+		while ( write_iovec_idx_ < write_iovecs_.size() && !err )
+		{
+			size_t sent = detail::sendmsg_some(
+				connected_socket_.native_handle()
+				, &write_iovecs_[ write_iovec_idx_ ]
+				, write_iovecs_.size() - write_iovec_idx_
+				, write_flags_
+				, err );
+
+			if ( err )
+			{
+				break;
+			}
+
+			observer_.record_reply_write();
+
+			for ( ; sent && sent >= write_iovecs_[ write_iovec_idx_ ].iov_len; ++write_iovec_idx_ )
+			{
+				sent -= write_iovecs_[ write_iovec_idx_ ].iov_len;
+			}
+
+			if ( sent )
+			{
+				iovec& partial = write_iovecs_[ write_iovec_idx_ ];
+				partial.iov_base = static_cast< char* >( partial.iov_base ) + sent;
+				partial.iov_len -= sent;
+			}
+		}
+
+		if ( err == boost::asio::error::would_block )
+		{
+			do_wait_write();
+		}
+		else if ( err )
 		{
-			std::cout << "error: deserialize header" << std::endl;
 			stop();
 		}
+		else
+		{
+			handle_replies_written();
+		}
+	}
+
+	void handle_replies_written()
+	{
+		if ( zerocopy_body_ )
+		{
+			zerocopy_flags_ = MSG_ZEROCOPY;
+			zerocopy_body_id_ = zerocopy_next_id_;
+			send_zerocopy_body();
+			return;
+		}
+
+		const protocol::reply& last = pending_reply( writing_count_ - 1 );
+		if ( last.has_file_descriptor() )
+		{
+			file_offset_ = last.header.offset;
+			if ( last.chunked )
+			{
+				start_chunks();
+			}
+			else
+			{
+				send_file();
+			}
+			return;
+		}
+
+		handle_replies_sent();
+	}
+
+	// gathered replies and sendfile bodies are written once the socket takes more
+	void do_wait_write()
+	{
+		connected_socket_.async_write_some(
+			boost::asio::null_buffers()
+			, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+				&connection::handle_wait_write, ptr( this )
+				, boost::asio::placeholders::error ) ) ) );
+	}
+
+	void handle_wait_write( const boost::system::error_code& err )
+	{
+		if ( err )
+		{
+			if ( err != boost::asio::error::operation_aborted )
+			{
+				stop();
+			}
+		}
+		else if ( write_iovec_idx_ < write_iovecs_.size() )
+		{
+			write_replies();
+		}
+		else if ( zerocopy_body_ )
+		{
+			send_zerocopy_body();
+		}
+		else
+		{
+			send_file();
+		}
 	}
 
-	void handle_read_body( const boost::system::error_code& err )
+	bool is_zerocopy_body( const protocol::reply& rep ) const
 	{
-		protocol::request request;
-		if ( variable_record_.deserialize_body( request ) )
+		return zerocopy_
+			&& !rep.has_file_descriptor()
+			&& rep.header.file_size >= size_t( zerocopy_min_size )
+			&& !zerocopy_bodies_.full();
+	}
+
+	// the kernel pins the pages of the body instead of copying them, every sendmsg
+	// taking some of it is numbered for the completion
+	void send_zerocopy_body()
+	{
+		boost::system::error_code err;
+		while ( zerocopy_iov_.iov_len && !err )
 		{
-			request_handler_.make_reply( request, reply_ );
+			const size_t sent = detail::sendmsg_some(
+				connected_socket_.native_handle()
+				, &zerocopy_iov_
+				, 1
+				, MSG_NOSIGNAL | zerocopy_flags_ | ( writing_count_ < pending_count_ ? MSG_MORE : 0 )
+				, err );
+
+			if ( err == boost::asio::error::no_buffer_space && zerocopy_flags_ )
+			{
+				// optmem_max is taken up by the pages pinned so far, the rest is copied
+				zerocopy_flags_ = 0;
+				err = boost::system::error_code();
+				continue;
+			}
+
+			if ( err )
+			{
+				break;
+			}
 
-			do_write_reply();
+			observer_.record_reply_write();
+			if ( zerocopy_flags_ )
+			{
+				++zerocopy_next_id_;
+			}
+
+			zerocopy_iov_.iov_base = static_cast< char* >( zerocopy_iov_.iov_base ) + sent;
+			zerocopy_iov_.iov_len -= sent;
+		}
+
+		if ( err == boost::asio::error::would_block )
+		{
+			do_wait_write();
+		}
+		else if ( err )
+		{
+			PERF_LOG_ERROR( "sendmsg " << err.message() );
+			stop();
 		}
 		else
 		{
-			std::cout << "error: deserialize body" << std::endl;
+			handle_zerocopy_body_sent( pending_reply( writing_count_ - 1 ) );
+		}
+	}
+
+	// the body is held until its completion comes: the shared content by a reference,
+	// file_data by taking its buffer, the reply goes on with a spare one
+	void handle_zerocopy_body_sent( protocol::reply& rep )
+	{
+		zerocopy_body_ = false;
+
+		if ( zerocopy_next_id_ != zerocopy_body_id_ )
+		{
+			zerocopy_bodies_.push_back( pinned_body() );
+			pinned_body& body = zerocopy_bodies_.back();
+			body.end_id = zerocopy_next_id_;
+			body.content = rep.file_content;
+			if ( !rep.file_content )
+			{
+				body.data.swap( rep.file_data );
+				if ( !spare_bodies_.empty() )
+				{
+					rep.file_data.swap( spare_bodies_.back() );
+					spare_bodies_.pop_back();
+				}
+			}
+
+			observer_.record_zerocopy_send();
+		}
+
+		handle_replies_sent();
+	}
+
+	// takes the completions off the error queue and releases the bodies they cover
+	void reap_zerocopy()
+	{
+		detail::zerocopy_completion completion;
+		while ( detail::read_zerocopy_completion( connected_socket_.native_handle(), completion ) )
+		{
+			if ( completion.copied )
+			{
+				// the device could not send from the pages, the kernel has copied them after
+				// all; the copy up front is cheaper than that
+				observer_.record_zerocopy_copied( completion.last - completion.first + 1 );
+				zerocopy_ = false;
+			}
+
+			// completions of a tcp socket come in the order of the sends
+			if ( boost::int32_t( completion.last + 1 - zerocopy_done_id_ ) > 0 )
+			{
+				zerocopy_done_id_ = completion.last + 1;
+			}
+		}
+
+		while ( !zerocopy_bodies_.empty()
+			&& boost::int32_t( zerocopy_done_id_ - zerocopy_bodies_.front().end_id ) >= 0 )
+		{
+			pinned_body& body = zerocopy_bodies_.front();
+			if ( body.data.capacity() && spare_bodies_.size() < size_t( max_spare_bodies ) )
+			{
+				spare_bodies_.push_back( std::vector< char >() );
+				spare_bodies_.back().swap( body.data );
+			}
+
+			zerocopy_bodies_.pop_front();
+		}
+	}
+
+	void send_file()
+	{
+		protocol::reply& rep = pending_reply( writing_count_ - 1 );
+		const boost::uint64_t range_end = rep.header.offset + rep.header.file_size;
+
+		boost::system::error_code err;
+		while ( boost::uint64_t( file_offset_ ) < range_end && !err )
+		{
+			const size_t sent = detail::sendfile_some(
+				connected_socket_.native_handle()
+				, rep.file_descriptor->get()
+				, file_offset_
+				, range_end - file_offset_
+				, err );
+
+			if ( !err && !sent )
+			{
+				// file was truncated after its size had been taken
+				err = boost::asio::error::eof;
+			}
+		}
+
+		if ( err == boost::asio::error::would_block )
+		{
+			do_wait_write();
+		}
+		else if ( err )
+		{
+			PERF_LOG_ERROR( "sendfile " << err.message() );
 			stop();
 		}
+		else
+		{
+			handle_file_sent( rep );
+		}
+	}
+
+	void start_chunks()
+	{
+		chunk_slab().acquire( chunk_ring_ );
+
+		chunk_head_ = 0;
+		chunks_ready_ = 0;
+
+		write_chunk();
+	}
+
+	// fills the free ring slots from the file; stops the connection on failure
+	bool read_chunks()
+	{
+		protocol::reply& rep = pending_reply( writing_count_ - 1 );
+		const boost::uint64_t range_end = rep.header.offset + rep.header.file_size;
+
+		while ( chunks_ready_ < chunk_ring_size && boost::uint64_t( file_offset_ ) < range_end )
+		{
+			const size_t slot = ( chunk_head_ + chunks_ready_ ) % chunk_ring_size;
+			const size_t length = std::min< boost::uint64_t >( chunk_size, range_end - file_offset_ );
+
+			const ssize_t was_read = ::pread( rep.file_descriptor->get(), &chunk_ring_[ slot * chunk_size ], length, file_offset_ );
+			if ( was_read < 0 && errno == EINTR )
+			{
+				continue;
+			}
+
+			if ( was_read <= 0 )
+			{
+				// file was truncated after its size had been taken
+				PERF_LOG_ERROR( "read chunk " << ( was_read ? strerror( errno ) : "end of file" ) );
+				stop();
+				return false;
+			}
+
+			chunk_lengths_[ slot ] = was_read;
+			file_offset_ += was_read;
+			++chunks_ready_;
+		}
+
+		return true;
 	}
 
-	void do_write_reply()
+	void write_chunk()
 	{
+		if ( !chunks_ready_ && !read_chunks() )
+		{
+			return;
+		}
+
+		if ( !chunks_ready_ )
+		{
+			handle_file_sent( pending_reply( writing_count_ - 1 ) );
+			return;
+		}
+
 		async_write(
 			connected_socket_
-			, reply_.get_buffers()
-			, boost::bind(
-				&connection::handle_write_reply, this->shared_from_this()
-				, boost::asio::placeholders::error ) );
+			, boost::asio::buffer( &chunk_ring_[ chunk_head_ * chunk_size ], chunk_lengths_[ chunk_head_ ] )
+			, strand_.wrap( make_custom_alloc_handler( handler_allocator_, boost::bind(
+				&connection::handle_write_chunk, ptr( this )
+				, boost::asio::placeholders::error ) ) ) );
+
+		// next chunks are read while this one is on its way
+		read_chunks();
 	}
 
-	void handle_write_reply( const boost::system::error_code& err )
+	void handle_write_chunk( const boost::system::error_code& err )
 	{
 		if ( !err )
 		{
-			// graceful connection closure.
-			/*boost::system::error_code non_err_code;
-			connected_socket_.shutdown(
-				boost::asio::ip::tcp::socket::shutdown_both
-				, non_err_code );*/
-			observer_.update_sent_data( reply_.header.file_size );
-			do_read();
+			chunk_head_ = ( chunk_head_ + 1 ) % chunk_ring_size;
+			--chunks_ready_;
+
+			write_chunk();
 		}
 		else if ( err != boost::asio::error::operation_aborted )
 		{
@@ -184,15 +958,116 @@ private:
 		}
 	}
 
+	void handle_file_sent( protocol::reply& rep )
+	{
+		rep.file_descriptor.reset();
+		handle_replies_sent();
+	}
+
+	void handle_replies_sent()
+	{
+		const boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+
+		for ( size_t idx = 0; idx < writing_count_; ++idx )
+		{
+			observer_.update_sent_data( pending_reply( idx ).header.file_size );
+
+			observer_.record_latency( now - request_times_.front() );
+			request_times_.pop_front();
+		}
+
+		first_pending_ = ( first_pending_ + writing_count_ ) % replies_.size();
+		pending_count_ -= writing_count_;
+		writing_count_ = 0;
+
+		if ( pending_count_ )
+		{
+			do_write_replies();
+		}
+		else if ( read_closed_ )
+		{
+			stop();
+			return;
+		}
+
+		// reading was paused by the full queue, requests may be waiting in the buffer
+		if ( !reading_ && !read_closed_ && pending_count_ < max_pending_replies )
+		{
+			process_requests();
+		}
+	}
+
+private:
+	// body of a reply sent with MSG_ZEROCOPY, free once the sends before end_id are done
+	struct pinned_body
+	{
+		pinned_body()
+			: end_id( 0 )
+		{
+		}
+
+		boost::uint32_t end_id;
+		boost::shared_ptr< const filelogic::file_content > content;
+		std::vector< char > data;
+	};
+
 private:
-	enum { buffer_len = 8192 };
+	boost::atomic< int > ref_count_;
+	boost::shared_ptr< recycler_type > recycler_;
 	boost::asio::ip::tcp::socket connected_socket_;
+	boost::asio::io_service::strand strand_;
+	char read_buffer_[ read_buffer_size ];
+	// unparsed requests are at [read_begin_, read_end_)
+	size_t read_begin_;
+	size_t read_end_;
+	// the header at read_begin_ is in variable_record_, its body has not come in whole
+	bool header_parsed_;
 	protocol::variable_record variable_record_;
-	std::vector< char > read_buffer_;
-	std::vector< char > write_buffer_;
+	// reused, so a file name does not take an allocation per request
+	protocol::request request_;
 	const request_handler& request_handler_;
 	detail::raii_observer_holder< observer > observer_;
-	protocol::reply reply_;
+	// ring of replies in request order, grown on demand up to max_pending_replies
+	boost::ptr_vector< protocol::reply > replies_;
+	size_t first_pending_;
+	size_t pending_count_;
+	size_t writing_count_;
+	// iovecs of the batch being written, those before write_iovec_idx_ are sent
+	std::vector< iovec > write_iovecs_;
+	size_t write_iovec_idx_;
+	int write_flags_;
+	// header arrival of every pending request, latency is taken when its reply is sent
+	boost::chrono::steady_clock::time_point header_read_time_;
+	boost::circular_buffer< boost::chrono::steady_clock::time_point > request_times_;
+	bool reading_;
+	bool read_closed_;
+	bool stopped_;
+	// TCP_QUICKACK is set again after every read
+	bool quick_ack_;
+	off_t file_offset_;
+	std::vector< char > chunk_ring_;
+	size_t chunk_lengths_[ chunk_ring_size ];
+	size_t chunk_head_;
+	size_t chunks_ready_;
+	// SO_ZEROCOPY is on, turned off when the kernel reports a zerocopy send copied
+	bool zerocopy_;
+	// the body of the last reply of the batch goes from zerocopy_iov_ with zerocopy_flags_,
+	// they lose MSG_ZEROCOPY when the kernel can not pin more
+	bool zerocopy_body_;
+	iovec zerocopy_iov_;
+	int zerocopy_flags_;
+	// zerocopy sends are numbered by the kernel from 0 per socket, those before
+	// zerocopy_done_id_ are completed; the body being sent starts at zerocopy_body_id_
+	boost::uint32_t zerocopy_next_id_;
+	boost::uint32_t zerocopy_done_id_;
+	boost::uint32_t zerocopy_body_id_;
+	boost::circular_buffer< pinned_body > zerocopy_bodies_;
+	std::vector< std::vector< char > > spare_bodies_;
+	// holds a stopped connection while the kernel has zerocopy bodies of it
+	boost::asio::steady_timer linger_timer_;
+	size_t linger_count_;
+	// memory of the operations in flight, outlives them as every handler holds a reference
+	handler_allocator handler_allocator_;
 };
 
 }
@@ -0,0 +1,134 @@
+#ifndef SERVER_CONNECTION_POOL_H_
+#define SERVER_CONNECTION_POOL_H_
+
+#include "connection.h"
+
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+namespace perf
+{
+
+// keeps finished connections of one io_service for the next accept; a connection
+// in use holds the pool alive, so the pool may be released before its connections
+template< class request_handler, class observer >
+class connection_pool
+	: public detail::connection_recycler< connection< request_handler, observer > >
+	, public boost::enable_shared_from_this< connection_pool< request_handler, observer > >
+	, private boost::noncopyable
+{
+public:
+	typedef connection< request_handler, observer > connection_type;
+	typedef typename connection_type::ptr connection_ptr;
+
+	// capacity connections are constructed up front, more are made on demand
+	// and deleted on return when the pool is full
+	connection_pool(
+		boost::asio::io_service& io_service
+		, const request_handler& req_handler
+		, observer& observ
+		, size_t capacity )
+		: io_service_( io_service )
+		, request_handler_( req_handler )
+		, observer_( observ )
+		, capacity_( capacity )
+		, hits_( 0 )
+		, misses_( 0 )
+	{
+		free_.reserve( capacity_ );
+		for ( size_t idx = 0; idx < capacity_; ++idx )
+		{
+			free_.push_back( make_connection() );
+		}
+	}
+
+	~connection_pool()
+	{
+		for ( size_t idx = 0; idx < free_.size(); ++idx )
+		{
+			delete free_[ idx ];
+		}
+	}
+
+	connection_ptr acquire()
+	{
+		connection_type* conn = 0;
+		{
+			boost::lock_guard< boost::mutex > lock( mutex_ );
+
+			if ( !free_.empty() )
+			{
+				conn = free_.back();
+				free_.pop_back();
+			}
+		}
+
+		if ( conn )
+		{
+			hits_.fetch_add( 1, boost::memory_order_relaxed );
+		}
+		else
+		{
+			conn = make_connection();
+			misses_.fetch_add( 1, boost::memory_order_relaxed );
+		}
+
+		conn->set_recycler( this->shared_from_this() );
+
+		return connection_ptr( conn );
+	}
+
+	void recycle( connection_type* conn )
+	{
+		{
+			boost::lock_guard< boost::mutex > lock( mutex_ );
+
+			if ( free_.size() < capacity_ )
+			{
+				free_.push_back( conn );
+				return;
+			}
+		}
+
+		delete conn;
+	}
+
+	boost::uint64_t get_hits() const
+	{
+		return hits_.load( boost::memory_order_relaxed );
+	}
+
+	boost::uint64_t get_misses() const
+	{
+		return misses_.load( boost::memory_order_relaxed );
+	}
+
+private:
+
+	connection_type* make_connection()
+	{
+		return new connection_type( io_service_, request_handler_, observer_ );
+	}
+
+private:
+
+	boost::asio::io_service& io_service_;
+	const request_handler& request_handler_;
+	observer& observer_;
+	const size_t capacity_;
+	boost::mutex mutex_;
+	std::vector< connection_type* > free_;
+	boost::atomic< boost::uint64_t > hits_;
+	boost::atomic< boost::uint64_t > misses_;
+};
+
+}
+
+#endif // SERVER_CONNECTION_POOL_H_
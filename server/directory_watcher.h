@@ -0,0 +1,236 @@
+#ifndef SERVER_DIRECTORY_WATCHER_H_
+#define SERVER_DIRECTORY_WATCHER_H_
+
+#include "logger.h"
+
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/chrono/include.hpp>
+
+namespace perf
+{
+namespace filelogic
+{
+
+// watches a directory with inotify from a thread of its own; names of files which
+// were written, created, moved or removed are collected until the directory has been
+// quiet for settle_ms, or for max_delay_ms at most, and handed over sorted and unique.
+// An overflowed event queue is reported with rescan set, the names are lost then
+class directory_watcher
+	: private boost::noncopyable
+{
+public:
+
+	typedef boost::function< void ( const std::vector< std::string >& names, bool rescan ) > changes_handler;
+
+	enum { settle_ms = 50, max_delay_ms = 500 };
+
+	// events are watched from here on, the handler is not called before start
+	directory_watcher( const boost::filesystem::path& dir, const changes_handler& handler )
+		: dir_( dir )
+		, handler_( handler )
+		, inotify_fd_( ::inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) )
+		, stop_fd_( ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) )
+		, rescan_( false )
+	{
+		if ( inotify_fd_ < 0 || stop_fd_ < 0 )
+		{
+			close_fds();
+			throw std::runtime_error( std::string( "can not create watcher: " ) + strerror( errno ) );
+		}
+
+		const boost::uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR;
+		if ( ::inotify_add_watch( inotify_fd_, dir_.string().c_str(), mask ) < 0 )
+		{
+			const std::string error = strerror( errno );
+			close_fds();
+			throw std::runtime_error( "can not watch " + dir_.string() + ": " + error );
+		}
+	}
+
+	~directory_watcher()
+	{
+		stop();
+		close_fds();
+	}
+
+	void start()
+	{
+		if ( !thread_ )
+		{
+			thread_.reset( new boost::thread( boost::bind( &directory_watcher::run, this ) ) );
+		}
+	}
+
+	// changes not handed over yet are dropped
+	void stop()
+	{
+		if ( thread_ )
+		{
+			const boost::uint64_t one = 1;
+			if ( ::write( stop_fd_, &one, sizeof( one ) ) < 0 )
+			{
+				PERF_LOG_ERROR( "can not stop watcher: " << strerror( errno ) );
+			}
+
+			thread_->join();
+			thread_.reset();
+		}
+	}
+
+private:
+
+	void run()
+	{
+		typedef boost::chrono::steady_clock clock;
+
+		clock::time_point first_change;
+		clock::time_point last_change;
+
+		for ( ;; )
+		{
+			int timeout = -1;
+			if ( has_changes() )
+			{
+				const clock::time_point now = clock::now();
+				const boost::chrono::milliseconds quiet( settle_ms );
+				const boost::chrono::milliseconds delay( max_delay_ms );
+				timeout = int( boost::chrono::duration_cast< boost::chrono::milliseconds >(
+					std::min( last_change + quiet, first_change + delay ) - now ).count() );
+
+				if ( timeout <= 0 )
+				{
+					hand_over();
+					continue;
+				}
+			}
+
+			pollfd fds[ 2 ] = { { inotify_fd_, POLLIN, 0 }, { stop_fd_, POLLIN, 0 } };
+			const int ready = ::poll( fds, 2, timeout );
+			if ( ready < 0 && errno != EINTR )
+			{
+				PERF_LOG_ERROR( "watching " << dir_.string() << ": " << strerror( errno ) );
+				return;
+			}
+
+			if ( ready > 0 && fds[ 1 ].revents )
+			{
+				return;
+			}
+
+			if ( ready > 0 && fds[ 0 ].revents )
+			{
+				const bool had_changes = has_changes();
+				read_events();
+
+				if ( has_changes() )
+				{
+					last_change = clock::now();
+					if ( !had_changes )
+					{
+						first_change = last_change;
+					}
+				}
+			}
+		}
+	}
+
+	void read_events()
+	{
+		char buffer[ 64 * 1024 ] __attribute__(( aligned( __alignof__( inotify_event ) ) ));
+
+		for ( ;; )
+		{
+			const ssize_t length = ::read( inotify_fd_, buffer, sizeof( buffer ) );
+			if ( length <= 0 )
+			{
+				return;
+			}
+
+			for ( ssize_t offset = 0; offset < length; )
+			{
+				const inotify_event* event = reinterpret_cast< const inotify_event* >( buffer + offset );
+				offset += sizeof( inotify_event ) + event->len;
+
+				if ( event->mask & IN_Q_OVERFLOW )
+				{
+					rescan_ = true;
+				}
+				else if ( event->len && !( event->mask & IN_ISDIR ) )
+				{
+					names_.push_back( event->name );
+				}
+			}
+		}
+	}
+
+	bool has_changes() const
+	{
+		return rescan_ || !names_.empty();
+	}
+
+	void hand_over()
+	{
+		std::sort( names_.begin(), names_.end() );
+		names_.erase( std::unique( names_.begin(), names_.end() ), names_.end() );
+
+		try
+		{
+			handler_( names_, rescan_ );
+		}
+		catch ( const std::exception& e )
+		{
+			PERF_LOG_ERROR( "applying changes of " << dir_.string() << ": " << e.what() );
+		}
+
+		names_.clear();
+		rescan_ = false;
+	}
+
+	void close_fds()
+	{
+		if ( inotify_fd_ >= 0 )
+		{
+			::close( inotify_fd_ );
+			inotify_fd_ = -1;
+		}
+
+		if ( stop_fd_ >= 0 )
+		{
+			::close( stop_fd_ );
+			stop_fd_ = -1;
+		}
+	}
+
+private:
+	const boost::filesystem::path dir_;
+	const changes_handler handler_;
+	int inotify_fd_;
+	int stop_fd_;
+	// touched by the watching thread only
+	std::vector< std::string > names_;
+	bool rescan_;
+	boost::scoped_ptr< boost::thread > thread_;
+};
+
+}
+}
+
+#endif // SERVER_DIRECTORY_WATCHER_H_
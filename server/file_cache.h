@@ -0,0 +1,205 @@
+#ifndef SERVER_FILE_CACHE_H_
+#define SERVER_FILE_CACHE_H_
+
+#include "file_logic.h"
+
+#include <list>
+#include <string>
+#include <stdexcept>
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace perf
+{
+namespace filelogic
+{
+
+enum cache_policy
+{
+	// hit moves entry to the head, the least recently used one is evicted
+	lru_cache_policy,
+	// entries are evicted in insertion order, hit does not touch the list
+	fifo_cache_policy
+};
+
+inline cache_policy cache_policy_from_string( const std::string& policy )
+{
+	if ( policy == "lru" )
+	{
+		return lru_cache_policy;
+	}
+	else if ( policy == "fifo" )
+	{
+		return fifo_cache_policy;
+	}
+
+	throw std::invalid_argument( "unknown cache policy: " + policy );
+}
+
+struct cache_settings
+{
+	cache_settings( size_t capacity_bytes = 0, cache_policy cache_pol = lru_cache_policy )
+		: capacity( capacity_bytes )
+		, policy( cache_pol )
+	{
+	}
+
+	size_t capacity;
+	cache_policy policy;
+};
+
+// size bounded cache of file contents; contents are reference counted so
+// an evicted entry stays alive until the last reply holding it is sent
+class file_cache
+	: private boost::noncopyable
+{
+public:
+
+	typedef size_t key_type;
+	typedef boost::shared_ptr< const file_content > content_ptr;
+
+	explicit file_cache( const cache_settings& settings )
+		: settings_( settings )
+		, size_( 0 )
+		, hits_( 0 )
+		, misses_( 0 )
+	{
+	}
+
+	content_ptr get( key_type key )
+	{
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		const index_type::iterator it = index_.find( key );
+		if ( it == index_.end() )
+		{
+			misses_.fetch_add( 1, boost::memory_order_relaxed );
+			return content_ptr();
+		}
+
+		if ( settings_.policy == lru_cache_policy )
+		{
+			entries_.splice( entries_.begin(), entries_, it->second );
+		}
+
+		hits_.fetch_add( 1, boost::memory_order_relaxed );
+
+		return it->second->content;
+	}
+
+	// returns false if content does not fit into the cache at all
+	bool put( key_type key, const content_ptr& content )
+	{
+		const size_t content_size = content->size();
+		if ( content_size > settings_.capacity )
+		{
+			return false;
+		}
+
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		if ( index_.count( key ) )
+		{
+			// other thread has loaded the same file
+			return true;
+		}
+
+		while ( size_ + content_size > settings_.capacity )
+		{
+			evict_last();
+		}
+
+		const entry item = { key, content };
+		entries_.push_front( item );
+		index_[ key ] = entries_.begin();
+		size_ += content_size;
+
+		return true;
+	}
+
+	// drops the content of a changed file, replies holding it keep it alive
+	void erase( key_type key )
+	{
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		const index_type::iterator it = index_.find( key );
+		if ( it == index_.end() )
+		{
+			return;
+		}
+
+		size_ -= it->second->content->size();
+		entries_.erase( it->second );
+		index_.erase( it );
+	}
+
+	void clear()
+	{
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		entries_.clear();
+		index_.clear();
+		size_ = 0;
+	}
+
+	size_t get_size() const
+	{
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		return size_;
+	}
+
+	const cache_settings& get_settings() const
+	{
+		return settings_;
+	}
+
+	boost::uint64_t get_hits() const
+	{
+		return hits_.load( boost::memory_order_relaxed );
+	}
+
+	boost::uint64_t get_misses() const
+	{
+		return misses_.load( boost::memory_order_relaxed );
+	}
+
+private:
+
+	void evict_last()
+	{
+		const entry& last = entries_.back();
+		size_ -= last.content->size();
+		index_.erase( last.key );
+		entries_.pop_back();
+	}
+
+private:
+
+	struct entry
+	{
+		key_type key;
+		content_ptr content;
+	};
+
+	typedef std::list< entry > entries_type;
+	typedef boost::unordered_map< key_type, entries_type::iterator > index_type;
+
+	const cache_settings settings_;
+	mutable boost::mutex mutex_;
+	entries_type entries_;
+	index_type index_;
+	size_t size_;
+	boost::atomic< boost::uint64_t > hits_;
+	boost::atomic< boost::uint64_t > misses_;
+};
+
+}
+}
+
+#endif /* SERVER_FILE_CACHE_H_ */
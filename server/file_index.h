@@ -0,0 +1,860 @@
+#ifndef SERVER_FILE_INDEX_H_
+#define SERVER_FILE_INDEX_H_
+
+#include "file_logic.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+
+namespace perf
+{
+namespace filelogic
+{
+
+struct file_entry
+{
+	boost::filesystem::path file_path;
+	boost::uint64_t disk_file_size;
+	boost::uint64_t inode;
+	// as stated, saved with the index to tell a file changed in place
+	statx_timestamp mtime;
+	statx_timestamp ctime;
+	// set when mapping is enabled
+	boost::shared_ptr< const file_content > mapping;
+};
+
+// part of the path after the last slash, without a copy
+inline void get_file_name( const std::string& path, const char*& name, size_t& length )
+{
+	const std::string::size_type slash = path.rfind( '/' );
+	const size_t name_pos = slash == std::string::npos ? 0 : slash + 1;
+
+	name = path.c_str() + name_pos;
+	length = path.length() - name_pos;
+}
+
+// file name to entry number; open addressing with linear probing over one flat array
+// of slots, the names are copied one after another into one block. A slot keeps the
+// full hash, so a probe compares names only when the hashes are equal, and a lookup
+// touches the slots and one name, it allocates nothing
+class file_name_index
+	: private boost::noncopyable
+{
+public:
+
+	static const size_t npos = size_t( -1 );
+
+	// names_count is an upper bound, the table is kept at most half full
+	explicit file_name_index( size_t names_count )
+		: mask_( 0 )
+		, size_( 0 )
+	{
+		size_t capacity = 16;
+		while ( capacity < names_count * 2 )
+		{
+			capacity *= 2;
+		}
+
+		slots_.resize( capacity );
+		mask_ = capacity - 1;
+	}
+
+	// a name inserted again keeps the first entry
+	void insert( const char* name, size_t length, size_t entry )
+	{
+		if ( ( size_ + 1 ) * 2 > slots_.size() )
+		{
+			throw std::length_error( "file name index is full" );
+		}
+
+		const boost::uint64_t hash = hash_name( name, length );
+		size_t idx = size_t( hash ) & mask_;
+		for ( ; slots_[ idx ].entry != empty_slot; idx = ( idx + 1 ) & mask_ )
+		{
+			if ( matches( slots_[ idx ], hash, name, length ) )
+			{
+				return;
+			}
+		}
+
+		slot& item = slots_[ idx ];
+		item.hash = hash;
+		item.name_offset = boost::uint32_t( names_.size() );
+		item.name_length = boost::uint32_t( length );
+		item.entry = boost::uint32_t( entry );
+		names_.insert( names_.end(), name, name + length );
+		++size_;
+	}
+
+	size_t find( const char* name, size_t length ) const
+	{
+		const boost::uint64_t hash = hash_name( name, length );
+		for ( size_t idx = size_t( hash ) & mask_; slots_[ idx ].entry != empty_slot; idx = ( idx + 1 ) & mask_ )
+		{
+			if ( matches( slots_[ idx ], hash, name, length ) )
+			{
+				return slots_[ idx ].entry;
+			}
+		}
+
+		return npos;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+private:
+
+	enum { empty_slot = 0xffffffff };
+
+	struct slot
+	{
+		slot()
+			: hash( 0 )
+			, name_offset( 0 )
+			, name_length( 0 )
+			, entry( empty_slot )
+		{
+		}
+
+		boost::uint64_t hash;
+		boost::uint32_t name_offset;
+		boost::uint32_t name_length;
+		boost::uint32_t entry;
+	};
+
+	// fnv-1a
+	static boost::uint64_t hash_name( const char* name, size_t length )
+	{
+		boost::uint64_t hash = 14695981039346656037ULL;
+		for ( size_t idx = 0; idx < length; ++idx )
+		{
+			hash ^= static_cast< unsigned char >( name[ idx ] );
+			hash *= 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	bool matches( const slot& item, boost::uint64_t hash, const char* name, size_t length ) const
+	{
+		return item.hash == hash
+			&& item.name_length == length
+			&& !memcmp( &names_[ 0 ] + item.name_offset, name, length );
+	}
+
+private:
+	std::vector< slot > slots_;
+	std::vector< char > names_;
+	size_t mask_;
+	size_t size_;
+};
+
+// append only table of entries, filled by one thread while others read it: entries
+// live in segments which never move, size is published after the entries are in.
+// Names are looked up once the filling thread has indexed them, after the last entry
+class file_table
+	: private boost::noncopyable
+{
+public:
+
+	enum { segment_size = 4096, max_segments = 65536 };
+
+	file_table()
+		: segments_( max_segments )
+		, size_( 0 )
+		, published_size_( 0 )
+		, names_( 0 )
+	{
+	}
+
+	~file_table()
+	{
+		clear();
+	}
+
+	// by the filling thread only
+	void push_back( const file_entry& entry )
+	{
+		const size_t segment = size_ / segment_size;
+		if ( segment == max_segments )
+		{
+			throw std::length_error( "too many files to index" );
+		}
+
+		if ( !segments_[ segment ] )
+		{
+			segments_[ segment ] = new file_entry[ segment_size ];
+		}
+
+		segments_[ segment ][ size_ % segment_size ] = entry;
+		++size_;
+	}
+
+	// makes the pushed entries visible to readers
+	void publish()
+	{
+		published_size_.store( size_, boost::memory_order_release );
+	}
+
+	size_t size() const
+	{
+		return published_size_.load( boost::memory_order_acquire );
+	}
+
+	const file_entry& operator[]( size_t idx ) const
+	{
+		return segments_[ idx / segment_size ][ idx % segment_size ];
+	}
+
+	// by the filling thread when all entries are in, no entry is pushed after it
+	void index_names()
+	{
+		file_name_index* const names = new file_name_index( size_ );
+		for ( size_t idx = 0; idx < size_; ++idx )
+		{
+			const char* name = 0;
+			size_t length = 0;
+			get_file_name( ( *this )[ idx ].file_path.native(), name, length );
+			names->insert( name, length, idx );
+		}
+
+		delete names_.exchange( names, boost::memory_order_acq_rel );
+	}
+
+	// null until the names are indexed
+	const file_entry* find( const std::string& name ) const
+	{
+		const file_name_index* const names = names_.load( boost::memory_order_acquire );
+		if ( !names )
+		{
+			return 0;
+		}
+
+		const size_t idx = names->find( name.data(), name.length() );
+
+		return idx == file_name_index::npos ? 0 : &( *this )[ idx ];
+	}
+
+	// nobody may read the table meanwhile
+	void clear()
+	{
+		for ( size_t idx = 0; idx < segments_.size() && segments_[ idx ]; ++idx )
+		{
+			delete [] segments_[ idx ];
+			segments_[ idx ] = 0;
+		}
+
+		size_ = 0;
+		publish();
+
+		delete names_.exchange( 0 );
+	}
+
+private:
+	// allocated once, never resized
+	std::vector< file_entry* > segments_;
+	size_t size_;
+	boost::atomic< size_t > published_size_;
+	boost::atomic< file_name_index* > names_;
+};
+
+// index of a directory saved by a previous run, mapped read only; records are
+// sorted by name so a name is looked up without building anything in memory
+class index_file
+	: private boost::noncopyable
+{
+public:
+
+	struct header
+	{
+		char magic[ 4 ];
+		boost::uint32_t version;
+		boost::uint64_t records_count;
+		boost::int64_t dir_mtime_sec;
+		boost::int64_t dir_mtime_nsec;
+	};
+
+	struct record
+	{
+		boost::uint64_t inode;
+		boost::uint64_t size;
+		boost::int64_t mtime_sec;
+		boost::int64_t ctime_sec;
+		boost::uint32_t mtime_nsec;
+		boost::uint32_t ctime_nsec;
+		boost::uint32_t name_offset;
+		boost::uint32_t name_length;
+	};
+
+	enum { version = 2 };
+
+	// invalid when the file is missing or is not an index
+	explicit index_file( const std::string& path )
+		: data_( 0 )
+		, length_( 0 )
+		, header_( 0 )
+		, records_( 0 )
+		, names_( 0 )
+	{
+		const int fd = ::open( path.c_str(), O_RDONLY );
+		if ( fd < 0 )
+		{
+			return;
+		}
+
+		struct stat file_stat;
+		if ( !::fstat( fd, &file_stat ) && size_t( file_stat.st_size ) >= sizeof( header ) )
+		{
+			void* addr = ::mmap( 0, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+			if ( addr != MAP_FAILED )
+			{
+				data_ = static_cast< const char* >( addr );
+				length_ = file_stat.st_size;
+			}
+		}
+
+		::close( fd );
+
+		if ( data_ )
+		{
+			validate();
+		}
+	}
+
+	~index_file()
+	{
+		if ( data_ )
+		{
+			::munmap( const_cast< char* >( data_ ), length_ );
+		}
+	}
+
+	bool is_valid() const
+	{
+		return header_ != 0;
+	}
+
+	size_t size() const
+	{
+		return header_ ? header_->records_count : 0;
+	}
+
+	// directory has had no entry added, removed or renamed since the index was saved
+	bool is_current( const statx_timestamp& dir_mtime ) const
+	{
+		return header_
+			&& header_->dir_mtime_sec == dir_mtime.tv_sec
+			&& header_->dir_mtime_nsec == dir_mtime.tv_nsec;
+	}
+
+	const record& get( size_t idx ) const
+	{
+		return records_[ idx ];
+	}
+
+	std::string get_name( size_t idx ) const
+	{
+		return std::string( names_ + records_[ idx ].name_offset, records_[ idx ].name_length );
+	}
+
+	// a file written in place keeps its inode and the directory's mtime, its own
+	// mtime and ctime tell it
+	static bool is_unchanged( const record& rec, const struct statx& file_stat )
+	{
+		return rec.inode == file_stat.stx_ino
+			&& rec.size == file_stat.stx_size
+			&& rec.mtime_sec == file_stat.stx_mtime.tv_sec
+			&& rec.mtime_nsec == file_stat.stx_mtime.tv_nsec
+			&& rec.ctime_sec == file_stat.stx_ctime.tv_sec
+			&& rec.ctime_nsec == file_stat.stx_ctime.tv_nsec;
+	}
+
+	static record make_record( const file_entry& entry )
+	{
+		record rec = record();
+		rec.inode = entry.inode;
+		rec.size = entry.disk_file_size;
+		rec.mtime_sec = entry.mtime.tv_sec;
+		rec.mtime_nsec = entry.mtime.tv_nsec;
+		rec.ctime_sec = entry.ctime.tv_sec;
+		rec.ctime_nsec = entry.ctime.tv_nsec;
+
+		return rec;
+	}
+
+	// 0 when there is no such name
+	const record* find( const char* name, size_t length ) const
+	{
+		size_t low = 0;
+		size_t high = size();
+		while ( low < high )
+		{
+			const size_t middle = low + ( high - low ) / 2;
+			const int res = compare( records_[ middle ], name, length );
+			if ( !res )
+			{
+				return &records_[ middle ];
+			}
+
+			if ( res < 0 )
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+
+		return 0;
+	}
+
+	// entries are sorted here; written aside and renamed, so a reader never sees half an index
+	static void save(
+		const std::string& path
+		, const statx_timestamp& dir_mtime
+		, std::vector< std::pair< std::string, record > >& entries )
+	{
+		std::sort( entries.begin(), entries.end(), less_name );
+
+		header head;
+		memcpy( head.magic, "PFIX", sizeof( head.magic ) );
+		head.version = version;
+		head.records_count = entries.size();
+		head.dir_mtime_sec = dir_mtime.tv_sec;
+		head.dir_mtime_nsec = dir_mtime.tv_nsec;
+
+		boost::uint32_t name_offset = 0;
+		for ( size_t idx = 0; idx < entries.size(); ++idx )
+		{
+			entries[ idx ].second.name_offset = name_offset;
+			entries[ idx ].second.name_length = entries[ idx ].first.length();
+			name_offset += entries[ idx ].first.length();
+		}
+
+		const std::string tmp_path = path + ".tmp";
+		{
+			std::ofstream out( tmp_path.c_str(), std::ios::binary | std::ios::trunc );
+			out.write( reinterpret_cast< const char* >( &head ), sizeof( head ) );
+			for ( size_t idx = 0; idx < entries.size(); ++idx )
+			{
+				out.write( reinterpret_cast< const char* >( &entries[ idx ].second ), sizeof( record ) );
+			}
+			for ( size_t idx = 0; idx < entries.size(); ++idx )
+			{
+				out.write( entries[ idx ].first.data(), entries[ idx ].first.length() );
+			}
+
+			if ( !out )
+			{
+				throw std::runtime_error( "can not write index file " + tmp_path );
+			}
+		}
+
+		if ( ::rename( tmp_path.c_str(), path.c_str() ) )
+		{
+			throw std::runtime_error( "can not rename index file to " + path + ": " + strerror( errno ) );
+		}
+	}
+
+private:
+
+	void validate()
+	{
+		const header* head = reinterpret_cast< const header* >( data_ );
+		if ( memcmp( head->magic, "PFIX", sizeof( head->magic ) ) || head->version != version )
+		{
+			return;
+		}
+
+		const boost::uint64_t names_start = sizeof( header ) + head->records_count * sizeof( record );
+		if ( head->records_count > length_ / sizeof( record ) || names_start > length_ )
+		{
+			return;
+		}
+
+		const record* records = reinterpret_cast< const record* >( data_ + sizeof( header ) );
+		const boost::uint64_t names_length = length_ - names_start;
+		for ( size_t idx = 0; idx < head->records_count; ++idx )
+		{
+			if ( boost::uint64_t( records[ idx ].name_offset ) + records[ idx ].name_length > names_length )
+			{
+				return;
+			}
+		}
+
+		header_ = head;
+		records_ = records;
+		names_ = data_ + names_start;
+	}
+
+	int compare( const record& rec, const char* name, size_t length ) const
+	{
+		const int res = memcmp( names_ + rec.name_offset, name, std::min< size_t >( rec.name_length, length ) );
+		if ( res )
+		{
+			return res;
+		}
+
+		return rec.name_length < length ? -1 : ( rec.name_length > length ? 1 : 0 );
+	}
+
+	static bool less_name(
+		const std::pair< std::string, record >& left
+		, const std::pair< std::string, record >& right )
+	{
+		return left.first < right.first;
+	}
+
+private:
+	const char* data_;
+	size_t length_;
+	const header* header_;
+	const record* records_;
+	const char* names_;
+};
+
+namespace detail
+{
+
+struct listed_file
+{
+	std::string name;
+	unsigned char type;
+};
+
+inline void throw_errno( const std::string& what )
+{
+	throw std::runtime_error( what + ": " + strerror( errno ) );
+}
+
+// names straight from getdents64, in large batches and without a stat per entry
+inline void list_directory( int dir_fd, std::vector< listed_file >& files )
+{
+	std::vector< char > buffer( 1024 * 1024 );
+
+	for ( ;; )
+	{
+		const ssize_t length = ::getdents64( dir_fd, &buffer[ 0 ], buffer.size() );
+		if ( length < 0 )
+		{
+			throw_errno( "getdents64" );
+		}
+
+		if ( !length )
+		{
+			break;
+		}
+
+		for ( ssize_t offset = 0; offset < length; )
+		{
+			const dirent64* entry = reinterpret_cast< const dirent64* >( &buffer[ offset ] );
+			offset += entry->d_reclen;
+
+			if ( entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN )
+			{
+				continue;
+			}
+
+			listed_file file;
+			file.name = entry->d_name;
+			file.type = entry->d_type;
+			files.push_back( file );
+		}
+	}
+}
+
+// sets the path and maps the file while fewer than max_mapped_files are mapped, 0
+// maps none; a file left unmapped is served with sendfile. The scanning threads
+// check the count together, it may go over by as many as they are
+inline void complete_entry(
+	const boost::filesystem::path& dir
+	, const std::string& name
+	, size_t max_mapped_files
+	, file_entry& entry )
+{
+	entry.file_path = dir;
+	entry.file_path /= name;
+
+	if ( !max_mapped_files )
+	{
+		return;
+	}
+
+	if ( mapped_file_content::get_mapped_count() >= max_mapped_files )
+	{
+		PERF_LOG_WARNING( "not mapped, " << max_mapped_files << " files are: " << entry.file_path.string() );
+		return;
+	}
+
+	try
+	{
+		entry.mapping.reset( new mapped_file_content( entry.file_path.string() ) );
+	}
+	catch ( const std::exception& e )
+	{
+		PERF_LOG_ERROR( e.what() << ", served unmapped" );
+	}
+}
+
+}
+
+namespace detail
+{
+
+// false when the file is not a regular one or is gone
+inline bool stat_regular_file( int dir_fd, const std::string& name, struct statx& file_stat )
+{
+	const unsigned int mask = STATX_TYPE | STATX_SIZE | STATX_INO | STATX_MTIME | STATX_CTIME;
+	if ( ::statx( dir_fd, name.c_str(), 0, mask, &file_stat ) )
+	{
+		return false;
+	}
+
+	return S_ISREG( file_stat.stx_mode );
+}
+
+inline void complete_entry(
+	const boost::filesystem::path& dir
+	, const std::string& name
+	, size_t max_mapped_files
+	, const struct statx& file_stat
+	, file_entry& entry )
+{
+	entry.disk_file_size = file_stat.stx_size;
+	entry.inode = file_stat.stx_ino;
+	entry.mtime = file_stat.stx_mtime;
+	entry.ctime = file_stat.stx_ctime;
+
+	complete_entry( dir, name, max_mapped_files, entry );
+}
+
+}
+
+// entry of one file of the directory open as dir_fd; false when the file is not
+// a regular one or is gone
+inline bool stat_file_entry(
+	int dir_fd
+	, const boost::filesystem::path& dir
+	, const std::string& name
+	, size_t max_mapped_files
+	, file_entry& entry )
+{
+	struct statx file_stat;
+	if ( !detail::stat_regular_file( dir_fd, name, file_stat ) )
+	{
+		return false;
+	}
+
+	detail::complete_entry( dir, name, max_mapped_files, file_stat, entry );
+
+	return true;
+}
+
+// what a scan has done, for reporting and tests
+struct scan_stats
+{
+	scan_stats()
+		: listed( 0 )
+		, stated( 0 )
+		, reused( 0 )
+		, from_index( false )
+	{
+	}
+
+	size_t listed;
+	// entries which took a statx, every listed one
+	size_t stated;
+	// entries the saved index has as they are now
+	size_t reused;
+	// directory was not listed at all, the index was current
+	bool from_index;
+};
+
+// builds entries of a directory: names come from getdents64 or, when the directory
+// has not changed since, from the saved index; the index saves the listing only, a
+// file rewritten in place leaves the directory as it was, so every entry is statx'ed
+// by a pool of threads in batches. Finished batches are handed to the calling
+// thread in completion order, so it may publish them while the rest is scanned
+class directory_scanner
+	: private boost::noncopyable
+{
+public:
+
+	typedef boost::function< void ( const std::vector< file_entry >& ) > batch_handler;
+
+	enum { batch_size = 1024 };
+
+	directory_scanner( const boost::filesystem::path& dir, size_t threads_count, size_t max_mapped_files )
+		: dir_( dir )
+		, threads_count_( std::max< size_t >( threads_count, 1 ) )
+		, max_mapped_files_( max_mapped_files )
+		, dir_fd_( -1 )
+		, next_batch_( 0 )
+		, stated_( 0 )
+		, reused_( 0 )
+	{
+		dir_fd_ = ::open( dir_.string().c_str(), O_RDONLY | O_DIRECTORY );
+		if ( dir_fd_ < 0 )
+		{
+			detail::throw_errno( "can not open directory " + dir_.string() );
+		}
+	}
+
+	~directory_scanner()
+	{
+		::close( dir_fd_ );
+	}
+
+	// returns directory modification time taken before listing, to be saved with the index
+	statx_timestamp scan( const index_file& index, const batch_handler& handler, scan_stats& stats )
+	{
+		struct statx dir_stat;
+		if ( ::statx( dir_fd_, "", AT_EMPTY_PATH, STATX_MTIME, &dir_stat ) )
+		{
+			detail::throw_errno( "statx " + dir_.string() );
+		}
+
+		if ( index.is_current( dir_stat.stx_mtime ) )
+		{
+			stats.from_index = true;
+			for ( size_t idx = 0; idx < index.size(); ++idx )
+			{
+				detail::listed_file file;
+				file.name = index.get_name( idx );
+				file.type = DT_REG;
+				files_.push_back( file );
+			}
+		}
+		else
+		{
+			detail::list_directory( dir_fd_, files_ );
+		}
+		stats.listed = files_.size();
+
+		const size_t batches_count = ( files_.size() + batch_size - 1 ) / batch_size;
+		batches_.resize( batches_count );
+
+		boost::thread_group threads;
+		for ( size_t idx = 0; idx < std::min( threads_count_, batches_count ); ++idx )
+		{
+			threads.create_thread( boost::bind( &directory_scanner::run_worker, this, boost::cref( index ) ) );
+		}
+
+		// finished batches are handed over as they come, whatever their order
+		for ( size_t handed = 0; handed < batches_count; ++handed )
+		{
+			size_t batch = 0;
+			{
+				boost::unique_lock< boost::mutex > lock( mutex_ );
+				while ( finished_.empty() )
+				{
+					batch_finished_.wait( lock );
+				}
+				batch = finished_.front();
+				finished_.pop_front();
+			}
+
+			handler( batches_[ batch ] );
+			std::vector< file_entry >().swap( batches_[ batch ] );
+		}
+
+		threads.join_all();
+
+		stats.stated = stated_.load();
+		stats.reused = reused_.load();
+
+		return dir_stat.stx_mtime;
+	}
+
+private:
+
+	void run_worker( const index_file& index )
+	{
+		const size_t batches_count = batches_.size();
+		for ( size_t batch = next_batch_++; batch < batches_count; batch = next_batch_++ )
+		{
+			const size_t end = std::min( files_.size(), ( batch + 1 ) * batch_size );
+			for ( size_t idx = batch * batch_size; idx < end; ++idx )
+			{
+				file_entry entry;
+				if ( make_entry( index, files_[ idx ], entry ) )
+				{
+					batches_[ batch ].push_back( entry );
+				}
+			}
+
+			{
+				boost::lock_guard< boost::mutex > lock( mutex_ );
+				finished_.push_back( batch );
+			}
+			batch_finished_.notify_one();
+		}
+	}
+
+	// false when the entry is not a regular file or is gone
+	bool make_entry( const index_file& index, const detail::listed_file& file, file_entry& entry )
+	{
+		++stated_;
+
+		struct statx file_stat;
+		if ( !detail::stat_regular_file( dir_fd_, file.name, file_stat ) )
+		{
+			return false;
+		}
+
+		const index_file::record* known = index.find( file.name.data(), file.name.length() );
+		if ( known && index_file::is_unchanged( *known, file_stat ) )
+		{
+			++reused_;
+		}
+
+		detail::complete_entry( dir_, file.name, max_mapped_files_, file_stat, entry );
+
+		return true;
+	}
+
+private:
+	const boost::filesystem::path dir_;
+	const size_t threads_count_;
+	const size_t max_mapped_files_;
+	int dir_fd_;
+	std::vector< detail::listed_file > files_;
+	std::vector< std::vector< file_entry > > batches_;
+	boost::atomic< size_t > next_batch_;
+	boost::atomic< size_t > stated_;
+	boost::atomic< size_t > reused_;
+	boost::mutex mutex_;
+	boost::condition_variable batch_finished_;
+	std::deque< size_t > finished_;
+};
+
+}
+}
+
+#endif // SERVER_FILE_INDEX_H_
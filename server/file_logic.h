@@ -6,12 +6,19 @@
 #include <math.h>
 #include <fstream>
 #include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <boost/bind.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
 
 namespace perf
 {
@@ -25,6 +32,205 @@ struct file_stream_info
 	boost::shared_ptr< std::istream > stream;
 };
 
+// opened on io threads, a file gone or not readable is told by is_open and
+// served as a miss instead of failing the connection
+class file_descriptor
+	: private boost::noncopyable
+{
+public:
+
+	explicit file_descriptor( const std::string& file_path )
+		: fd_( ::open( file_path.c_str(), O_RDONLY ) )
+	{
+	}
+
+	~file_descriptor()
+	{
+		if ( is_open() )
+		{
+			::close( fd_ );
+		}
+	}
+
+	bool is_open() const
+	{
+		return fd_ >= 0;
+	}
+
+	int get() const
+	{
+		return fd_;
+	}
+
+private:
+
+	const int fd_;
+};
+
+struct file_descriptor_info
+{
+	std::string file_name;
+	size_t disk_file_size;
+	boost::shared_ptr< file_descriptor > descriptor;
+};
+
+// immutable file bytes shared between the cache and the replies being sent
+class file_content
+	: private boost::noncopyable
+{
+public:
+
+	virtual ~file_content()
+	{
+	}
+
+	virtual const char* data() const = 0;
+	virtual size_t size() const = 0;
+};
+
+// read on io threads as file_descriptor is opened, a file which can not be read
+// whole is told by is_read
+class memory_file_content
+	: public file_content
+{
+public:
+
+	memory_file_content( const std::string& file_path, size_t file_size )
+		: data_( file_size )
+		, read_( false )
+	{
+		std::ifstream file( file_path.c_str(), std::ios::binary );
+		file.read( data_.empty() ? 0 : &data_[ 0 ], data_.size() );
+
+		read_ = size_t( file.gcount() ) == data_.size();
+		if ( !read_ )
+		{
+			std::vector< char >().swap( data_ );
+		}
+	}
+
+	bool is_read() const
+	{
+		return read_;
+	}
+
+	const char* data() const
+	{
+		return data_.empty() ? 0 : &data_[ 0 ];
+	}
+
+	size_t size() const
+	{
+		return data_.size();
+	}
+
+private:
+
+	std::vector< char > data_;
+	bool read_;
+};
+
+// mmap fails past vm.max_map_count, which is about 65k mappings by default; the
+// mappings of files are kept to half of it, the rest is left to the heap, thread
+// stacks and libraries
+inline size_t get_default_max_mapped_files()
+{
+	size_t max_map_count = 65530;
+	std::ifstream in( "/proc/sys/vm/max_map_count" );
+	in >> max_map_count;
+
+	return max_map_count / 2;
+}
+
+class mapped_file_content
+	: public file_content
+{
+public:
+
+	explicit mapped_file_content( const std::string& file_path )
+		: data_( 0 )
+		, size_( 0 )
+	{
+		file_descriptor file( file_path );
+		if ( !file.is_open() )
+		{
+			throw std::runtime_error( "can not open file " + file_path );
+		}
+
+		const off_t file_size = ::lseek( file.get(), 0, SEEK_END );
+		if ( file_size < 0 )
+		{
+			throw std::runtime_error( "can not get size of file " + file_path );
+		}
+
+		size_ = file_size;
+		if ( !size_ )
+		{
+			// zero length mapping is not allowed
+			return;
+		}
+
+		void* addr = ::mmap( 0, size_, PROT_READ, MAP_SHARED, file.get(), 0 );
+		if ( addr == MAP_FAILED )
+		{
+			throw std::runtime_error( "can not map file " + file_path );
+		}
+
+		data_ = static_cast< const char* >( addr );
+		++get_counter();
+
+		// replies are written front to back, let the kernel read ahead aggressively
+		::madvise( addr, size_, MADV_SEQUENTIAL );
+		::madvise( addr, size_, MADV_WILLNEED );
+	}
+
+	~mapped_file_content()
+	{
+		if ( data_ )
+		{
+			::munmap( const_cast< char* >( data_ ), size_ );
+			--get_counter();
+		}
+	}
+
+	// mappings alive in the process
+	static size_t get_mapped_count()
+	{
+		return get_counter().load();
+	}
+
+	const char* data() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+private:
+
+	static boost::atomic< size_t >& get_counter()
+	{
+		static boost::atomic< size_t > counter( 0 );
+
+		return counter;
+	}
+
+private:
+
+	const char* data_;
+	size_t size_;
+};
+
+struct file_content_info
+{
+	std::string file_name;
+	size_t disk_file_size;
+	boost::shared_ptr< const file_content > content;
+};
+
 class file_generator
 {
 public:
@@ -2,12 +2,24 @@
 #define SERVER_FILE_PROVIDER_H_
 
 #include "file_logic.h"
+#include "file_cache.h"
+#include "file_index.h"
+#include "directory_watcher.h"
+#include "rcu.h"
+#include "logger.h"
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <string>
 #include <iostream>
 #include <vector>
+#include <utility>
+#include <stdexcept>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread/tss.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -18,71 +30,263 @@ namespace perf
 {
 namespace filelogic
 {
-namespace detail
-{
-	struct file_entry
-	{
-		boost::filesystem::path file_path;
-		size_t disk_file_size;
-	};
-}
 
+// files of the directory, picked at random; the index is built by attach, in the
+// background with start_attach, files are served as soon as the first batch is in.
+// Readers take the current table through an atomic pointer under an rcu read guard
+// and never lock; later changes are built into a new table which replaces the
+// current one whole, the replaced table is freed once no reader is left in it
 class file_provider
 {
 public:
 
 	explicit file_provider( const boost::filesystem::path& file_dir )
 		: file_dir_path_( file_dir )
-		, files_()
-		, dist_()
+		, files_( 0 )
+		, max_mapped_files_( 0 )
+		, watching_enabled_( false )
+		, scan_threads_( std::max( boost::thread::hardware_concurrency(), 1u ) )
+		, attaching_( false )
+	{
+	}
+
+	~file_provider()
+	{
+		if ( attach_thread_ )
+		{
+			attach_thread_->join();
+		}
+
+		watcher_.reset();
+		delete files_.load();
+	}
+
+	// contents loaded by get_file_content are kept within the settings budget
+	void enable_cache( const cache_settings& settings )
+	{
+		cache_.reset( new file_cache( settings ) );
+	}
+
+	// files are mapped into memory by attach and served by get_mapped_file, up to
+	// max_mapped_files of them; get_mapped_file gives the others with no content
+	void enable_mapping( size_t max_mapped_files = get_default_max_mapped_files() )
+	{
+		max_mapped_files_ = max_mapped_files;
+	}
+
+	// index is loaded from the file on attach and saved there after it
+	void enable_index( const std::string& index_path )
+	{
+		index_path_ = index_path;
+	}
+
+	// files added, removed or changed after attach are applied to the served set
+	void enable_watching()
 	{
-		files_.reserve( 1024 );
+		watching_enabled_ = true;
+	}
 
-		/*boost::packaged_task< void > pt( boost::bind( &file_provider::attach, this ) );
-		future_attach_ = pt.get_future();
-		boost::thread task( boost::move(pt) );
-		task.detach();*/
+	void set_scan_threads( size_t threads_count )
+	{
+		scan_threads_ = std::max< size_t >( threads_count, 1 );
 	}
 
+	// builds the index; the first one is served while it grows, a later one
+	// replaces the served index when it is complete
 	void attach()
 	{
-		files_.clear();
-		dist_.reset();
+		{
+			boost::lock_guard< boost::mutex > lock( writer_mutex_ );
+
+			if ( watching_enabled_ && !watcher_ )
+			{
+				// watched before the scan, so a change made meanwhile is not missed
+				watcher_.reset( new directory_watcher(
+					file_dir_path_, boost::bind( &file_provider::apply_changes, this, _1, _2 ) ) );
+			}
+
+			file_table* const table = new file_table();
+			const bool first = !files_.load();
+			if ( first )
+			{
+				files_.store( table );
+			}
+
+			try
+			{
+				scan( *table );
+				table->index_names();
+			}
+			catch ( ... )
+			{
+				if ( !first )
+				{
+					delete table;
+				}
+				throw;
+			}
+
+			if ( !first )
+			{
+				if ( cache_ )
+				{
+					cache_->clear();
+				}
+				replace_table( table );
+			}
+		}
+
+		set_attached();
+
+		if ( watcher_ )
+		{
+			watcher_->start();
+		}
+	}
+
+	// attach in a thread of its own; returns at once
+	void start_attach()
+	{
+		{
+			boost::lock_guard< boost::mutex > lock( state_mutex_ );
+			attaching_ = true;
+		}
 
-		namespace fs = boost::filesystem;
-		using namespace detail;
+		attach_thread_.reset( new boost::thread( boost::bind( &file_provider::run_attach, this ) ) );
+	}
+
+	// waits until there is a file to serve or attach has found none
+	void wait_until_serving() const
+	{
+		boost::unique_lock< boost::mutex > lock( state_mutex_ );
+		while ( attaching_ && !get_files_count() )
+		{
+			state_changed_.wait( lock );
+		}
+	}
 
-		file_entry item;
-		fs::directory_iterator end;
-		for ( fs::directory_iterator it( file_dir_path_ ); it != end; ++it )
+	// waits for the whole index
+	void wait_until_attached() const
+	{
+		boost::unique_lock< boost::mutex > lock( state_mutex_ );
+		while ( attaching_ )
 		{
-		    const fs::path& file_path = it->path();
-		    item.file_path = file_path;
-		    item.disk_file_size = fs::file_size( file_path );
-			files_.push_back( item );
+			state_changed_.wait( lock );
 		}
+	}
 
-		dist_.reset( new boost::random::uniform_int_distribution<>( 0, files_.size() - 1 ) );
+	const scan_stats& get_scan_stats() const
+	{
+		return scan_stats_;
 	}
 
 	file_stream_info get_file() const
 	{
-		using namespace detail;
+		const rcu_domain::read_guard guard( rcu_ );
 
-		const size_t idx = get_random_idx();
+		file_stream_info info = file_stream_info();
+		const file_entry* const item = pick_file();
+		if ( item )
+		{
+			make_stream_info( *item, info );
+		}
 
-		file_entry item = files_[ idx ];
-		file_stream_info info = {
-			item.file_path.filename().string()
-			, item.disk_file_size
-			, boost::shared_ptr< std::istream >( new std::ifstream( item.file_path.string().c_str() ) ) };
+		return info;
+	}
+
+	// with no files served or a picked file which can not be opened or read the info
+	// has no name, the named getters return false then and when no file of the name
+	// is served
+	bool get_file( const std::string& name, file_stream_info& info ) const
+	{
+		const rcu_domain::read_guard guard( rcu_ );
+		const file_entry* const item = find_file( name );
+
+		return item && make_stream_info( *item, info );
+	}
+
+	file_descriptor_info get_file_descriptor() const
+	{
+		const rcu_domain::read_guard guard( rcu_ );
+
+		file_descriptor_info info = file_descriptor_info();
+		const file_entry* const item = pick_file();
+		if ( item )
+		{
+			make_descriptor_info( *item, info );
+		}
+
+		return info;
+	}
+
+	bool get_file_descriptor( const std::string& name, file_descriptor_info& info ) const
+	{
+		const rcu_domain::read_guard guard( rcu_ );
+		const file_entry* const item = find_file( name );
+
+		return item && make_descriptor_info( *item, info );
+	}
+
+	file_content_info get_file_content() const
+	{
+		const rcu_domain::read_guard guard( rcu_ );
+
+		file_content_info info = file_content_info();
+		const file_entry* const item = pick_file();
+		if ( item )
+		{
+			make_content_info( *item, info );
+		}
+
+		return info;
+	}
+
+	bool get_file_content( const std::string& name, file_content_info& info ) const
+	{
+		const rcu_domain::read_guard guard( rcu_ );
+		const file_entry* const item = find_file( name );
+
+		return item && make_content_info( *item, info );
+	}
+
+	file_content_info get_mapped_file() const
+	{
+		const rcu_domain::read_guard guard( rcu_ );
+
+		file_content_info info = file_content_info();
+		const file_entry* const item = pick_file();
+		if ( item )
+		{
+			info = make_mapped_info( *item );
+		}
 
 		return info;
 	}
 
+	bool get_mapped_file( const std::string& name, file_content_info& info ) const
+	{
+		const rcu_domain::read_guard guard( rcu_ );
+		const file_entry* const item = find_file( name );
+		if ( item )
+		{
+			info = make_mapped_info( *item );
+		}
+
+		return item != 0;
+	}
+
+	const file_cache* get_cache() const
+	{
+		return cache_.get();
+	}
+
+	// files served now
 	size_t get_files_count() const
 	{
-		return files_.size();
+		const rcu_domain::read_guard guard( rcu_ );
+		const file_table* const files = files_.load();
+
+		return files ? files->size() : 0;
 	}
 
 	boost::filesystem::path get_file_dir() const
@@ -92,7 +296,268 @@ public:
 
 private:
 
-	size_t get_random_idx() const
+	void scan( file_table& table )
+	{
+		const index_file index( index_path_ );
+		directory_scanner scanner( file_dir_path_, scan_threads_, max_mapped_files_ );
+
+		scan_stats stats;
+		const statx_timestamp dir_mtime = scanner.scan(
+			index, boost::bind( &file_provider::add_batch, this, boost::ref( table ), _1 ), stats );
+
+		scan_stats_ = stats;
+		PERF_LOG_INFO( "indexed " << table.size() << " files, " << stats.stated <<
+			" stated, " << stats.reused << " unchanged since the saved index" );
+
+		// saved again when a file has changed in place as well
+		if ( !index_path_.empty() && ( !stats.from_index || stats.reused != table.size() ) )
+		{
+			std::vector< std::pair< std::string, index_file::record > > saved;
+			for ( size_t idx = 0; idx < table.size(); ++idx )
+			{
+				saved.push_back( std::make_pair(
+					table[ idx ].file_path.filename().string(), index_file::make_record( table[ idx ] ) ) );
+			}
+			index_file::save( index_path_, dir_mtime, saved );
+		}
+	}
+
+	// called by the attaching thread for every scanned batch
+	void add_batch( file_table& table, const std::vector< file_entry >& batch )
+	{
+		for ( size_t idx = 0; idx < batch.size(); ++idx )
+		{
+			table.push_back( batch[ idx ] );
+		}
+		table.publish();
+
+		if ( !batch.empty() )
+		{
+			boost::lock_guard< boost::mutex > lock( state_mutex_ );
+			state_changed_.notify_all();
+		}
+	}
+
+	void set_attached()
+	{
+		boost::lock_guard< boost::mutex > lock( state_mutex_ );
+		attaching_ = false;
+		state_changed_.notify_all();
+	}
+
+	void run_attach()
+	{
+		try
+		{
+			attach();
+		}
+		catch ( const std::exception& e )
+		{
+			PERF_LOG_ERROR( "attach " << file_dir_path_.string() << ": " << e.what() );
+			set_attached();
+		}
+	}
+
+	// the make_*_info functions run on io threads, a file removed or made unreadable
+	// since it was indexed gives false
+
+	static bool make_stream_info( const file_entry& item, file_stream_info& info )
+	{
+		const boost::shared_ptr< std::istream > stream( new std::ifstream( item.file_path.string().c_str() ) );
+		if ( !*stream )
+		{
+			return false;
+		}
+
+		info.file_name = item.file_path.filename().string();
+		info.disk_file_size = item.disk_file_size;
+		info.stream = stream;
+
+		return true;
+	}
+
+	static bool make_descriptor_info( const file_entry& item, file_descriptor_info& info )
+	{
+		const boost::shared_ptr< file_descriptor > descriptor( new file_descriptor( item.file_path.string() ) );
+		if ( !descriptor->is_open() )
+		{
+			return false;
+		}
+
+		info.file_name = item.file_path.filename().string();
+		info.disk_file_size = item.disk_file_size;
+		info.descriptor = descriptor;
+
+		return true;
+	}
+
+	bool make_content_info( const file_entry& item, file_content_info& info ) const
+	{
+		// inode stays with the file while the table is replaced, changed files are erased
+		file_cache::content_ptr content;
+		if ( cache_ )
+		{
+			content = cache_->get( item.inode );
+		}
+
+		if ( !content )
+		{
+			const boost::shared_ptr< memory_file_content > read(
+				new memory_file_content( item.file_path.string(), item.disk_file_size ) );
+			if ( !read->is_read() )
+			{
+				return false;
+			}
+
+			content = read;
+			if ( cache_ )
+			{
+				cache_->put( item.inode, content );
+			}
+		}
+
+		info.file_name = item.file_path.filename().string();
+		info.disk_file_size = content->size();
+		info.content = content;
+
+		return true;
+	}
+
+	// a file past the mappings budget has no content, it is served from its descriptor
+	static file_content_info make_mapped_info( const file_entry& item )
+	{
+		file_content_info info = {
+			item.file_path.filename().string()
+			, item.mapping ? item.mapping->size() : item.disk_file_size
+			, item.mapping };
+
+		return info;
+	}
+
+	// called by the watcher with sorted names of changed files; entries of the names
+	// are dropped from a copy of the current table and those still there statx'ed again
+	void apply_changes( const std::vector< std::string >& names, bool rescan )
+	{
+		if ( rescan )
+		{
+			PERF_LOG_WARNING( "changes of " << file_dir_path_.string() << " are lost, indexing it again" );
+			attach();
+			return;
+		}
+
+		boost::lock_guard< boost::mutex > lock( writer_mutex_ );
+
+		const file_table& current = *files_.load();
+		file_table* const table = new file_table();
+		int dir_fd = -1;
+		size_t removed = 0;
+		size_t added = 0;
+		try
+		{
+			for ( size_t idx = 0; idx < current.size(); ++idx )
+			{
+				const file_entry& entry = current[ idx ];
+				if ( is_listed( names, entry.file_path.native() ) )
+				{
+					++removed;
+					if ( cache_ )
+					{
+						cache_->erase( entry.inode );
+					}
+					continue;
+				}
+
+				table->push_back( entry );
+			}
+
+			dir_fd = ::open( file_dir_path_.string().c_str(), O_RDONLY | O_DIRECTORY );
+			if ( dir_fd < 0 )
+			{
+				detail::throw_errno( "can not open directory " + file_dir_path_.string() );
+			}
+
+			for ( size_t idx = 0; idx < names.size(); ++idx )
+			{
+				file_entry entry;
+				if ( stat_file_entry( dir_fd, file_dir_path_, names[ idx ], max_mapped_files_, entry ) )
+				{
+					++added;
+					if ( cache_ )
+					{
+						cache_->erase( entry.inode );
+					}
+					table->push_back( entry );
+				}
+			}
+
+			::close( dir_fd );
+			dir_fd = -1;
+
+			table->index_names();
+		}
+		catch ( ... )
+		{
+			if ( dir_fd >= 0 )
+			{
+				::close( dir_fd );
+			}
+			delete table;
+			throw;
+		}
+
+		replace_table( table );
+
+		PERF_LOG_DEBUG( "changes applied to " << file_dir_path_.string() << ": " << removed <<
+			" entries dropped, " << added << " added, " << table->size() << " files served" );
+	}
+
+	// by the writer; a reader sees the replaced table or the new one, never a part of
+	// either, and the replaced one is freed when the readers have left it
+	void replace_table( file_table* table )
+	{
+		table->publish();
+		file_table* const replaced = files_.exchange( table );
+		rcu_.synchronize();
+		delete replaced;
+	}
+
+	static bool is_listed( const std::vector< std::string >& names, const std::string& path )
+	{
+		const char* name = 0;
+		size_t name_length = 0;
+		get_file_name( path, name, name_length );
+
+		size_t first = 0;
+		size_t count = names.size();
+		while ( count )
+		{
+			const size_t step = count / 2;
+			if ( names[ first + step ].compare( 0, std::string::npos, name, name_length ) < 0 )
+			{
+				first += step + 1;
+				count -= step + 1;
+			}
+			else
+			{
+				count = step;
+			}
+		}
+
+		return first < names.size() && !names[ first ].compare( 0, std::string::npos, name, name_length );
+	}
+
+	// under a read guard as pick_file; null when the name is not served or the
+	// index is still being built
+	const file_entry* find_file( const std::string& name ) const
+	{
+		const file_table* const files = files_.load();
+
+		return files ? files->find( name ) : 0;
+	}
+
+	// under a read guard, the entry stays valid until the guard is left; null when
+	// no file is served, as the watcher may have removed them all
+	const file_entry* pick_file() const
 	{
 		static boost::thread_specific_ptr< boost::random::mt19937 > rng;
 
@@ -101,14 +566,39 @@ private:
 			rng.reset( new boost::random::mt19937 );
 		}
 
-		return (*dist_)( *rng );
+		// seq_cst load, ordered after the epoch stored by the guard
+		const file_table* const files = files_.load();
+
+		// index may be growing, files published so far are picked from
+		const size_t files_count = files ? files->size() : 0;
+		if ( !files_count )
+		{
+			return 0;
+		}
+
+		boost::random::uniform_int_distribution< size_t > dist( 0, files_count - 1 );
+
+		return &( *files )[ dist( *rng ) ];
 	}
 
 private:
 
 	const boost::filesystem::path file_dir_path_;
-	std::vector< detail::file_entry > files_;
-	boost::scoped_ptr< boost::random::uniform_int_distribution<> > dist_;
+	boost::atomic< file_table* > files_;
+	rcu_domain rcu_;
+	// serializes attach and apply_changes, readers do not take it
+	boost::mutex writer_mutex_;
+	boost::scoped_ptr< file_cache > cache_;
+	size_t max_mapped_files_;
+	bool watching_enabled_;
+	std::string index_path_;
+	size_t scan_threads_;
+	scan_stats scan_stats_;
+	mutable boost::mutex state_mutex_;
+	mutable boost::condition_variable state_changed_;
+	bool attaching_;
+	boost::scoped_ptr< boost::thread > attach_thread_;
+	boost::scoped_ptr< directory_watcher > watcher_;
 };
 
 }
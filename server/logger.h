@@ -0,0 +1,528 @@
+#ifndef SERVER_LOGGER_H_
+#define SERVER_LOGGER_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/chrono/include.hpp>
+
+namespace perf
+{
+
+enum log_level
+{
+	debug_log_level
+	, info_log_level
+	, warning_log_level
+	, error_log_level
+	// nothing is logged
+	, none_log_level
+};
+
+inline log_level log_level_from_string( const std::string& level )
+{
+	if ( level == "debug" )
+	{
+		return debug_log_level;
+	}
+	else if ( level == "info" )
+	{
+		return info_log_level;
+	}
+	else if ( level == "warning" )
+	{
+		return warning_log_level;
+	}
+	else if ( level == "error" )
+	{
+		return error_log_level;
+	}
+	else if ( level == "none" )
+	{
+		return none_log_level;
+	}
+
+	throw std::invalid_argument( "unknown log level: " + level );
+}
+
+inline const char* log_level_name( log_level level )
+{
+	static const char* const names[] = { "debug", "info", "warning", "error", "none" };
+
+	return names[ level ];
+}
+
+// message formatted in place, longer text is cut off
+class log_record
+{
+public:
+
+	enum { max_text_length = 240 };
+
+	explicit log_record( log_level level = info_log_level )
+		: level_( level )
+		, time_( boost::chrono::steady_clock::now() )
+		, length_( 0 )
+	{
+		text_[ 0 ] = 0;
+	}
+
+	log_level get_level() const
+	{
+		return level_;
+	}
+
+	const boost::chrono::steady_clock::time_point& get_time() const
+	{
+		return time_;
+	}
+
+	const char* get_text() const
+	{
+		return text_;
+	}
+
+	log_record& operator<<( const char* text )
+	{
+		append( text, strlen( text ) );
+		return *this;
+	}
+
+	log_record& operator<<( const std::string& text )
+	{
+		append( text.data(), text.length() );
+		return *this;
+	}
+
+	log_record& operator<<( char value )
+	{
+		append( &value, 1 );
+		return *this;
+	}
+
+	log_record& operator<<( int value )
+	{
+		return format( "%d", value );
+	}
+
+	log_record& operator<<( unsigned int value )
+	{
+		return format( "%u", value );
+	}
+
+	log_record& operator<<( long value )
+	{
+		return format( "%ld", value );
+	}
+
+	log_record& operator<<( unsigned long value )
+	{
+		return format( "%lu", value );
+	}
+
+	log_record& operator<<( long long value )
+	{
+		return format( "%lld", value );
+	}
+
+	log_record& operator<<( unsigned long long value )
+	{
+		return format( "%llu", value );
+	}
+
+	log_record& operator<<( double value )
+	{
+		return format( "%g", value );
+	}
+
+private:
+
+	void append( const char* text, size_t length )
+	{
+		length = std::min< size_t >( length, max_text_length - length_ );
+		memcpy( text_ + length_, text, length );
+		length_ += length;
+		text_[ length_ ] = 0;
+	}
+
+	template< class T >
+	log_record& format( const char* spec, T value )
+	{
+		const int written = snprintf( text_ + length_, max_text_length + 1 - length_, spec, value );
+		if ( written > 0 )
+		{
+			length_ = std::min< size_t >( length_ + written, max_text_length );
+		}
+
+		return *this;
+	}
+
+private:
+	log_level level_;
+	boost::chrono::steady_clock::time_point time_;
+	size_t length_;
+	char text_[ max_text_length + 1 ];
+};
+
+namespace detail
+{
+
+// single producer single consumer ring of records: the owning thread pushes, the
+// flusher pops, head and tail are the only shared state. A ring released by its
+// exiting thread is taken by a new one, records left in it are still flushed
+class log_ring
+	: private boost::noncopyable
+{
+public:
+
+	enum { capacity = 256 };
+
+	log_ring()
+		: head_( 0 )
+		, tail_( 0 )
+		, dropped_( 0 )
+		, window_start_()
+		, window_count_( 0 )
+		, owned_( true )
+	{
+	}
+
+	// the owner's writes before release are seen by the thread acquiring it next
+	bool try_acquire()
+	{
+		bool owned = false;
+		if ( !owned_.compare_exchange_strong( owned, true, boost::memory_order_acquire ) )
+		{
+			return false;
+		}
+
+		window_start_ = boost::chrono::steady_clock::time_point();
+		window_count_ = 0;
+
+		return true;
+	}
+
+	void release()
+	{
+		owned_.store( false, boost::memory_order_release );
+	}
+
+	// false when the ring is full or the thread is over its rate
+	bool push( const log_record& record, size_t max_rate )
+	{
+		// records per second of wall clock, the excess is counted and dropped
+		if ( record.get_time() - window_start_ >= boost::chrono::seconds( 1 ) )
+		{
+			window_start_ = record.get_time();
+			window_count_ = 0;
+		}
+
+		const size_t tail = tail_.load( boost::memory_order_relaxed );
+		if ( ( max_rate && window_count_ >= max_rate )
+			|| tail - head_.load( boost::memory_order_acquire ) == capacity )
+		{
+			dropped_.store( dropped_.load( boost::memory_order_relaxed ) + 1, boost::memory_order_relaxed );
+			return false;
+		}
+
+		records_[ tail % capacity ] = record;
+		tail_.store( tail + 1, boost::memory_order_release );
+		++window_count_;
+
+		return true;
+	}
+
+	bool pop( log_record& record )
+	{
+		const size_t head = head_.load( boost::memory_order_relaxed );
+		if ( head == tail_.load( boost::memory_order_acquire ) )
+		{
+			return false;
+		}
+
+		record = records_[ head % capacity ];
+		head_.store( head + 1, boost::memory_order_release );
+
+		return true;
+	}
+
+	boost::uint64_t get_dropped() const
+	{
+		return dropped_.load( boost::memory_order_relaxed );
+	}
+
+private:
+	log_record records_[ capacity ];
+	boost::atomic< size_t > head_;
+	boost::atomic< size_t > tail_;
+	boost::atomic< boost::uint64_t > dropped_;
+	// touched by the owning thread only
+	boost::chrono::steady_clock::time_point window_start_;
+	size_t window_count_;
+	boost::atomic< bool > owned_;
+};
+
+}
+
+// logging threads put records into rings of their own and go on, a background thread
+// writes them out in batches with one flush per batch; a thread which logs faster than
+// max_rate records a second or fills its ring loses the excess, the loss is reported
+class logger
+	: private boost::noncopyable
+{
+public:
+
+	enum { flush_interval_ms = 20, default_max_rate = 1000 };
+
+	explicit logger( std::ostream& out = std::cout )
+		: out_( out )
+		, level_( info_log_level )
+		, max_rate_( default_max_rate )
+		, id_( next_id() )
+		, start_( boost::chrono::steady_clock::now() )
+		, stopping_( false )
+		, slot_( &logger::release_slot )
+		, reported_dropped_( 0 )
+	{
+	}
+
+	~logger()
+	{
+		stop();
+	}
+
+	void set_level( log_level level )
+	{
+		level_.store( level, boost::memory_order_relaxed );
+	}
+
+	log_level get_level() const
+	{
+		return log_level( level_.load( boost::memory_order_relaxed ) );
+	}
+
+	// 0 is no limit
+	void set_max_rate( size_t records_per_second )
+	{
+		max_rate_.store( records_per_second, boost::memory_order_relaxed );
+	}
+
+	bool is_enabled( log_level level ) const
+	{
+		return level >= get_level() && level != none_log_level;
+	}
+
+	// records written before start wait in the rings, as many as fit
+	void start()
+	{
+		boost::lock_guard< boost::mutex > lock( flusher_mutex_ );
+
+		if ( !flusher_ )
+		{
+			stopping_.store( false );
+			flusher_.reset( new boost::thread( boost::bind( &logger::run_flusher, this ) ) );
+		}
+	}
+
+	// writes out what is left
+	void stop()
+	{
+		boost::lock_guard< boost::mutex > lock( flusher_mutex_ );
+
+		if ( flusher_ )
+		{
+			stopping_.store( true );
+			flusher_->join();
+			flusher_.reset();
+		}
+	}
+
+	void write( const log_record& record )
+	{
+		local_ring().push( record, max_rate_.load( boost::memory_order_relaxed ) );
+	}
+
+	// writes out all rings, called by the flusher
+	void flush()
+	{
+		boost::lock_guard< boost::mutex > lock( rings_mutex_ );
+
+		bool written = false;
+		boost::uint64_t dropped = 0;
+		log_record record;
+		for ( size_t idx = 0; idx < rings_.size(); ++idx )
+		{
+			while ( rings_[ idx ]->pop( record ) )
+			{
+				write_record( record );
+				written = true;
+			}
+
+			dropped += rings_[ idx ]->get_dropped();
+		}
+
+		if ( dropped != reported_dropped_ )
+		{
+			out_ << "warning: " << dropped - reported_dropped_ << " log records dropped\n";
+			reported_dropped_ = dropped;
+			written = true;
+		}
+
+		if ( written )
+		{
+			out_.flush();
+		}
+	}
+
+	// rings of the threads which have logged, those of exited threads are reused
+	size_t get_rings_count() const
+	{
+		boost::lock_guard< boost::mutex > lock( rings_mutex_ );
+
+		return rings_.size();
+	}
+
+private:
+
+	typedef boost::shared_ptr< detail::log_ring > ring_ptr;
+
+	// the slot shares its ring, the logger may be gone when the thread exits
+	struct thread_slot
+	{
+		boost::uint64_t owner_id;
+		ring_ptr ring;
+	};
+
+	static void release_slot( thread_slot* slot )
+	{
+		slot->ring->release();
+		delete slot;
+	}
+
+	static boost::uint64_t next_id()
+	{
+		static boost::atomic< boost::uint64_t > id( 0 );
+
+		return ++id;
+	}
+
+	detail::log_ring& local_ring()
+	{
+		thread_slot* slot = slot_.get();
+		if ( !slot || slot->owner_id != id_ )
+		{
+			boost::lock_guard< boost::mutex > lock( rings_mutex_ );
+
+			slot = new thread_slot;
+			slot->owner_id = id_;
+			for ( size_t idx = 0; idx < rings_.size() && !slot->ring; ++idx )
+			{
+				if ( rings_[ idx ]->try_acquire() )
+				{
+					slot->ring = rings_[ idx ];
+				}
+			}
+
+			if ( !slot->ring )
+			{
+				slot->ring.reset( new detail::log_ring() );
+				rings_.push_back( slot->ring );
+			}
+			slot_.reset( slot );
+		}
+
+		return *slot->ring;
+	}
+
+	void write_record( const log_record& record )
+	{
+		const boost::chrono::duration< double > since_start = record.get_time() - start_;
+
+		char prefix[ 32 ];
+		snprintf( prefix, sizeof( prefix ), "[%.6f] ", since_start.count() );
+
+		out_ << prefix;
+		if ( record.get_level() != info_log_level )
+		{
+			out_ << log_level_name( record.get_level() ) << ": ";
+		}
+		out_ << record.get_text() << '\n';
+	}
+
+	void run_flusher()
+	{
+		while ( !stopping_.load() )
+		{
+			flush();
+			boost::this_thread::sleep_for( boost::chrono::milliseconds( flush_interval_ms ) );
+		}
+
+		flush();
+	}
+
+private:
+	std::ostream& out_;
+	boost::atomic< int > level_;
+	boost::atomic< size_t > max_rate_;
+	const boost::uint64_t id_;
+	const boost::chrono::steady_clock::time_point start_;
+	boost::atomic< bool > stopping_;
+	boost::mutex flusher_mutex_;
+	boost::scoped_ptr< boost::thread > flusher_;
+	boost::thread_specific_ptr< thread_slot > slot_;
+	mutable boost::mutex rings_mutex_;
+	std::vector< ring_ptr > rings_;
+	// touched by flush under rings_mutex_
+	boost::uint64_t reported_dropped_;
+};
+
+// logger of the process, its level and rate are set from the server options
+inline logger& get_logger()
+{
+	static logger instance;
+
+	return instance;
+}
+
+}
+
+// message is a chain of operator<< applied to a log_record and is not evaluated
+// when the level is off
+#define PERF_LOG( level, message ) \
+	do \
+	{ \
+		if ( perf::get_logger().is_enabled( level ) ) \
+		{ \
+			perf::log_record perf_log_record( level ); \
+			perf_log_record << message; \
+			perf::get_logger().write( perf_log_record ); \
+		} \
+	} \
+	while ( false )
+
+// building with -DPERF_NO_DEBUG_LOG removes debug records from the code
+#if defined( PERF_NO_DEBUG_LOG )
+#define PERF_LOG_DEBUG( message ) do {} while ( false )
+#else
+#define PERF_LOG_DEBUG( message ) PERF_LOG( perf::debug_log_level, message )
+#endif
+
+#define PERF_LOG_INFO( message ) PERF_LOG( perf::info_log_level, message )
+#define PERF_LOG_WARNING( message ) PERF_LOG( perf::warning_log_level, message )
+#define PERF_LOG_ERROR( message ) PERF_LOG( perf::error_log_level, message )
+
+#endif // SERVER_LOGGER_H_
@@ -3,24 +3,56 @@
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "server_program_options.h"
 #include "common_file_logic.h"
 #include "file_logic.h"
 #include "server.h"
+#include "uring_server.h"
+
+namespace
+{
+
+// either engine, the latency histogram is saved when asked for
+template< class server_type >
+void run_server( server_type& server, const perf::server_program_options& options )
+{
+	server.run();
+
+	if ( !options.get_latency_csv().empty() )
+	{
+		perf::save_latency_csv( server.get_latency().get_merged(), options.get_latency_csv() );
+	}
+}
+
+}
 
 int main( int argc, char* argv[] )
 try
 {
 	perf::server_program_options options( argc, argv );
 
+	perf::get_logger().set_level( options.get_log_level() );
+	perf::get_logger().start();
+
 	boost::asio::ip::tcp::endpoint endpoint(
 		options.get_ip_appdress()
 		, options.get_port() );
 
 	const boost::filesystem::path file_working_dir( "/home/zaytcevandrey/perf-server-test-dir" );
-	perf::filelogic::raii_directory_holder<> holdfer( file_working_dir );
+	// kept files stay for the next run, which finds them in the saved index
+	boost::scoped_ptr< perf::filelogic::raii_directory_holder<> > holdfer;
+	if ( options.is_keep_files() )
+	{
+		boost::filesystem::create_directories( file_working_dir );
+	}
+	else
+	{
+		holdfer.reset( new perf::filelogic::raii_directory_holder<>( file_working_dir ) );
+	}
 
+	if ( !options.is_keep_files() || boost::filesystem::is_empty( file_working_dir ) )
 	{
 		const size_t file_size = options.get_file_size();
 		const size_t file_count = options.get_files_count();
@@ -32,8 +64,37 @@ try
 	}
 
 	const size_t threads_count = options.get_threads_count();
-	perf::server server( endpoint, file_working_dir, threads_count );
-	server.run();
+	if ( options.get_engine() == perf::uring_server_engine )
+	{
+		perf::uring_server server(
+			endpoint
+			, file_working_dir
+			, threads_count
+			, options.get_reply_mode()
+			, options.get_cache_settings()
+			, options.get_index_file()
+			, options.is_watch_files()
+			, options.get_socket_settings() );
+		run_server( server, options );
+	}
+	else
+	{
+		perf::server server(
+			endpoint
+			, file_working_dir
+			, threads_count
+			, options.get_reply_mode()
+			, options.get_cache_settings()
+			, options.is_sharded()
+			, options.get_connection_pool_size()
+			, options.get_stats_port()
+			, options.get_index_file()
+			, options.is_watch_files()
+			, options.get_socket_settings() );
+		run_server( server, options );
+	}
+
+	perf::get_logger().stop();
 
 	return 0;
 }
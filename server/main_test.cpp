@@ -3,10 +3,22 @@
 #include "common_file_logic.h"
 #include "file_logic.h"
 #include "file_provider.h"
+#include "file_cache.h"
 #include "request_handler.h"
+#include "connection.h"
+#include "connection_pool.h"
+#include "buffer_slab.h"
+#include "sendfile.h"
+#include "uring.h"
+#include "latency_histogram.h"
+#include "server_stats.h"
+#include "stats_endpoint.h"
+#include "logger.h"
+#include "rcu.h"
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <exception>
 #include <vector>
 #include <assert.h>
@@ -16,6 +28,33 @@
 #include <gtest/gtest.h>
 
 #include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lexical_cast.hpp>
+
+// every heap allocation of the test process is counted while count_allocations is set
+boost::atomic< bool > count_allocations( false );
+boost::atomic< size_t > allocations_count( 0 );
+
+void* operator new( size_t size )
+{
+	if ( count_allocations.load( boost::memory_order_relaxed ) )
+	{
+		allocations_count.fetch_add( 1, boost::memory_order_relaxed );
+	}
+
+	void* pointer = malloc( size ? size : 1 );
+	if ( !pointer )
+	{
+		throw std::bad_alloc();
+	}
+
+	return pointer;
+}
+
+void operator delete( void* pointer ) throw()
+{
+	free( pointer );
+}
 
 int main( int argc, char* argv[] )
 {
@@ -67,6 +106,21 @@ TEST( varrec_header, deserialize_wrong_data )
 	EXPECT_FALSE( bool( res ) );
 }
 
+TEST( varrec_header, deserialize_length_with_trailing_characters )
+{
+	using namespace perf::protocol;
+
+	const char* const fields[] = { "MSGN 12x", "MSGN1 2 ", "MSGN  1-", "MSGN12  " };
+	for ( size_t idx = 0; idx < sizeof( fields ) / sizeof( fields[ 0 ] ); ++idx )
+	{
+		variable_record_header header( 8192 );
+		const boost::tribool res = header.deserialize( fields[ idx ], strlen( fields[ idx ] ) );
+
+		EXPECT_FALSE( bool( res ) ) << fields[ idx ];
+		EXPECT_FALSE( boost::indeterminate( res ) ) << fields[ idx ];
+	}
+}
+
 TEST( varrec_header, serialize_to_buffer )
 {
 	using namespace perf::protocol;
@@ -97,6 +151,48 @@ TEST( varrec_header, serialize_to_vector )
 	EXPECT_EQ( res, ref );
 }
 
+TEST( varrec_header, binary_serialize_deserialize )
+{
+	using namespace perf::protocol;
+
+	variable_record_header writer( 8192, binary_header_format );
+	const std::vector< char > buff = writer.serialize( 4097 );
+
+	ASSERT_EQ( buff.size(), variable_record_header::full_length );
+	EXPECT_EQ( buff[ 0 ], 'P' );
+	EXPECT_EQ( buff[ 1 ], 'F' );
+
+	// reader starts as ascii and takes the format from the data
+	variable_record_header reader( 8192 );
+	const boost::tribool res = reader.deserialize( &buff[ 0 ], buff.size() );
+
+	EXPECT_TRUE( bool( res == true ) );
+	EXPECT_EQ( reader.get_body_length(), 4097u );
+	EXPECT_EQ( reader.get_format(), binary_header_format );
+
+	const std::string ascii( "MSGN  12" );
+	EXPECT_TRUE( bool( reader.deserialize( ascii.data(), ascii.size() ) == true ) );
+	EXPECT_EQ( reader.get_body_length(), 12u );
+	EXPECT_EQ( reader.get_format(), ascii_header_format );
+}
+
+TEST( varrec_header, binary_deserialize_wrong_data )
+{
+	using namespace perf::protocol;
+
+	variable_record_header writer( 16384, binary_header_format );
+	std::vector< char > buff = writer.serialize( 9000 );
+
+	// longer than the reader allows
+	variable_record_header reader( 8192 );
+	EXPECT_FALSE( bool( reader.deserialize( &buff[ 0 ], buff.size() ) ) );
+
+	// unknown version
+	buff = writer.serialize( 10 );
+	buff[ 2 ] = 2;
+	EXPECT_FALSE( bool( reader.deserialize( &buff[ 0 ], buff.size() ) ) );
+}
+
 // variable_record tests
 
 TEST( varrec, deserialize_request )
@@ -142,6 +238,65 @@ TEST( varrec, serialize_request )
 	EXPECT_STREQ( var_rec.get_body_buff(), "GET" );
 }
 
+TEST( varrec, serialize_deserialize_named_request )
+{
+	using namespace perf::protocol;
+
+	request req;
+	req.method = "GET";
+	req.file_name = "some_file_name";
+
+	variable_record var_rec;
+	var_rec.serialize_data( req );
+	ASSERT_TRUE( var_rec.deserialize_header() );
+	EXPECT_EQ( var_rec.get_body_length(), 18u );
+
+	request parsed;
+	parsed.file_name = "left from a previous request";
+	EXPECT_TRUE( var_rec.deserialize_body( parsed ) );
+	EXPECT_EQ( parsed.method, "GET" );
+	EXPECT_EQ( parsed.file_name, "some_file_name" );
+
+	req.file_name.clear();
+	var_rec.serialize_data( req );
+	ASSERT_TRUE( var_rec.deserialize_header() );
+	EXPECT_TRUE( var_rec.deserialize_body( parsed ) );
+	EXPECT_EQ( parsed.method, "GET" );
+	EXPECT_TRUE( parsed.file_name.empty() );
+}
+
+TEST( varrec, serialize_deserialize_ranged_request )
+{
+	using namespace perf::protocol;
+
+	request req( "GET" );
+	req.file_name = "some_file_name";
+	req.offset = 5ull * 1024 * 1024 * 1024;
+	req.length = 4096;
+
+	variable_record var_rec;
+	var_rec.serialize_data( req );
+	ASSERT_TRUE( var_rec.deserialize_header() );
+	EXPECT_EQ( std::string( var_rec.get_body_buff(), var_rec.get_body_length() )
+		, "GET range=5368709120,4096 some_file_name" );
+
+	request parsed;
+	EXPECT_TRUE( var_rec.deserialize_body( parsed ) );
+	EXPECT_EQ( parsed.method, "GET" );
+	EXPECT_EQ( parsed.file_name, "some_file_name" );
+	EXPECT_EQ( parsed.offset, req.offset );
+	EXPECT_EQ( parsed.length, req.length );
+
+	// range alone asks for a part of a file picked at random
+	EXPECT_TRUE( deserialize( parsed, "GET range=10,0", 14 ) );
+	EXPECT_TRUE( parsed.file_name.empty() );
+	EXPECT_EQ( parsed.offset, 10u );
+
+	EXPECT_FALSE( deserialize( parsed, "GET range=10 name", 17 ) );
+	EXPECT_FALSE( deserialize( parsed, "GET range=,5 name", 17 ) );
+	EXPECT_FALSE( deserialize( parsed, "GET range=99999999999999999999,1 name", 37 ) );
+}
+
 TEST( varrec, serialize_request_to_asio_buffer )
 {
 	using namespace perf::protocol;
@@ -190,6 +345,23 @@ TEST( varrec, serialize_deserialize_reply_header )
 	EXPECT_STREQ( rep_dst.file_name.c_str(), rep_header.file_name.c_str() );
 }
 
+TEST( varrec, serialize_deserialize_large_file_size )
+{
+	using namespace perf::protocol;
+
+	// does not fit into 32 bits
+	const reply_header rep_header = { 5ull * 1024 * 1024 * 1024 + 7, "large_file" };
+
+	variable_record var_rec;
+	const size_t data_len = var_rec.serialize_data( rep_header );
+	EXPECT_EQ( data_len, variable_record::header_length + 24 + rep_header.file_name.length() );
+
+	reply_header rep_dst;
+	EXPECT_TRUE( deserialize( rep_dst, var_rec.get_body_buff(), data_len - variable_record::header_length ) );
+	EXPECT_EQ( rep_dst.file_size, rep_header.file_size );
+	EXPECT_STREQ( rep_dst.file_name.c_str(), rep_header.file_name.c_str() );
+}
+
 class filelogic_test : public ::testing::Test
 {
 public:
@@ -360,6 +532,219 @@ TEST_F( filelogic_test, file_provider_test )
 	EXPECT_FALSE( file_data.empty() );
 }
 
+TEST_F( filelogic_test, file_provider_saved_index )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 1024, 300 );
+
+	fs::path index_path( fs::current_path() );
+	index_path /= "test_directory.index";
+	fs::remove( index_path );
+
+	// every file is stated and the index is saved
+	{
+		file_provider provider( test_directory_ );
+		provider.enable_index( index_path.string() );
+		provider.set_scan_threads( 4 );
+		provider.attach();
+		EXPECT_EQ( provider.get_files_count(), 300u );
+		EXPECT_EQ( provider.get_scan_stats().stated, 300u );
+		EXPECT_TRUE( fs::exists( index_path ) );
+	}
+
+	// unchanged directory is not even listed, its files are still stated
+	{
+		file_provider provider( test_directory_ );
+		provider.enable_index( index_path.string() );
+		provider.attach();
+		EXPECT_EQ( provider.get_files_count(), 300u );
+		EXPECT_TRUE( provider.get_scan_stats().from_index );
+		EXPECT_EQ( provider.get_scan_stats().stated, 300u );
+		EXPECT_EQ( provider.get_scan_stats().reused, 300u );
+
+		const file_descriptor_info info = provider.get_file_descriptor();
+		fs::path file( test_directory_ );
+		file /= info.file_name;
+		EXPECT_EQ( info.disk_file_size, fs::file_size( file ) );
+	}
+
+	// a file appended to in place leaves the directory mtime, its size is taken anew
+	const fs::path appended = fs::directory_iterator( test_directory_ )->path();
+	const size_t appended_size = fs::file_size( appended ) + 100;
+	{
+		std::ofstream out( appended.string().c_str(), std::ios::binary | std::ios::app );
+		out << std::string( 100, 'x' );
+	}
+	{
+		file_provider provider( test_directory_ );
+		provider.enable_index( index_path.string() );
+		provider.attach();
+		EXPECT_TRUE( provider.get_scan_stats().from_index );
+		EXPECT_EQ( provider.get_scan_stats().reused, 299u );
+
+		file_descriptor_info info;
+		ASSERT_TRUE( provider.get_file_descriptor( appended.filename().string(), info ) );
+		EXPECT_EQ( info.disk_file_size, appended_size );
+	}
+
+	// the index saved with the appended file has it as it is now
+	file_gen.generate_files( "other string", 2048, 1 );
+	{
+		file_provider provider( test_directory_ );
+		provider.enable_index( index_path.string() );
+		provider.attach();
+		EXPECT_EQ( provider.get_files_count(), 301u );
+		EXPECT_FALSE( provider.get_scan_stats().from_index );
+		EXPECT_EQ( provider.get_scan_stats().stated, 301u );
+		EXPECT_EQ( provider.get_scan_stats().reused, 300u );
+	}
+
+	fs::remove( index_path );
+}
+
+TEST_F( filelogic_test, file_provider_serves_while_attaching )
+{
+	using namespace perf::filelogic;
+
+	const size_t file_count = directory_scanner::batch_size * 3;
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 16, file_count );
+
+	file_provider provider( test_directory_ );
+	provider.set_scan_threads( 2 );
+	provider.start_attach();
+
+	provider.wait_until_serving();
+	EXPECT_GT( provider.get_files_count(), 0u );
+	EXPECT_FALSE( provider.get_file_descriptor().file_name.empty() );
+
+	provider.wait_until_attached();
+	EXPECT_EQ( provider.get_files_count(), file_count );
+}
+
+namespace
+{
+
+// waits up to a few seconds for the watcher to apply the changes
+bool wait_for_files_count( const perf::filelogic::file_provider& provider, size_t files_count )
+{
+	for ( int attempt = 0; attempt < 300 && provider.get_files_count() != files_count; ++attempt )
+	{
+		boost::this_thread::sleep_for( boost::chrono::milliseconds( 10 ) );
+	}
+
+	return provider.get_files_count() == files_count;
+}
+
+void write_test_file( const boost::filesystem::path& path, size_t size )
+{
+	std::ofstream file( path.string().c_str() );
+	file << std::string( size, 'x' );
+}
+
+}
+
+TEST( file_name_index_test, finds_inserted_names )
+{
+	using perf::filelogic::file_name_index;
+
+	const size_t names_count = 1000;
+	file_name_index index( names_count );
+	for ( size_t idx = 0; idx < names_count; ++idx )
+	{
+		const std::string name = "file_" + boost::lexical_cast< std::string >( idx );
+		index.insert( name.data(), name.length(), idx );
+	}
+
+	// a name inserted again keeps its first entry
+	index.insert( "file_7", 6, 12345 );
+	EXPECT_EQ( index.size(), names_count );
+
+	for ( size_t idx = 0; idx < names_count; ++idx )
+	{
+		const std::string name = "file_" + boost::lexical_cast< std::string >( idx );
+		EXPECT_EQ( index.find( name.data(), name.length() ), idx );
+	}
+
+	EXPECT_TRUE( index.find( "file_", 5 ) == file_name_index::npos );
+	EXPECT_TRUE( index.find( "file_1000", 9 ) == file_name_index::npos );
+}
+
+TEST_F( filelogic_test, file_provider_finds_files_by_name )
+{
+	using namespace perf::filelogic;
+	namespace fs = boost::filesystem;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 16, 10 );
+
+	file_provider provider( test_directory_ );
+	provider.attach();
+
+	for ( fs::directory_iterator it( test_directory_ ); it != fs::directory_iterator(); ++it )
+	{
+		file_descriptor_info info;
+		ASSERT_TRUE( provider.get_file_descriptor( it->path().filename().string(), info ) );
+		EXPECT_EQ( info.file_name, it->path().filename().string() );
+		EXPECT_EQ( info.disk_file_size, fs::file_size( it->path() ) );
+	}
+
+	file_descriptor_info info;
+	EXPECT_FALSE( provider.get_file_descriptor( "missing_file", info ) );
+}
+
+TEST_F( filelogic_test, file_provider_applies_watched_changes )
+{
+	using namespace perf::filelogic;
+	namespace fs = boost::filesystem;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 16, 3 );
+
+	std::vector< fs::path > generated;
+	for ( fs::directory_iterator it( test_directory_ ); it != fs::directory_iterator(); ++it )
+	{
+		generated.push_back( it->path() );
+	}
+	ASSERT_EQ( generated.size(), 3u );
+
+	file_provider provider( test_directory_ );
+	provider.enable_watching();
+	provider.attach();
+	ASSERT_EQ( provider.get_files_count(), 3u );
+
+	write_test_file( fs::path( test_directory_ ) / "added_file", 100 );
+	EXPECT_TRUE( wait_for_files_count( provider, 4 ) );
+
+	// the new table has its names indexed
+	file_descriptor_info added;
+	EXPECT_TRUE( provider.get_file_descriptor( "added_file", added ) );
+	EXPECT_EQ( added.disk_file_size, 100u );
+
+	fs::remove( generated[ 0 ] );
+	fs::remove( generated[ 1 ] );
+	EXPECT_TRUE( wait_for_files_count( provider, 2 ) );
+
+	// the remaining generated file is resized, every file served is 100 bytes then
+	write_test_file( generated[ 2 ], 100 );
+	bool resized = false;
+	for ( int attempt = 0; attempt < 300 && !resized; ++attempt )
+	{
+		boost::this_thread::sleep_for( boost::chrono::milliseconds( 10 ) );
+
+		resized = true;
+		for ( int idx = 0; idx < 32; ++idx )
+		{
+			resized = resized && provider.get_file_descriptor().disk_file_size == 100;
+		}
+	}
+	EXPECT_TRUE( resized );
+	EXPECT_EQ( provider.get_files_count(), 2u );
+}
+
 class fake_file_provider
 {
 public:
@@ -410,6 +795,47 @@ public:
 		return info;
 	}
 
+	bool get_file( const std::string& name, perf::filelogic::file_stream_info& info ) const
+	{
+		if ( name != file_name_ )
+		{
+			return false;
+		}
+
+		info = get_file();
+		return true;
+	}
+
+	perf::filelogic::file_descriptor_info get_file_descriptor() const
+	{
+		throw std::logic_error( "fake_file_provider has no file on disk" );
+	}
+
+	bool get_file_descriptor( const std::string&, perf::filelogic::file_descriptor_info& ) const
+	{
+		throw std::logic_error( "fake_file_provider has no file on disk" );
+	}
+
+	perf::filelogic::file_content_info get_file_content() const
+	{
+		throw std::logic_error( "fake_file_provider has no file on disk" );
+	}
+
+	bool get_file_content( const std::string&, perf::filelogic::file_content_info& ) const
+	{
+		throw std::logic_error( "fake_file_provider has no file on disk" );
+	}
+
+	perf::filelogic::file_content_info get_mapped_file() const
+	{
+		throw std::logic_error( "fake_file_provider has no file on disk" );
+	}
+
+	bool get_mapped_file( const std::string&, perf::filelogic::file_content_info& ) const
+	{
+		throw std::logic_error( "fake_file_provider has no file on disk" );
+	}
+
 	const std::vector< char >& get_file_data() const
 	{
 		return data_cache_;
@@ -451,6 +877,1561 @@ TEST( request_handler_test, make_reply )
 		, file_data.begin() ) );
 }
 
+TEST( reply_test, reset_keeps_capacity_within_window )
+{
+	using namespace perf::protocol;
+
+	reply rep;
+	rep.header.file_name = "some_file_name";
+	rep.header.file_size = 1024 * 1024;
+	rep.file_data.resize( 1024 * 1024 );
+	rep.chunked = true;
+
+	rep.reset();
+	EXPECT_TRUE( rep.header.file_name.empty() );
+	EXPECT_EQ( rep.header.file_size, 0u );
+	EXPECT_FALSE( rep.chunked );
+	EXPECT_TRUE( rep.file_data.empty() );
+	EXPECT_EQ( rep.file_data.capacity(), 1024u * 1024 );
+	EXPECT_EQ( rep.get_buffers().size(), 1u );
+
+	// a window of small bodies gives the big buffer back
+	for ( size_t idx = 0; idx < 2 * reply::shrink_window; ++idx )
+	{
+		rep.reset();
+		rep.file_data.resize( 100 );
+	}
+	EXPECT_EQ( rep.file_data.capacity(), size_t( reply::min_retained_capacity ) );
+}
+
+TEST( reply_test, steady_replies_do_not_reallocate )
+{
+	using namespace perf::protocol;
+
+	reply rep;
+	rep.file_data.resize( 200 * 1024 );
+	const char* data = &rep.file_data[ 0 ];
+
+	for ( size_t idx = 0; idx < 2 * reply::shrink_window; ++idx )
+	{
+		rep.reset();
+		rep.file_data.resize( idx % 2 ? 200 * 1024 : 150 * 1024 );
+		EXPECT_EQ( &rep.file_data[ 0 ], data );
+	}
+}
+
+TEST( request_handler_test, make_named_reply )
+{
+	using namespace perf::protocol;
+
+	const std::string file_name( "named_test_file" );
+	fake_file_provider provider( file_name, "test file string text", 16 );
+	request_handler< fake_file_provider > handler( provider );
+
+	request req;
+	req.method = "GET";
+	req.file_name = file_name;
+	reply rep;
+	handler.make_reply( req, rep );
+
+	EXPECT_EQ( rep.header.file_name, file_name );
+	EXPECT_EQ( rep.header.file_size, provider.get_file_data().size() );
+
+	// no such file, the reply is empty
+	req.file_name = "missing_file";
+	handler.make_reply( req, rep );
+
+	EXPECT_TRUE( rep.header.file_name.empty() );
+	EXPECT_EQ( rep.header.file_size, 0u );
+	EXPECT_TRUE( rep.file_data.empty() );
+}
+
+TEST_F( filelogic_test, request_handler_sendfile_reply )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 1024, 1 );
+
+	file_provider provider( test_directory_ );
+	provider.attach();
+
+	request_handler< file_provider > handler( provider, sendfile_reply_mode );
+
+	request req;
+	req.method = "GET";
+	reply rep;
+	handler.make_reply( req, rep );
+
+	fs::path file( provider.get_file_dir() );
+	file /= rep.header.file_name;
+	EXPECT_TRUE( rep.has_file_descriptor() );
+	EXPECT_TRUE( rep.file_data.empty() );
+	EXPECT_EQ( rep.header.file_size, fs::file_size( file ) );
+
+	// only the framed header goes through the buffers
+	EXPECT_EQ( rep.get_buffers().size(), 1 );
+}
+
+TEST_F( filelogic_test, request_handler_misses_removed_file )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 1024, 1 );
+
+	// not watched, the removed file stays in the index
+	file_provider provider( test_directory_ );
+	provider.enable_cache( cache_settings( 1024 * 1024 ) );
+	provider.attach();
+
+	const fs::directory_iterator it( test_directory_ );
+	const std::string file_name = it->path().filename().string();
+	fs::remove( it->path() );
+
+	EXPECT_FALSE( file_descriptor( it->path().string() ).is_open() );
+	EXPECT_FALSE( memory_file_content( it->path().string(), 1024 ).is_read() );
+
+	const reply_mode modes[] = { copy_reply_mode, sendfile_reply_mode, cache_reply_mode, chunked_reply_mode };
+	for ( size_t idx = 0; idx < sizeof( modes ) / sizeof( modes[ 0 ] ); ++idx )
+	{
+		request_handler< file_provider > handler( provider, modes[ idx ] );
+
+		request req;
+		req.method = "GET";
+		reply rep;
+		handler.make_reply( req, rep );
+
+		EXPECT_TRUE( rep.header.file_name.empty() );
+		EXPECT_EQ( rep.header.file_size, 0u );
+		EXPECT_FALSE( rep.has_file_descriptor() );
+		EXPECT_FALSE( rep.chunked );
+
+		req.file_name = file_name;
+		handler.make_reply( req, rep );
+
+		EXPECT_TRUE( rep.header.file_name.empty() );
+		EXPECT_EQ( rep.header.file_size, 0u );
+	}
+}
+
+class fake_file_content
+	: public perf::filelogic::file_content
+{
+public:
+
+	explicit fake_file_content( size_t size )
+		: data_( size, 'x' )
+	{
+	}
+
+	const char* data() const
+	{
+		return data_.data();
+	}
+
+	size_t size() const
+	{
+		return data_.size();
+	}
+
+private:
+
+	const std::string data_;
+};
+
+TEST_F( filelogic_test, request_handler_ranged_replies )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "0123456789", 10000, 1 );
+
+	file_provider provider( test_directory_ );
+	provider.enable_mapping();
+	provider.attach();
+
+	const fs::path file = fs::directory_iterator( test_directory_ )->path();
+	std::ifstream in( file.string().c_str(), std::ios::binary );
+	const std::vector< char > expected( ( std::istreambuf_iterator< char >( in ) ), std::istreambuf_iterator< char >() );
+
+	request req( "GET" );
+	req.file_name = file.filename().string();
+	req.offset = 1234;
+	req.length = 100;
+
+	// copy and mapping replies carry the range in their buffers
+	const reply_mode modes[] = { copy_reply_mode, mmap_reply_mode };
+	for ( size_t idx = 0; idx < sizeof( modes ) / sizeof( modes[ 0 ] ); ++idx )
+	{
+		request_handler< file_provider > handler( provider, modes[ idx ] );
+		reply rep;
+		handler.make_reply( req, rep );
+
+		EXPECT_EQ( rep.header.offset, 1234u );
+		EXPECT_EQ( rep.header.file_size, 100u );
+		EXPECT_EQ( rep.header.total_size, expected.size() );
+
+		const reply_buffers buffers = rep.get_buffers();
+		ASSERT_EQ( buffers.size(), 2u );
+		const char* body = boost::asio::buffer_cast< const char* >( buffers[ 1 ] );
+		ASSERT_EQ( boost::asio::buffer_size( buffers[ 1 ] ), 100u );
+		EXPECT_TRUE( std::equal( body, body + 100, expected.begin() + 1234 ) );
+	}
+
+	request_handler< file_provider > handler( provider, sendfile_reply_mode );
+	reply rep;
+
+	// cut to the end of the file
+	req.length = expected.size();
+	handler.make_reply( req, rep );
+	EXPECT_EQ( rep.header.offset, 1234u );
+	EXPECT_EQ( rep.header.file_size, expected.size() - 1234 );
+
+	// past the end, only the size of the file comes back
+	req.offset = expected.size() + 1;
+	handler.make_reply( req, rep );
+	EXPECT_EQ( rep.header.offset, expected.size() );
+	EXPECT_EQ( rep.header.file_size, 0u );
+	EXPECT_EQ( rep.header.total_size, expected.size() );
+}
+
+TEST( file_cache_test, lru_eviction )
+{
+	using namespace perf::filelogic;
+
+	file_cache cache( cache_settings( 300, lru_cache_policy ) );
+
+	const file_cache::content_ptr first( new fake_file_content( 100 ) );
+	EXPECT_TRUE( cache.put( 1, first ) );
+	EXPECT_TRUE( cache.put( 2, file_cache::content_ptr( new fake_file_content( 100 ) ) ) );
+	EXPECT_TRUE( cache.put( 3, file_cache::content_ptr( new fake_file_content( 100 ) ) ) );
+	EXPECT_EQ( cache.get_size(), 300 );
+
+	// touch the oldest entry so the second one becomes least recently used
+	EXPECT_EQ( cache.get( 1 ), first );
+	EXPECT_TRUE( cache.put( 4, file_cache::content_ptr( new fake_file_content( 100 ) ) ) );
+
+	EXPECT_TRUE( cache.get( 1 ) );
+	EXPECT_FALSE( cache.get( 2 ) );
+	EXPECT_TRUE( cache.get( 3 ) );
+	EXPECT_TRUE( cache.get( 4 ) );
+	EXPECT_EQ( cache.get_size(), 300 );
+	EXPECT_EQ( cache.get_hits(), 4 );
+	EXPECT_EQ( cache.get_misses(), 1 );
+
+	// larger than the whole budget
+	EXPECT_FALSE( cache.put( 5, file_cache::content_ptr( new fake_file_content( 301 ) ) ) );
+	EXPECT_EQ( cache.get_size(), 300 );
+}
+
+TEST( file_cache_test, fifo_eviction )
+{
+	using namespace perf::filelogic;
+
+	file_cache cache( cache_settings( 200, fifo_cache_policy ) );
+
+	EXPECT_TRUE( cache.put( 1, file_cache::content_ptr( new fake_file_content( 100 ) ) ) );
+	EXPECT_TRUE( cache.put( 2, file_cache::content_ptr( new fake_file_content( 100 ) ) ) );
+
+	EXPECT_TRUE( cache.get( 1 ) );
+	EXPECT_TRUE( cache.put( 3, file_cache::content_ptr( new fake_file_content( 150 ) ) ) );
+
+	EXPECT_FALSE( cache.get( 1 ) );
+	EXPECT_FALSE( cache.get( 2 ) );
+	EXPECT_TRUE( cache.get( 3 ) );
+	EXPECT_EQ( cache.get_size(), 150 );
+}
+
+TEST_F( filelogic_test, file_provider_cached_content )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 1024, 1 );
+
+	file_provider provider( test_directory_ );
+	provider.enable_cache( cache_settings( 1024 * 1024 ) );
+	provider.attach();
+
+	request_handler< file_provider > handler( provider, cache_reply_mode );
+
+	request req;
+	req.method = "GET";
+	reply first;
+	handler.make_reply( req, first );
+	reply second;
+	handler.make_reply( req, second );
+
+	// both replies point to the same cached bytes
+	EXPECT_TRUE( first.file_content );
+	EXPECT_EQ( first.file_content, second.file_content );
+	EXPECT_TRUE( first.file_data.empty() );
+	EXPECT_EQ( provider.get_cache()->get_hits(), 1 );
+	EXPECT_EQ( provider.get_cache()->get_misses(), 1 );
+
+	fs::path file( provider.get_file_dir() );
+	file /= first.header.file_name;
+	EXPECT_EQ( first.header.file_size, fs::file_size( file ) );
+	EXPECT_EQ( first.file_content->size(), fs::file_size( file ) );
+
+	std::ifstream stream( file.string().c_str() );
+	stream >> std::noskipws;
+	const std::vector< char > expected(
+		( std::istream_iterator< char >( stream ) )
+		, std::istream_iterator< char >() );
+	EXPECT_TRUE( std::equal( expected.begin(), expected.end(), first.file_content->data() ) );
+
+	EXPECT_EQ( first.get_buffers().size(), 2 );
+}
+
+TEST_F( filelogic_test, file_provider_mapped_file )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 1024, 4 );
+
+	file_provider provider( test_directory_ );
+	provider.enable_mapping();
+	provider.attach();
+
+	request_handler< file_provider > handler( provider, mmap_reply_mode );
+
+	request req;
+	req.method = "GET";
+	reply rep;
+	handler.make_reply( req, rep );
+
+	fs::path file( provider.get_file_dir() );
+	file /= rep.header.file_name;
+	EXPECT_TRUE( rep.file_content );
+	EXPECT_TRUE( rep.file_data.empty() );
+	EXPECT_EQ( rep.header.file_size, fs::file_size( file ) );
+
+	std::ifstream stream( file.string().c_str() );
+	stream >> std::noskipws;
+	const std::vector< char > expected(
+		( std::istream_iterator< char >( stream ) )
+		, std::istream_iterator< char >() );
+	EXPECT_EQ( rep.file_content->size(), expected.size() );
+	EXPECT_TRUE( std::equal( expected.begin(), expected.end(), rep.file_content->data() ) );
+
+	// body buffer points into the mapping
+	const reply_buffers buffers = rep.get_buffers();
+	EXPECT_EQ( buffers.size(), 2 );
+	EXPECT_EQ( boost::asio::buffer_cast< const char* >( buffers[ 1 ] ), rep.file_content->data() );
+}
+
+TEST_F( filelogic_test, file_provider_maps_files_within_budget )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 1024, 4 );
+
+	// one scanning thread does not go over the budget
+	file_provider provider( test_directory_ );
+	provider.enable_mapping( mapped_file_content::get_mapped_count() + 2 );
+	provider.set_scan_threads( 1 );
+	provider.attach();
+	ASSERT_EQ( provider.get_files_count(), 4u );
+
+	request_handler< file_provider > handler( provider, mmap_reply_mode );
+
+	// the files past the budget are still served, from their descriptors
+	size_t mapped = 0;
+	size_t unmapped = 0;
+	for ( fs::directory_iterator it( test_directory_ ); it != fs::directory_iterator(); ++it )
+	{
+		request req( "GET" );
+		req.file_name = it->path().filename().string();
+		reply rep;
+		handler.make_reply( req, rep );
+
+		EXPECT_EQ( rep.header.file_name, req.file_name );
+		EXPECT_EQ( rep.header.file_size, fs::file_size( it->path() ) );
+		mapped += rep.file_content ? 1 : 0;
+		unmapped += rep.has_file_descriptor() ? 1 : 0;
+	}
+
+	EXPECT_EQ( mapped, 2u );
+	EXPECT_EQ( unmapped, 2u );
+}
+
+TEST_F( filelogic_test, sendfile_some_to_socket )
+{
+	namespace fs = boost::filesystem;
+	using namespace perf::filelogic;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 4096, 1 );
+
+	file_provider provider( test_directory_ );
+	provider.attach();
+	file_descriptor_info info = provider.get_file_descriptor();
+
+	boost::asio::io_service io_service;
+	boost::asio::local::stream_protocol::socket src( io_service );
+	boost::asio::local::stream_protocol::socket dst( io_service );
+	boost::asio::local::connect_pair( src, dst );
+	src.native_non_blocking( true );
+
+	off_t offset = 0;
+	std::vector< char > received;
+	while ( size_t( offset ) < info.disk_file_size )
+	{
+		boost::system::error_code err;
+		perf::detail::sendfile_some(
+			src.native_handle()
+			, info.descriptor->get()
+			, offset
+			, info.disk_file_size - offset
+			, err );
+		EXPECT_TRUE( !err || err == boost::asio::error::would_block );
+
+		char buff[ 1024 ];
+		const size_t read = dst.read_some( boost::asio::buffer( buff ) );
+		received.insert( received.end(), buff, buff + read );
+	}
+
+	while ( received.size() < info.disk_file_size )
+	{
+		char buff[ 1024 ];
+		const size_t read = dst.read_some( boost::asio::buffer( buff ) );
+		received.insert( received.end(), buff, buff + read );
+	}
+
+	fs::path file( provider.get_file_dir() );
+	file /= info.file_name;
+	std::ifstream stream( file.string().c_str() );
+	stream >> std::noskipws;
+	std::vector< char > expected(
+		( std::istream_iterator< char >( stream ) )
+		, std::istream_iterator< char >() );
+
+	EXPECT_EQ( received.size(), expected.size() );
+	EXPECT_TRUE( received == expected );
+}
+
+class fake_observer
+{
+public:
+
+	fake_observer()
+		: connections_( 0 )
+		, sent_data_( 0 )
+		, latencies_count_( 0 )
+		, requests_count_( 0 )
+		, parse_errors_( 0 )
+		, file_opens_( 0 )
+		, dropped_replies_( 0 )
+		, reply_writes_( 0 )
+		, zerocopy_sends_( 0 )
+		, zerocopy_copied_( 0 )
+	{
+	}
+
+	void checkin()
+	{
+		++connections_;
+	}
+
+	void checkout()
+	{
+		--connections_;
+	}
+
+	void update_sent_data( size_t size )
+	{
+		sent_data_ += size;
+	}
+
+	void record_latency( const boost::chrono::nanoseconds& )
+	{
+		++latencies_count_;
+	}
+
+	void request_received()
+	{
+		++requests_count_;
+	}
+
+	void parse_failed()
+	{
+		++parse_errors_;
+	}
+
+	void record_file_open( const boost::chrono::nanoseconds& )
+	{
+		++file_opens_;
+	}
+
+	void replies_dropped( size_t count )
+	{
+		dropped_replies_ += count;
+	}
+
+	void record_reply_write()
+	{
+		++reply_writes_;
+	}
+
+	void record_zerocopy_send()
+	{
+		++zerocopy_sends_;
+	}
+
+	void record_zerocopy_copied( size_t count )
+	{
+		zerocopy_copied_ += count;
+	}
+
+	const perf::socket_settings& tune_socket( int fd )
+	{
+		perf::detail::set_socket_options( fd, sockets_ );
+
+		return sockets_;
+	}
+
+	int connections_;
+	size_t sent_data_;
+	size_t latencies_count_;
+	size_t requests_count_;
+	size_t parse_errors_;
+	size_t file_opens_;
+	size_t dropped_replies_;
+	size_t reply_writes_;
+	size_t zerocopy_sends_;
+	size_t zerocopy_copied_;
+	perf::socket_settings sockets_;
+};
+
+void record_latencies( perf::latency_recorder& recorder, size_t count )
+{
+	for ( size_t idx = 1; idx <= count; ++idx )
+	{
+		recorder.record( boost::chrono::microseconds( idx ) );
+	}
+}
+
+TEST( connection_test, pipelined_requests )
+{
+	using namespace perf::protocol;
+	namespace ip = boost::asio::ip;
+
+	typedef perf::connection< request_handler< fake_file_provider >, fake_observer > connection_type;
+
+	const std::string file_name( "nonexisting_test_file_name" );
+	fake_file_provider provider( file_name, "test file string text", 16 );
+	request_handler< fake_file_provider > handler( provider );
+	fake_observer observer;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+
+	// all requests are sent before any reply is read
+	const size_t requests_count = 5;
+	std::vector< char > requests;
+	for ( size_t idx = 0; idx < requests_count; ++idx )
+	{
+		variable_record var_rec;
+		const request req = { "GET" };
+		const size_t len = var_rec.serialize_data( req );
+		requests.insert( requests.end(), var_rec.get_data_buff(), var_rec.get_data_buff() + len );
+	}
+	boost::asio::write( client, boost::asio::buffer( requests ) );
+	client.shutdown( ip::tcp::socket::shutdown_send );
+
+	io_service.run();
+
+	// connection writes every queued reply out before it closes after end of requests
+	size_t replies_count = 0;
+	for ( ;; )
+	{
+		variable_record var_rec;
+		boost::system::error_code err;
+		boost::asio::read( client
+			, boost::asio::buffer( var_rec.get_header_buff(), variable_record::header_length )
+			, err );
+		if ( err )
+		{
+			break;
+		}
+
+		ASSERT_TRUE( var_rec.deserialize_header() );
+		boost::asio::read( client, boost::asio::buffer( var_rec.get_body_buff(), var_rec.get_body_length() ) );
+		reply_header header;
+		ASSERT_TRUE( var_rec.deserialize_body( header ) );
+		EXPECT_STREQ( header.file_name.c_str(), file_name.c_str() );
+
+		std::vector< char > data( header.file_size );
+		boost::asio::read( client, boost::asio::buffer( data ) );
+		++replies_count;
+	}
+
+	EXPECT_EQ( replies_count, requests_count );
+	EXPECT_EQ( observer.latencies_count_, requests_count );
+	EXPECT_EQ( observer.requests_count_, requests_count );
+	EXPECT_EQ( observer.file_opens_, requests_count );
+	EXPECT_EQ( observer.dropped_replies_, 0u );
+	EXPECT_EQ( observer.connections_, 0 );
+}
+
+TEST( socket_tuning_test, applies_and_reports_first_socket )
+{
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::socket first( io_service );
+	boost::asio::ip::tcp::socket second( io_service );
+	first.open( boost::asio::ip::tcp::v4() );
+	second.open( boost::asio::ip::tcp::v4() );
+
+	perf::socket_settings settings;
+	settings.send_buffer = 64 * 1024;
+	settings.no_delay = true;
+	settings.not_sent_lowat = 16 * 1024;
+	perf::socket_tuner tuner( settings );
+
+	std::string report;
+	EXPECT_TRUE( tuner.apply( first.native_handle(), report ) );
+	EXPECT_NE( report.find( "TCP_NODELAY 1 (1)" ), std::string::npos );
+	EXPECT_NE( report.find( "TCP_NOTSENT_LOWAT 16384 (16384)" ), std::string::npos );
+	// the kernel doubles the size asked for
+	EXPECT_NE( report.find( "(65536)" ), std::string::npos );
+	EXPECT_NE( report.find( "SO_ZEROCOPY 0" ), std::string::npos );
+
+	report.clear();
+	EXPECT_FALSE( tuner.apply( second.native_handle(), report ) );
+	EXPECT_TRUE( report.empty() );
+
+	boost::asio::ip::tcp::no_delay no_delay;
+	second.get_option( no_delay );
+	EXPECT_TRUE( no_delay.value() );
+}
+
+TEST( connection_test, tunes_accepted_socket )
+{
+	using namespace perf::protocol;
+	namespace ip = boost::asio::ip;
+
+	typedef perf::connection< request_handler< fake_file_provider >, fake_observer > connection_type;
+
+	fake_file_provider provider( "nonexisting_test_file_name", "test file string text", 16 );
+	request_handler< fake_file_provider > handler( provider );
+	fake_observer observer;
+	observer.sockets_.no_delay = true;
+	observer.sockets_.quick_ack = true;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+
+	ip::tcp::no_delay no_delay;
+	conn->connected_socket().get_option( no_delay );
+	EXPECT_TRUE( no_delay.value() );
+
+	variable_record var_rec;
+	const request req = { "GET" };
+	boost::asio::write( client, boost::asio::buffer( var_rec.get_data_buff(), var_rec.serialize_data( req ) ) );
+	client.shutdown( ip::tcp::socket::shutdown_send );
+
+	io_service.run();
+
+	EXPECT_EQ( observer.latencies_count_, 1u );
+	EXPECT_EQ( observer.connections_, 0 );
+}
+
+TEST( connection_test, batched_replies )
+{
+	using namespace perf::protocol;
+	namespace ip = boost::asio::ip;
+
+	typedef perf::connection< request_handler< fake_file_provider >, fake_observer > connection_type;
+
+	const std::string file_name( "nonexisting_test_file_name" );
+	fake_file_provider provider( file_name, "test file string text", 16 );
+	request_handler< fake_file_provider > handler( provider );
+	fake_observer observer;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+
+	// more requests than the queue takes, the first write ends inside a header
+	const size_t requests_count = connection_type::max_pending_replies + 36;
+	std::vector< char > requests;
+	for ( size_t idx = 0; idx < requests_count; ++idx )
+	{
+		variable_record var_rec;
+		const request req = { "GET" };
+		const size_t len = var_rec.serialize_data( req );
+		requests.insert( requests.end(), var_rec.get_data_buff(), var_rec.get_data_buff() + len );
+	}
+
+	const size_t split = 2 * ( variable_record::header_length + 3 ) + 5;
+	boost::asio::write( client, boost::asio::buffer( &requests[ 0 ], split ) );
+	for ( size_t idx = 0; idx < 10; ++idx )
+	{
+		io_service.poll();
+	}
+	boost::asio::write( client, boost::asio::buffer( &requests[ split ], requests.size() - split ) );
+	client.shutdown( ip::tcp::socket::shutdown_send );
+
+	io_service.run();
+
+	size_t replies_count = 0;
+	for ( ;; )
+	{
+		variable_record var_rec;
+		boost::system::error_code err;
+		boost::asio::read( client
+			, boost::asio::buffer( var_rec.get_header_buff(), variable_record::header_length )
+			, err );
+		if ( err )
+		{
+			break;
+		}
+
+		ASSERT_TRUE( var_rec.deserialize_header() );
+		boost::asio::read( client, boost::asio::buffer( var_rec.get_body_buff(), var_rec.get_body_length() ) );
+		reply_header header;
+		ASSERT_TRUE( var_rec.deserialize_body( header ) );
+		EXPECT_STREQ( header.file_name.c_str(), file_name.c_str() );
+
+		std::vector< char > data( header.file_size );
+		boost::asio::read( client, boost::asio::buffer( data ) );
+		++replies_count;
+	}
+
+	EXPECT_EQ( replies_count, requests_count );
+	EXPECT_EQ( observer.requests_count_, requests_count );
+	EXPECT_EQ( observer.parse_errors_, 0u );
+	EXPECT_EQ( observer.connections_, 0 );
+	// replies read at once leave in one sendmsg
+	EXPECT_GT( observer.reply_writes_, 0u );
+	EXPECT_LT( observer.reply_writes_, requests_count / 4 );
+}
+
+TEST_F( filelogic_test, connection_chunked_reply )
+{
+	namespace fs = boost::filesystem;
+	namespace ip = boost::asio::ip;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	typedef perf::connection< request_handler< file_provider >, fake_observer > connection_type;
+
+	// several times the chunk ring, last chunk is partial
+	const size_t file_size = connection_type::chunk_size * connection_type::chunk_ring_size * 2 + 1000;
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", file_size, 1 );
+
+	file_provider provider( test_directory_ );
+	provider.attach();
+	request_handler< file_provider > handler( provider, chunked_reply_mode );
+	fake_observer observer;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+
+	variable_record request_record;
+	const request req = { "GET" };
+	const size_t len = request_record.serialize_data( req );
+	boost::asio::write( client, boost::asio::buffer( request_record.get_data_buff(), len ) );
+	client.shutdown( ip::tcp::socket::shutdown_send );
+
+	// reply is bigger than socket buffers, read it while the connection writes
+	boost::thread server_thread( boost::bind( &boost::asio::io_service::run, &io_service ) );
+
+	variable_record var_rec;
+	boost::asio::read( client, boost::asio::buffer( var_rec.get_header_buff(), variable_record::header_length ) );
+	ASSERT_TRUE( var_rec.deserialize_header() );
+	boost::asio::read( client, boost::asio::buffer( var_rec.get_body_buff(), var_rec.get_body_length() ) );
+	reply_header header;
+	ASSERT_TRUE( var_rec.deserialize_body( header ) );
+
+	fs::path file( provider.get_file_dir() );
+	file /= header.file_name;
+	ASSERT_EQ( header.file_size, fs::file_size( file ) );
+
+	std::vector< char > received( header.file_size );
+	boost::asio::read( client, boost::asio::buffer( received ) );
+	server_thread.join();
+
+	std::ifstream in( file.string().c_str(), std::ios::binary );
+	std::vector< char > expected( ( std::istreambuf_iterator< char >( in ) ), std::istreambuf_iterator< char >() );
+	EXPECT_TRUE( received == expected );
+	EXPECT_EQ( observer.sent_data_, header.file_size );
+	EXPECT_EQ( observer.connections_, 0 );
+}
+
+TEST_F( filelogic_test, connection_ranged_sendfile_replies )
+{
+	namespace fs = boost::filesystem;
+	namespace ip = boost::asio::ip;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	typedef perf::connection< request_handler< file_provider >, fake_observer > connection_type;
+
+	const size_t file_size = 256 * 1024;
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", file_size, 1 );
+
+	file_provider provider( test_directory_ );
+	provider.attach();
+	request_handler< file_provider > handler( provider, sendfile_reply_mode );
+	fake_observer observer;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+
+	const fs::path file = fs::directory_iterator( test_directory_ )->path();
+	std::ifstream in( file.string().c_str(), std::ios::binary );
+	const std::vector< char > expected( ( std::istreambuf_iterator< char >( in ) ), std::istreambuf_iterator< char >() );
+
+	// the file in three pipelined ranges, the last one up to the end
+	const boost::uint64_t offsets[] = { 0, 100000, 200000 };
+	const boost::uint64_t lengths[] = { 100000, 100000, 0 };
+	for ( size_t idx = 0; idx < 3; ++idx )
+	{
+		request req( "GET" );
+		req.file_name = file.filename().string();
+		req.offset = offsets[ idx ];
+		req.length = lengths[ idx ];
+
+		variable_record request_record;
+		const size_t len = request_record.serialize_data( req );
+		boost::asio::write( client, boost::asio::buffer( request_record.get_data_buff(), len ) );
+	}
+	client.shutdown( ip::tcp::socket::shutdown_send );
+
+	boost::thread server_thread( boost::bind( &boost::asio::io_service::run, &io_service ) );
+
+	std::vector< char > received( expected.size() );
+	for ( size_t idx = 0; idx < 3; ++idx )
+	{
+		variable_record var_rec;
+		boost::asio::read( client, boost::asio::buffer( var_rec.get_header_buff(), variable_record::header_length ) );
+		ASSERT_TRUE( var_rec.deserialize_header() );
+		boost::asio::read( client, boost::asio::buffer( var_rec.get_body_buff(), var_rec.get_body_length() ) );
+		reply_header header;
+		ASSERT_TRUE( var_rec.deserialize_body( header ) );
+
+		EXPECT_EQ( header.offset, offsets[ idx ] );
+		EXPECT_EQ( header.total_size, expected.size() );
+		boost::asio::read( client, boost::asio::buffer( &received[ header.offset ], header.file_size ) );
+	}
+	server_thread.join();
+
+	EXPECT_TRUE( received == expected );
+	EXPECT_EQ( observer.sent_data_, expected.size() );
+}
+
+TEST_F( filelogic_test, connection_misses_file_removed_while_watched )
+{
+	namespace fs = boost::filesystem;
+	namespace ip = boost::asio::ip;
+	using namespace perf::filelogic;
+	using namespace perf::protocol;
+
+	typedef perf::connection< request_handler< file_provider >, fake_observer > connection_type;
+
+	file_generator file_gen( test_directory_ );
+	file_gen.generate_files( "test string", 1024, 1 );
+
+	file_provider provider( test_directory_ );
+	provider.enable_watching();
+	provider.attach();
+	request_handler< file_provider > handler( provider, sendfile_reply_mode );
+	fake_observer observer;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+
+	boost::thread server_thread( boost::bind( &boost::asio::io_service::run, &io_service ) );
+
+	const fs::path file = fs::directory_iterator( test_directory_ )->path();
+	fs::remove( file );
+
+	// the first pair is likely served from the table which still has the file, which
+	// can not be opened then; the last one after the swap, from an empty table
+	const size_t requests_count = 3;
+	for ( size_t idx = 0; idx < requests_count; ++idx )
+	{
+		if ( idx == 2 )
+		{
+			EXPECT_TRUE( wait_for_files_count( provider, 0 ) );
+		}
+
+		request req( "GET" );
+		req.file_name = idx == 1 ? file.filename().string() : std::string();
+
+		variable_record request_record;
+		const size_t len = request_record.serialize_data( req );
+		boost::asio::write( client, boost::asio::buffer( request_record.get_data_buff(), len ) );
+
+		variable_record var_rec;
+		boost::asio::read( client, boost::asio::buffer( var_rec.get_header_buff(), variable_record::header_length ) );
+		ASSERT_TRUE( var_rec.deserialize_header() );
+		boost::asio::read( client, boost::asio::buffer( var_rec.get_body_buff(), var_rec.get_body_length() ) );
+		reply_header header;
+		ASSERT_TRUE( var_rec.deserialize_body( header ) );
+
+		EXPECT_TRUE( header.file_name.empty() );
+		EXPECT_EQ( header.file_size, 0u );
+	}
+	client.shutdown( ip::tcp::socket::shutdown_send );
+	server_thread.join();
+
+	EXPECT_EQ( observer.requests_count_, requests_count );
+	EXPECT_EQ( observer.sent_data_, 0u );
+	EXPECT_EQ( observer.connections_, 0 );
+}
+
+TEST( latency_histogram_test, percentiles )
+{
+	perf::latency_histogram histogram;
+	for ( boost::uint64_t value = 1; value <= 100000; ++value )
+	{
+		histogram.record( value * 1000 );
+	}
+
+	EXPECT_EQ( histogram.get_total_count(), 100000u );
+	EXPECT_EQ( histogram.get_min(), 1000u );
+	EXPECT_EQ( histogram.get_max(), 100000000u );
+
+	// reported values are within bucket precision of the exact ones
+	const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	for ( size_t idx = 0; idx < sizeof( percentiles ) / sizeof( percentiles[ 0 ] ); ++idx )
+	{
+		const double expected = percentiles[ idx ] * 1000000;
+		const double reported = double( histogram.get_value_at_percentile( percentiles[ idx ] ) );
+		EXPECT_NEAR( reported, expected, expected / perf::latency_histogram::sub_bucket_half_count );
+	}
+
+	EXPECT_EQ( histogram.get_value_at_percentile( 100.0 ), histogram.get_max() );
+}
+
+TEST( latency_histogram_test, bucket_bounds )
+{
+	typedef perf::latency_histogram histogram_type;
+
+	for ( boost::uint64_t value = 0; value < 1000000; value = value * 3 / 2 + 1 )
+	{
+		const size_t idx = histogram_type::bucket_index( value );
+		EXPECT_LT( idx, size_t( histogram_type::buckets_count ) );
+		EXPECT_LE( histogram_type::bucket_lowest( idx ), value );
+		EXPECT_GE( histogram_type::bucket_highest( idx ), value );
+		EXPECT_EQ( histogram_type::bucket_lowest( idx + 1 ), histogram_type::bucket_highest( idx ) + 1 );
+	}
+}
+
+TEST( latency_histogram_test, recorder_merges_threads )
+{
+	perf::latency_recorder recorder;
+
+	boost::thread_group threads;
+	for ( size_t idx = 0; idx < 4; ++idx )
+	{
+		threads.create_thread( boost::bind( &record_latencies, boost::ref( recorder ), 1000 ) );
+	}
+	threads.join_all();
+
+	recorder.record( boost::chrono::microseconds( 5000 ) );
+
+	const perf::latency_histogram merged = recorder.get_merged();
+	EXPECT_EQ( merged.get_total_count(), 4001u );
+	EXPECT_EQ( merged.get_max(), 5000000u );
+
+	std::ostringstream csv;
+	merged.write_csv( csv );
+	EXPECT_EQ( csv.str().find( "value_ns,count,percentile\n" ), 0u );
+}
+
+TEST( connection_pool_test, recycles_connections )
+{
+	using namespace perf::protocol;
+
+	typedef perf::connection_pool< request_handler< fake_file_provider >, fake_observer > pool_type;
+
+	fake_file_provider provider( "nonexisting_test_file_name", "test file string text", 16 );
+	request_handler< fake_file_provider > handler( provider );
+	fake_observer observer;
+	boost::asio::io_service io_service;
+
+	boost::shared_ptr< pool_type > pool( new pool_type( io_service, handler, observer, 1 ) );
+
+	pool_type::connection_ptr first = pool->acquire();
+	pool_type::connection_type* const first_address = first.get();
+	EXPECT_EQ( pool->get_hits(), 1u );
+
+	// pool is empty, second one is constructed
+	pool_type::connection_ptr second = pool->acquire();
+	EXPECT_EQ( pool->get_misses(), 1u );
+
+	// goes back to the pool, the other one is deleted as the pool is full
+	first.reset();
+	second.reset();
+
+	first = pool->acquire();
+	EXPECT_EQ( first.get(), first_address );
+	EXPECT_EQ( pool->get_hits(), 2u );
+
+	// connection in use outlives the pool
+	pool.reset();
+	first.reset();
+}
+
+// serves one file from memory; its name fits the string's inline buffer, so the
+// file info is copied without allocation
+class fake_content_provider
+{
+public:
+
+	fake_content_provider( const std::string& file_name, size_t file_size )
+		: file_name_( file_name )
+		, content_( new fake_file_content( file_size ) )
+	{
+	}
+
+	perf::filelogic::file_stream_info get_file() const
+	{
+		throw std::logic_error( "fake_content_provider has no file stream" );
+	}
+
+	bool get_file( const std::string&, perf::filelogic::file_stream_info& ) const
+	{
+		throw std::logic_error( "fake_content_provider has no file stream" );
+	}
+
+	perf::filelogic::file_descriptor_info get_file_descriptor() const
+	{
+		throw std::logic_error( "fake_content_provider has no file on disk" );
+	}
+
+	bool get_file_descriptor( const std::string&, perf::filelogic::file_descriptor_info& ) const
+	{
+		throw std::logic_error( "fake_content_provider has no file on disk" );
+	}
+
+	perf::filelogic::file_content_info get_file_content() const
+	{
+		return get_mapped_file();
+	}
+
+	bool get_file_content( const std::string& name, perf::filelogic::file_content_info& info ) const
+	{
+		return get_mapped_file( name, info );
+	}
+
+	bool get_mapped_file( const std::string& name, perf::filelogic::file_content_info& info ) const
+	{
+		if ( name != file_name_ )
+		{
+			return false;
+		}
+
+		info = get_mapped_file();
+		return true;
+	}
+
+	perf::filelogic::file_content_info get_mapped_file() const
+	{
+		const perf::filelogic::file_content_info info = {
+			file_name_
+			, content_->size()
+			, content_ };
+
+		return info;
+	}
+
+private:
+
+	const std::string file_name_;
+	const boost::shared_ptr< const perf::filelogic::file_content > content_;
+};
+
+TEST( connection_test, steady_state_requests_do_not_allocate )
+{
+	using namespace perf::protocol;
+	namespace ip = boost::asio::ip;
+
+	typedef perf::connection< request_handler< fake_content_provider >, fake_observer > connection_type;
+
+	const std::string file_name( "short_name" );
+	const size_t file_size = 4096;
+	fake_content_provider provider( file_name, file_size );
+	request_handler< fake_content_provider > handler( provider, mmap_reply_mode );
+	fake_observer observer;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+	conn.reset();
+
+	boost::thread server_thread( boost::bind( &boost::asio::io_service::run, &io_service ) );
+
+	variable_record request_record;
+	const request req = { "GET" };
+	const size_t request_length = request_record.serialize_data( req );
+
+	variable_record reply_record;
+	reply_header header;
+	std::vector< char > data( file_size );
+
+	// first requests grow the reply ring and the buffers, the rest has to reuse them
+	const size_t warm_up_count = 16;
+	const size_t requests_count = 256;
+	for ( size_t idx = 0; idx < warm_up_count + requests_count; ++idx )
+	{
+		if ( idx == warm_up_count )
+		{
+			allocations_count.store( 0 );
+			count_allocations.store( true );
+		}
+
+		boost::asio::write( client, boost::asio::buffer( request_record.get_data_buff(), request_length ) );
+
+		boost::asio::read( client, boost::asio::buffer( reply_record.get_header_buff(), variable_record::header_length ) );
+		ASSERT_TRUE( reply_record.deserialize_header() );
+		boost::asio::read( client, boost::asio::buffer( reply_record.get_body_buff(), reply_record.get_body_length() ) );
+		ASSERT_TRUE( reply_record.deserialize_body( header ) );
+		ASSERT_EQ( header.file_size, file_size );
+		boost::asio::read( client, boost::asio::buffer( data ) );
+	}
+
+	count_allocations.store( false );
+	const size_t allocations = allocations_count.load();
+
+	client.shutdown( ip::tcp::socket::shutdown_send );
+	server_thread.join();
+
+	EXPECT_EQ( allocations, 0u ) << double( allocations ) / requests_count << " allocations per request";
+	EXPECT_EQ( observer.latencies_count_, warm_up_count + requests_count );
+	EXPECT_EQ( observer.connections_, 0 );
+}
+
+// pipelined requests for bodies large enough to go with MSG_ZEROCOPY; returns how many
+// bytes of the bodies read back are fill
+template< class provider_type >
+size_t serve_zerocopy_bodies(
+	const provider_type& provider
+	, perf::protocol::reply_mode mode
+	, size_t requests_count
+	, char fill
+	, fake_observer& observer )
+{
+	using namespace perf::protocol;
+	namespace ip = boost::asio::ip;
+
+	typedef perf::connection< request_handler< provider_type >, fake_observer > connection_type;
+
+	request_handler< provider_type > handler( provider, mode );
+	observer.sockets_.zerocopy = true;
+
+	boost::asio::io_service io_service;
+	ip::tcp::acceptor acceptor( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ) );
+	ip::tcp::socket client( io_service );
+	client.connect( acceptor.local_endpoint() );
+
+	typename connection_type::ptr conn( new connection_type( io_service, handler, observer ) );
+	acceptor.accept( conn->connected_socket() );
+	conn->start();
+	conn.reset();
+
+	boost::thread server_thread( boost::bind( &boost::asio::io_service::run, &io_service ) );
+
+	std::vector< char > requests;
+	for ( size_t idx = 0; idx < requests_count; ++idx )
+	{
+		variable_record var_rec;
+		const request req = { "GET" };
+		const size_t len = var_rec.serialize_data( req );
+		requests.insert( requests.end(), var_rec.get_data_buff(), var_rec.get_data_buff() + len );
+	}
+
+	boost::asio::write( client, boost::asio::buffer( requests ) );
+	client.shutdown( ip::tcp::socket::shutdown_send );
+
+	size_t received = 0;
+	for ( ;; )
+	{
+		variable_record var_rec;
+		boost::system::error_code err;
+		boost::asio::read( client
+			, boost::asio::buffer( var_rec.get_header_buff(), variable_record::header_length )
+			, err );
+		if ( err )
+		{
+			break;
+		}
+
+		EXPECT_TRUE( var_rec.deserialize_header() );
+		boost::asio::read( client, boost::asio::buffer( var_rec.get_body_buff(), var_rec.get_body_length() ) );
+		reply_header header;
+		EXPECT_TRUE( var_rec.deserialize_body( header ) );
+
+		std::vector< char > data( header.file_size );
+		boost::asio::read( client, boost::asio::buffer( data ) );
+		received += std::count( data.begin(), data.end(), fill );
+	}
+
+	// the connection is let go once the kernel has given back every body
+	server_thread.join();
+
+	return received;
+}
+
+TEST( connection_test, zerocopy_bodies )
+{
+	using namespace perf::protocol;
+
+	const size_t requests_count = 32;
+
+	const size_t file_size = 256 * 1024;
+	fake_content_provider content_provider( "short_name", file_size );
+	fake_observer content_observer;
+	EXPECT_EQ( serve_zerocopy_bodies( content_provider, mmap_reply_mode, requests_count, 'x', content_observer )
+		, requests_count * file_size );
+
+	// file_data buffers are taken from the replies while the kernel holds them
+	fake_file_provider file_provider( "nonexisting_test_file_name", std::string( 1023, 'y' ), 64 );
+	fake_observer file_observer;
+	EXPECT_EQ( serve_zerocopy_bodies( file_provider, copy_reply_mode, requests_count, 'y', file_observer )
+		, requests_count * 64 * 1023 );
+
+	const fake_observer* observers[] = { &content_observer, &file_observer };
+	for ( size_t idx = 0; idx < 2; ++idx )
+	{
+		const fake_observer& observer = *observers[ idx ];
+		EXPECT_EQ( observer.latencies_count_, requests_count );
+		EXPECT_EQ( observer.connections_, 0 );
+		EXPECT_GT( observer.zerocopy_sends_, 0u );
+		// loopback can not send from the pages, the kernel copies and zerocopy is
+		// given up for the rest of the connection
+		EXPECT_GT( observer.zerocopy_copied_, 0u );
+		EXPECT_LT( observer.zerocopy_sends_, requests_count );
+	}
+}
+
+void count_stats( perf::server_stats& stats, size_t count )
+{
+	for ( size_t idx = 0; idx < count; ++idx )
+	{
+		stats.add( perf::requests_received_counter, 1 );
+		stats.add( perf::queue_depth_counter, 1 );
+		stats.record_file_open( boost::chrono::microseconds( idx + 1 ) );
+	}
+}
+
+namespace
+{
+
+void read_in_section( const perf::rcu_domain& rcu, boost::atomic< bool >& entered, boost::atomic< bool >& leave )
+{
+	const perf::rcu_domain::read_guard guard( rcu );
+	entered = true;
+	while ( !leave )
+	{
+		boost::this_thread::yield();
+	}
+}
+
+void synchronize_rcu( const perf::rcu_domain& rcu, boost::atomic< bool >& synchronized )
+{
+	rcu.synchronize();
+	synchronized = true;
+}
+
+}
+
+TEST( rcu_test, synchronize_waits_for_readers )
+{
+	perf::rcu_domain rcu;
+
+	// no reader inside, nothing to wait for
+	rcu.synchronize();
+
+	boost::atomic< bool > entered( false );
+	boost::atomic< bool > leave( false );
+	boost::atomic< bool > synchronized( false );
+
+	boost::thread reader( boost::bind( &read_in_section, boost::cref( rcu ), boost::ref( entered ), boost::ref( leave ) ) );
+	while ( !entered )
+	{
+		boost::this_thread::yield();
+	}
+
+	boost::thread writer( boost::bind( &synchronize_rcu, boost::cref( rcu ), boost::ref( synchronized ) ) );
+	boost::this_thread::sleep_for( boost::chrono::milliseconds( 50 ) );
+	EXPECT_FALSE( synchronized );
+
+	leave = true;
+	reader.join();
+	writer.join();
+	EXPECT_TRUE( synchronized );
+}
+
+TEST( server_stats_test, sums_thread_counters )
+{
+	perf::server_stats stats;
+
+	boost::thread_group threads;
+	for ( size_t idx = 0; idx < 4; ++idx )
+	{
+		threads.create_thread( boost::bind( &count_stats, boost::ref( stats ), 1000 ) );
+	}
+	threads.join_all();
+
+	// the other thread's replies bring the queue down
+	stats.add( perf::queue_depth_counter, -3000 );
+	stats.add( perf::connections_opened_counter, 2 );
+	stats.add( perf::connections_closed_counter, 1 );
+
+	const perf::server_stats_snapshot snapshot = stats.get_snapshot();
+	EXPECT_EQ( snapshot.get( perf::requests_received_counter ), 4000 );
+	EXPECT_EQ( snapshot.get( perf::queue_depth_counter ), 1000 );
+	EXPECT_EQ( snapshot.get( perf::file_opens_counter ), 4000 );
+	EXPECT_EQ( snapshot.file_open_max_ns, 1000000u );
+	EXPECT_EQ( snapshot.get_open_connections(), 1 );
+	EXPECT_DOUBLE_EQ( snapshot.get_file_open_avg_us(), 500.5 );
+
+	std::ostringstream text;
+	snapshot.write_text( text );
+	EXPECT_NE( text.str().find( "requests_received 4000\n" ), std::string::npos );
+
+	std::ostringstream json;
+	snapshot.write_json( json );
+	EXPECT_EQ( json.str()[ 0 ], '{' );
+	EXPECT_NE( json.str().find( "\"queue_depth\": 1000" ), std::string::npos );
+}
+
+TEST( stats_endpoint_test, serves_json_on_request )
+{
+	namespace ip = boost::asio::ip;
+
+	perf::server_stats stats;
+	stats.add( perf::accepts_counter, 7 );
+
+	boost::asio::io_service io_service;
+	perf::stats_endpoint endpoint( io_service, ip::tcp::endpoint( ip::address_v4::loopback(), 0 ), stats );
+
+	ip::tcp::socket client( io_service );
+	client.connect( endpoint.get_local_endpoint() );
+	boost::asio::write( client, boost::asio::buffer( std::string( "json\n" ) ) );
+
+	boost::thread server_thread( boost::bind( &boost::asio::io_service::run, &io_service ) );
+
+	// session closes the connection after the reply
+	std::string reply;
+	boost::system::error_code err;
+	char buffer[ 1024 ];
+	while ( !err )
+	{
+		const size_t was_read = client.read_some( boost::asio::buffer( buffer ), err );
+		reply.append( buffer, was_read );
+	}
+
+	// endpoint goes on waiting for the next scrape
+	io_service.stop();
+	server_thread.join();
+
+	EXPECT_EQ( err, boost::asio::error::eof );
+	EXPECT_EQ( reply[ 0 ], '{' );
+	EXPECT_NE( reply.find( "\"accepts\": 7" ), std::string::npos );
+}
+
+TEST( logger_test, writes_enabled_records_in_batches )
+{
+	std::ostringstream out;
+	perf::logger log( out );
+	log.set_level( perf::info_log_level );
+	log.set_max_rate( 3 );
+
+	EXPECT_FALSE( log.is_enabled( perf::debug_log_level ) );
+	EXPECT_TRUE( log.is_enabled( perf::error_log_level ) );
+
+	for ( size_t idx = 0; idx < 5; ++idx )
+	{
+		perf::log_record record( perf::error_log_level );
+		record << "record " << idx << " of " << std::string( "five" );
+		log.write( record );
+	}
+
+	// nothing is written until the flush
+	EXPECT_TRUE( out.str().empty() );
+	log.flush();
+
+	const std::string text = out.str();
+	EXPECT_NE( text.find( "error: record 0 of five\n" ), std::string::npos );
+	EXPECT_NE( text.find( "error: record 2 of five\n" ), std::string::npos );
+	// over the rate of three a second
+	EXPECT_EQ( text.find( "record 3" ), std::string::npos );
+	EXPECT_NE( text.find( "2 log records dropped" ), std::string::npos );
+
+	// long text is cut at the record size
+	perf::log_record record;
+	record << std::string( perf::log_record::max_text_length * 2, 'x' );
+	EXPECT_EQ( strlen( record.get_text() ), size_t( perf::log_record::max_text_length ) );
+}
+
+namespace
+{
+
+void write_log_record( perf::logger& log, size_t idx )
+{
+	perf::log_record record( perf::error_log_level );
+	record << "thread " << idx;
+	log.write( record );
+}
+
+}
+
+TEST( logger_test, reuses_rings_of_exited_threads )
+{
+	std::ostringstream out;
+	perf::logger log( out );
+
+	// threads one after another, each takes the ring the last one has left
+	const size_t threads_count = 10;
+	for ( size_t idx = 0; idx < threads_count; ++idx )
+	{
+		boost::thread thread( boost::bind( &write_log_record, boost::ref( log ), idx ) );
+		thread.join();
+	}
+	EXPECT_EQ( log.get_rings_count(), 1u );
+
+	// records of the exited threads are all flushed
+	log.flush();
+	for ( size_t idx = 0; idx < threads_count; ++idx )
+	{
+		EXPECT_NE( out.str().find( "error: thread " + boost::lexical_cast< std::string >( idx ) + "\n" ), std::string::npos );
+	}
+}
+
+TEST( buffer_slab_test, reuses_released_buffers )
+{
+	perf::buffer_slab slab( 1024, 1 );
+
+	perf::buffer_slab::buffer_type buffer;
+	slab.acquire( buffer );
+	ASSERT_EQ( buffer.size(), 1024u );
+	const char* const data = &buffer[ 0 ];
+	EXPECT_EQ( slab.get_misses(), 1u );
+
+	slab.release( buffer );
+	EXPECT_TRUE( buffer.empty() );
+
+	slab.acquire( buffer );
+	EXPECT_EQ( &buffer[ 0 ], data );
+	EXPECT_EQ( slab.get_hits(), 1u );
+
+	// free list holds one buffer, the second release frees its memory
+	perf::buffer_slab::buffer_type other;
+	slab.acquire( other );
+	slab.release( buffer );
+	slab.release( other );
+	EXPECT_TRUE( other.empty() );
+	EXPECT_EQ( other.capacity(), 0u );
+}
+
+TEST( uring_test, recv_send_over_socket_pair )
+{
+	perf::uring::ring ring( 8 );
+
+	boost::asio::io_service io_service;
+	boost::asio::local::stream_protocol::socket src( io_service );
+	boost::asio::local::stream_protocol::socket dst( io_service );
+	boost::asio::local::connect_pair( src, dst );
+
+	const std::string data( "MSGN   3GET" );
+	char received[ 16 ] = {};
+
+	// both operations go to the kernel in one batch
+	io_uring_sqe* recv_sqe = ring.get_sqe();
+	recv_sqe->opcode = IORING_OP_RECV;
+	recv_sqe->fd = dst.native_handle();
+	recv_sqe->addr = reinterpret_cast< boost::uint64_t >( received );
+	recv_sqe->len = data.size();
+	recv_sqe->msg_flags = MSG_WAITALL;
+	recv_sqe->user_data = 1;
+
+	io_uring_sqe* send_sqe = ring.get_sqe();
+	send_sqe->opcode = IORING_OP_SEND;
+	send_sqe->fd = src.native_handle();
+	send_sqe->addr = reinterpret_cast< boost::uint64_t >( data.data() );
+	send_sqe->len = data.size();
+	send_sqe->user_data = 2;
+
+	size_t completed = 0;
+	while ( completed < 2 )
+	{
+		ring.submit_and_wait( 1 );
+
+		while ( io_uring_cqe* cqe = ring.peek_cqe() )
+		{
+			EXPECT_EQ( cqe->res, int( data.size() ) );
+			EXPECT_TRUE( cqe->user_data == 1 || cqe->user_data == 2 );
+			ring.cqe_seen();
+			++completed;
+		}
+	}
+
+	EXPECT_STREQ( received, data.c_str() );
+}
+
 TEST( receive_logic_test, overall_functionality )
 {
 	namespace fs = boost::filesystem;
@@ -498,7 +2479,8 @@ TEST( receive_logic_test, overall_functionality )
 
 	// ready to send reply
 
-	boost::asio::buffer( rep.get_buffers() );
+	EXPECT_EQ( boost::asio::buffer_size( rep.get_buffers() )
+		, variable_record::header_length + 24 + file_name.length() + rep.header.file_size );
 }
 
 /*{
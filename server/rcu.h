@@ -0,0 +1,130 @@
+#ifndef SERVER_RCU_H_
+#define SERVER_RCU_H_
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace perf
+{
+
+// read-copy-update for data published through an atomic pointer: readers mark the
+// time they are inside with the current epoch in a slot of their own and take no
+// lock; the writer swaps the pointer, moves the epoch on and waits in synchronize
+// until no reader has been in since an older epoch, the old data is free then
+class rcu_domain
+	: private boost::noncopyable
+{
+private:
+
+	// 0 when the thread is not inside a read section
+	struct reader_slot
+	{
+		reader_slot()
+			: epoch( 0 )
+		{
+		}
+
+		boost::atomic< boost::uint64_t > epoch;
+		char padding[ 64 ];
+	};
+
+public:
+
+	// read sections of one thread must not nest
+	class read_guard
+		: private boost::noncopyable
+	{
+	public:
+
+		explicit read_guard( const rcu_domain& domain )
+			: slot_( domain.local_slot() )
+		{
+			// seq_cst store, the pointer is loaded after the epoch is visible to the writer
+			slot_.epoch.store( domain.epoch_.load() );
+		}
+
+		~read_guard()
+		{
+			slot_.epoch.store( 0, boost::memory_order_release );
+		}
+
+	private:
+		reader_slot& slot_;
+	};
+
+	rcu_domain()
+		: id_( next_id() )
+		, epoch_( 1 )
+	{
+	}
+
+	// called by the writer after the pointer is swapped
+	void synchronize() const
+	{
+		const boost::uint64_t target = ++epoch_;
+
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		for ( size_t idx = 0; idx < slots_.size(); ++idx )
+		{
+			for ( ;; )
+			{
+				const boost::uint64_t epoch = slots_[ idx ].epoch.load();
+				if ( !epoch || epoch >= target )
+				{
+					break;
+				}
+
+				boost::this_thread::yield();
+			}
+		}
+	}
+
+private:
+
+	// as in latency_recorder, a slot left by a destroyed domain is told by its id
+	struct thread_slot
+	{
+		boost::uint64_t owner_id;
+		reader_slot* slot;
+	};
+
+	static boost::uint64_t next_id()
+	{
+		static boost::atomic< boost::uint64_t > id( 0 );
+
+		return ++id;
+	}
+
+	reader_slot& local_slot() const
+	{
+		thread_slot* slot = thread_slot_.get();
+		if ( !slot || slot->owner_id != id_ )
+		{
+			boost::lock_guard< boost::mutex > lock( mutex_ );
+
+			slots_.push_back( new reader_slot() );
+
+			slot = new thread_slot;
+			slot->owner_id = id_;
+			slot->slot = &slots_.back();
+			thread_slot_.reset( slot );
+		}
+
+		return *slot->slot;
+	}
+
+private:
+	const boost::uint64_t id_;
+	mutable boost::atomic< boost::uint64_t > epoch_;
+	mutable boost::thread_specific_ptr< thread_slot > thread_slot_;
+	mutable boost::mutex mutex_;
+	mutable boost::ptr_vector< reader_slot > slots_;
+};
+
+}
+
+#endif // SERVER_RCU_H_
@@ -3,38 +3,211 @@
 
 #include "protocol_structs.h"
 #include "variable_record.h"
+#include "file_logic.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
 
 #include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/assert.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace perf
 {
 namespace protocol
 {
 
+enum reply_mode
+{
+	// file body is read into reply::file_data and written from there
+	copy_reply_mode,
+	// file body goes from the page cache to the socket with sendfile(2)
+	sendfile_reply_mode,
+	// file body is written from the shared buffer kept in file_provider cache
+	cache_reply_mode,
+	// file body is written straight from the file mapping made by file_provider
+	mmap_reply_mode,
+	// file body is read and written in fixed size chunks through a small per connection ring
+	chunked_reply_mode
+};
+
+inline reply_mode reply_mode_from_string( const std::string& mode )
+{
+	if ( mode == "copy" )
+	{
+		return copy_reply_mode;
+	}
+	else if ( mode == "sendfile" )
+	{
+		return sendfile_reply_mode;
+	}
+	else if ( mode == "cache" )
+	{
+		return cache_reply_mode;
+	}
+	else if ( mode == "mmap" )
+	{
+		return mmap_reply_mode;
+	}
+	else if ( mode == "chunked" )
+	{
+		return chunked_reply_mode;
+	}
+
+	throw std::invalid_argument( "unknown reply mode: " + mode );
+}
+
+// buffers of one reply held in place, a const buffer sequence taken without allocation
+class reply_buffers
+{
+public:
+	typedef boost::asio::const_buffer value_type;
+	typedef const boost::asio::const_buffer* const_iterator;
+
+	enum { max_count = 2 };
+
+	reply_buffers()
+		: count_( 0 )
+	{
+	}
+
+	void push_back( const boost::asio::const_buffer& buffer )
+	{
+		BOOST_ASSERT( count_ < max_count );
+		buffers_[ count_++ ] = buffer;
+	}
+
+	size_t size() const
+	{
+		return count_;
+	}
+
+	const boost::asio::const_buffer& operator[]( size_t idx ) const
+	{
+		return buffers_[ idx ];
+	}
+
+	const_iterator begin() const
+	{
+		return buffers_.data();
+	}
+
+	const_iterator end() const
+	{
+		return buffers_.data() + count_;
+	}
+
+private:
+	boost::array< boost::asio::const_buffer, max_count > buffers_;
+	size_t count_;
+};
+
+// made once per slot of a connection and reused for every request going through
+// it: reset drops the references to the last file but keeps the memory, so steady
+// serving allocates nothing. file_data keeps the capacity of the largest body of the
+// last shrink_window replies, a burst of big copies does not stay pinned for good
 struct reply
 {
+	enum { shrink_window = 64, min_retained_capacity = 64 * 1024 };
+
+	reply()
+		: header()
+		, format( ascii_header_format )
+		, chunked( false )
+		, high_water_( 0 )
+		, window_count_( 0 )
+	{
+	}
+
 	reply_header header;
+	// reply header goes in the format the request header came in
+	header_format format;
 	std::vector< char > file_data;
+	// set when the body has to be sent from the file instead of file_data
+	boost::shared_ptr< filelogic::file_descriptor > file_descriptor;
+	// file body is streamed in chunks read from file_descriptor instead of sendfile
+	bool chunked;
+	// set when the body is written from the shared immutable buffer (cache or mapping) instead of file_data
+	boost::shared_ptr< const filelogic::file_content > file_content;
 
-	std::vector< boost::asio::const_buffer > get_buffers() const
+	bool has_file_descriptor() const
 	{
-		std::vector< boost::asio::const_buffer > buffers;
+		return file_descriptor.get() != 0;
+	}
 
+	// back to an empty reply with no name and no body; the format is set per request
+	void reset()
+	{
+		header.file_name.clear();
+		header.file_size = 0;
+		header.offset = 0;
+		header.total_size = 0;
+		file_descriptor.reset();
+		chunked = false;
+		file_content.reset();
+
+		high_water_ = std::max( high_water_, file_data.size() );
+		file_data.clear();
+
+		if ( ++window_count_ == shrink_window )
+		{
+			const size_t retained = std::max< size_t >( high_water_, min_retained_capacity );
+			if ( file_data.capacity() > 2 * retained )
+			{
+				std::vector< char > shrunk;
+				shrunk.reserve( retained );
+				file_data.swap( shrunk );
+			}
+
+			high_water_ = 0;
+			window_count_ = 0;
+		}
+	}
+
+	// framed header and the body when it is not sent from the file
+	enum { max_buffers_count = reply_buffers::max_count };
+
+	reply_buffers get_buffers() const
+	{
+		reply_buffers buffers;
+		append_buffers( buffers );
+
+		return buffers;
+	}
+
+	// appends to the caller's sequence, a vector keeps its capacity from reply to reply
+	template< class buffer_sequence >
+	void append_buffers( buffer_sequence& buffers ) const
+	{
+		var_rec_.set_header_format( format );
 		const size_t data_len = var_rec_.serialize_data( header );
 		buffers.push_back(
 			boost::asio::buffer( var_rec_.get_data_buff()
 			, data_len ) );
 
-		buffers.push_back(
-			boost::asio::buffer( &file_data[ 0 ]
-			, file_data.size() ) );
-
-		return buffers;
+		// the body is the requested range of the shared content
+		if ( file_content && header.file_size )
+		{
+			buffers.push_back(
+				boost::asio::buffer( file_content->data() + header.offset
+				, header.file_size ) );
+		}
+		else if ( !file_data.empty() )
+		{
+			buffers.push_back(
+				boost::asio::buffer( &file_data[ 0 ]
+				, file_data.size() ) );
+		}
 	}
 
 private:
 	mutable variable_record var_rec_;
-	mutable std::vector< char > buff;
+	// largest body of the current window
+	size_t high_water_;
+	size_t window_count_;
 };
 
 }
@@ -20,35 +20,176 @@ class request_handler
 {
 public:
 
-	request_handler( const T& file_prov )
+	request_handler( const T& file_prov, reply_mode mode = copy_reply_mode )
 		: file_provider_( file_prov )
+		, mode_( mode )
 	{
 	}
 
+	// a request without a name gets a file picked at random, a name which is not
+	// served or a file which can not be opened gets a reply with no name and no
+	// data; a range limits the body to a part of the file in every mode
 	void make_reply( const request& req, reply& rep ) const
 	{
-		namespace fs = boost::filesystem;
+		rep.reset();
 
-		if ( req.method == "GET" )
+		if ( req.method == "GET" && !req.file_name.empty() )
 		{
-			perf::filelogic::file_stream_info file_entry = file_provider_.get_file();
-			const fs::path file_name = file_entry.file_name;
-			rep.header.file_name = file_name.filename().string();
+			make_named_reply( req, rep );
+		}
+		else if ( req.method == "GET" )
+		{
+			if ( mode_ == sendfile_reply_mode )
+			{
+				make_sendfile_reply( req, file_provider_.get_file_descriptor(), rep );
+			}
+			else if ( mode_ == cache_reply_mode )
+			{
+				make_content_reply( req, file_provider_.get_file_content(), rep );
+			}
+			else if ( mode_ == mmap_reply_mode )
+			{
+				make_mapped_reply( req, file_provider_.get_mapped_file(), rep );
+			}
+			else if ( mode_ == chunked_reply_mode )
+			{
+				make_sendfile_reply( req, file_provider_.get_file_descriptor(), rep );
+				rep.chunked = rep.has_file_descriptor();
+			}
+			else
+			{
+				make_copy_reply( req, file_provider_.get_file(), rep );
+			}
+		}
+	}
+
+private:
+
+	// a name which is not served leaves the reply as reset
+	void make_named_reply( const request& req, reply& rep ) const
+	{
+		if ( mode_ == sendfile_reply_mode || mode_ == chunked_reply_mode )
+		{
+			perf::filelogic::file_descriptor_info file_entry;
+			if ( file_provider_.get_file_descriptor( req.file_name, file_entry ) )
+			{
+				make_sendfile_reply( req, file_entry, rep );
+				rep.chunked = mode_ == chunked_reply_mode;
+			}
+		}
+		else if ( mode_ == cache_reply_mode )
+		{
+			perf::filelogic::file_content_info file_entry;
+			if ( file_provider_.get_file_content( req.file_name, file_entry ) )
+			{
+				make_content_reply( req, file_entry, rep );
+			}
+		}
+		else if ( mode_ == mmap_reply_mode )
+		{
+			perf::filelogic::file_content_info file_entry;
+			if ( file_provider_.get_mapped_file( req.file_name, file_entry ) )
+			{
+				make_mapped_reply( req, file_entry, rep );
+			}
+		}
+		else
+		{
+			perf::filelogic::file_stream_info file_entry;
+			if ( file_provider_.get_file( req.file_name, file_entry ) )
+			{
+				make_copy_reply( req, file_entry, rep );
+			}
+		}
+	}
+
+	// the make_*_reply functions fill a reply which has been reset; an entry with no
+	// name, of a picked file which could not be opened, leaves it so
+
+	void make_copy_reply( const request& req, const perf::filelogic::file_stream_info& file_entry, reply& rep ) const
+	{
+		if ( file_entry.file_name.empty() )
+		{
+			return;
+		}
+
+		assign_file_name( file_entry.file_name, rep.header.file_name );
+		set_range( req, file_entry.disk_file_size, rep.header );
+
+		// only the range is read, a file shorter than its size taken gives less;
+		// file_data is sized within the capacity the reply has kept
+		std::istream& stream = *file_entry.stream;
+		stream.seekg( rep.header.offset );
+		rep.file_data.resize( rep.header.file_size );
+		if ( rep.header.file_size )
+		{
+			stream.read( &rep.file_data[ 0 ], rep.header.file_size );
+			rep.file_data.resize( stream.gcount() );
+		}
+		rep.header.file_size = rep.file_data.size();
+	}
 
-			std::istream& stream = *file_entry.stream;
-			stream >> std::noskipws;
-			std::istream_iterator< char > begin( stream );
-			std::istream_iterator< char > end;
+	void make_sendfile_reply( const request& req, const perf::filelogic::file_descriptor_info& file_entry, reply& rep ) const
+	{
+		if ( file_entry.file_name.empty() )
+		{
+			return;
+		}
+
+		assign_file_name( file_entry.file_name, rep.header.file_name );
+		set_range( req, file_entry.disk_file_size, rep.header );
+		rep.file_descriptor = file_entry.descriptor;
+	}
 
-			rep.file_data.reserve( file_entry.disk_file_size );
-			std::copy( begin, end, std::back_inserter( rep.file_data ) );
-			rep.header.file_size = rep.file_data.size();
+	// a file which is not mapped, as the mappings budget was used up, goes with sendfile
+	void make_mapped_reply( const request& req, const perf::filelogic::file_content_info& file_entry, reply& rep ) const
+	{
+		if ( file_entry.content || file_entry.file_name.empty() )
+		{
+			make_content_reply( req, file_entry, rep );
+			return;
+		}
+
+		perf::filelogic::file_descriptor_info descriptor_entry;
+		if ( file_provider_.get_file_descriptor( file_entry.file_name, descriptor_entry ) )
+		{
+			make_sendfile_reply( req, descriptor_entry, rep );
 		}
 	}
 
+	void make_content_reply( const request& req, const perf::filelogic::file_content_info& file_entry, reply& rep ) const
+	{
+		if ( file_entry.file_name.empty() )
+		{
+			return;
+		}
+
+		assign_file_name( file_entry.file_name, rep.header.file_name );
+		set_range( req, file_entry.disk_file_size, rep.header );
+		rep.file_content = file_entry.content;
+	}
+
+	// range is cut to the file, an offset past the end gives an empty body
+	static void set_range( const request& req, boost::uint64_t total_size, reply_header& header )
+	{
+		header.total_size = total_size;
+		header.offset = std::min( req.offset, total_size );
+
+		const boost::uint64_t left = total_size - header.offset;
+		header.file_size = req.length ? std::min( req.length, left ) : left;
+	}
+
+	// the reply's string keeps its capacity, names are of about the same length
+	static void assign_file_name( const std::string& path, std::string& file_name )
+	{
+		const std::string::size_type slash = path.rfind( '/' );
+		file_name.assign( path, slash == std::string::npos ? 0 : slash + 1, std::string::npos );
+	}
+
 private:
 
 	const T& file_provider_;
+	const reply_mode mode_;
 };
 
 }
@@ -0,0 +1,194 @@
+#ifndef SERVER_SENDFILE_H_
+#define SERVER_SENDFILE_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/system/error_code.hpp>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+namespace perf
+{
+namespace detail
+{
+
+// iovecs a single sendmsg(2) takes
+enum { max_iovecs = IOV_MAX };
+
+inline iovec make_iovec( const boost::asio::const_buffer& buffer )
+{
+	iovec iov;
+	iov.iov_base = const_cast< void* >( boost::asio::buffer_cast< const void* >( buffer ) );
+	iov.iov_len = boost::asio::buffer_size( buffer );
+
+	return iov;
+}
+
+// sends up to count bytes of in_fd starting from offset to the non-blocking socket out_fd,
+// advances offset; returns boost::asio::error::would_block when the socket is full
+inline size_t sendfile_some(
+	int out_fd
+	, int in_fd
+	, off_t& offset
+	, size_t count
+	, boost::system::error_code& err )
+{
+	for ( ;; )
+	{
+		const ssize_t sent = ::sendfile( out_fd, in_fd, &offset, count );
+
+		if ( sent >= 0 )
+		{
+			err = boost::system::error_code();
+			return sent;
+		}
+
+		if ( errno == EINTR )
+		{
+			continue;
+		}
+
+		if ( errno == EAGAIN || errno == EWOULDBLOCK )
+		{
+			err = boost::asio::error::would_block;
+		}
+		else
+		{
+			err = boost::system::error_code( errno, boost::asio::error::get_system_category() );
+		}
+
+		return 0;
+	}
+}
+
+// sends what the non-blocking socket fd takes of up to max_iovecs of the count
+// iovecs with one sendmsg(2); returns boost::asio::error::would_block when the socket is full
+inline size_t sendmsg_some(
+	int fd
+	, iovec* iov
+	, size_t count
+	, int flags
+	, boost::system::error_code& err )
+{
+	msghdr msg;
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count < size_t( max_iovecs ) ? count : size_t( max_iovecs );
+
+	for ( ;; )
+	{
+		const ssize_t sent = ::sendmsg( fd, &msg, flags );
+
+		if ( sent >= 0 )
+		{
+			err = boost::system::error_code();
+			return sent;
+		}
+
+		if ( errno == EINTR )
+		{
+			continue;
+		}
+
+		if ( errno == EAGAIN || errno == EWOULDBLOCK )
+		{
+			err = boost::asio::error::would_block;
+		}
+		else
+		{
+			err = boost::system::error_code( errno, boost::asio::error::get_system_category() );
+		}
+
+		return 0;
+	}
+}
+
+// MSG_ZEROCOPY is ignored without a notification when SO_ZEROCOPY is not set
+inline bool zerocopy_enabled( int fd )
+{
+	int value = 0;
+	socklen_t length = sizeof( value );
+
+	return !::getsockopt( fd, SOL_SOCKET, SO_ZEROCOPY, &value, &length ) && value;
+}
+
+// completion of the MSG_ZEROCOPY sends numbered [first, last] in the order they were
+// made on the socket; copied is set when the kernel has copied the data after all
+struct zerocopy_completion
+{
+	boost::uint32_t first;
+	boost::uint32_t last;
+	bool copied;
+};
+
+// takes the next zerocopy completion off the error queue of fd without blocking;
+// false when there is none left, other errors queued are skipped
+inline bool read_zerocopy_completion( int fd, zerocopy_completion& completion )
+{
+	for ( ;; )
+	{
+		char control[ CMSG_SPACE( sizeof( sock_extended_err ) + sizeof( sockaddr_in6 ) ) ];
+		msghdr msg;
+		memset( &msg, 0, sizeof( msg ) );
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof( control );
+
+		if ( ::recvmsg( fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT ) < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		for ( cmsghdr* cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+		{
+			const bool recverr = ( cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR )
+				|| ( cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR );
+			if ( !recverr )
+			{
+				continue;
+			}
+
+			const sock_extended_err* err = reinterpret_cast< const sock_extended_err* >( CMSG_DATA( cmsg ) );
+			if ( err->ee_errno == 0 && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY )
+			{
+				completion.first = err->ee_info;
+				completion.last = err->ee_data;
+				completion.copied = ( err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) != 0;
+				return true;
+			}
+		}
+	}
+}
+
+}
+}
+
+#endif // SERVER_SENDFILE_H_
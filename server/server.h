@@ -2,14 +2,22 @@
 #define PERF_SERVER_H_
 
 #include "connection.h"
+#include "connection_pool.h"
 #include "file_provider.h"
 #include "request_handler.h"
+#include "latency_histogram.h"
+#include "server_stats.h"
+#include "stats_endpoint.h"
+#include "logger.h"
 
 #include <iostream>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
@@ -17,39 +25,157 @@
 #include <boost/filesystem.hpp>
 #include <boost/atomic.hpp>
 #include <boost/chrono/include.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 
 namespace perf
 {
 
+namespace detail
+{
+
+inline void print_transfer_rate(
+	boost::uint64_t sent_data_b
+	, const boost::chrono::duration< double >& interval_sec )
+{
+	const boost::uint64_t bytes_in_mb = 1024 * 1024;
+	const boost::uint64_t sent_data_bits = sent_data_b * std::numeric_limits< char >::digits;
+	const double sent_data_mb = double( sent_data_b ) / bytes_in_mb;
+
+	std::cout << "Sent " << sent_data_b << " bytes" <<
+		" : " << sent_data_mb << " MB. " << std::endl;
+
+	const boost::chrono::duration< double, boost::ratio< 60l > > interval_min( interval_sec );
+
+	std::cout << "Used time: " << interval_sec << " : " <<
+		interval_min << std::endl;
+
+	const double sent_data_mb_per_s = sent_data_mb / interval_sec.count();
+	const double sent_data_mbit_per_s = double( sent_data_bits ) / ( bytes_in_mb * interval_sec.count() );
+
+	std::cout << "Transfer rate " <<
+		sent_data_mbit_per_s << " Mbit/s" <<
+		" : " << sent_data_mb_per_s << " MB/s" << std::endl;
+}
+
+inline void pin_current_thread( unsigned int cpu )
+{
+	cpu_set_t cpu_set;
+	CPU_ZERO( &cpu_set );
+	CPU_SET( cpu, &cpu_set );
+
+	const int res = pthread_setaffinity_np( pthread_self(), sizeof( cpu_set ), &cpu_set );
+	if ( res )
+	{
+		PERF_LOG_ERROR( "can not pin thread to cpu " << cpu );
+	}
+}
+
+typedef boost::asio::detail::socket_option::boolean< SOL_SOCKET, SO_REUSEPORT > reuse_port;
+
+// io_service with its own listening socket; connections accepted by a shard
+// live on its io_service for the whole lifetime
+class server_shard
+	: private boost::noncopyable
+{
+public:
+
+	server_shard(
+		const boost::asio::ip::tcp::endpoint& endpoint
+		, bool reuse_port_enabled
+		, const socket_tuner& tuner )
+		: io_service_()
+		, acceptor_( io_service_ )
+	{
+		// bind, listen
+		acceptor_.open( endpoint.protocol() );
+		acceptor_.set_option( boost::asio::ip::tcp::acceptor::reuse_address( true ) );
+		tuner.apply_listening( acceptor_.native_handle() );
+		if ( reuse_port_enabled )
+		{
+			// every shard listens on the same port, the kernel balances incoming connections
+			acceptor_.set_option( reuse_port( true ) );
+		}
+		acceptor_.bind( endpoint );
+		acceptor_.listen();
+	}
+
+	boost::asio::io_service& get_io_service()
+	{
+		return io_service_;
+	}
+
+	boost::asio::ip::tcp::acceptor& get_acceptor()
+	{
+		return acceptor_;
+	}
+
+	void run_pinned( unsigned int cpu )
+	{
+		pin_current_thread( cpu );
+
+		io_service_.run();
+	}
+
+	void stop()
+	{
+		io_service_.stop();
+	}
+
+private:
+	boost::asio::io_service io_service_;
+	boost::asio::ip::tcp::acceptor acceptor_;
+};
+
+}
+
 class server;
 
 class server
 {
 	typedef connection< protocol::request_handler< filelogic::file_provider >, server >::ptr connection_ptr;
 	typedef connection< protocol::request_handler< filelogic::file_provider >, server > connection_type;
+	typedef connection_pool< protocol::request_handler< filelogic::file_provider >, server > connection_pool_type;
 public:
 
 	server(
 		const boost::asio::ip::tcp::endpoint& endpoint
 		, const boost::filesystem::path& file_dir
-		, unsigned int threads_count )
+		, unsigned int threads_count
+		, protocol::reply_mode mode = protocol::copy_reply_mode
+		, const filelogic::cache_settings& cache = filelogic::cache_settings()
+		, bool sharded = false
+		, size_t connection_pool_size = 0
+		, unsigned short stats_port = 0
+		, const std::string& index_file = std::string()
+		, bool watch_files = false
+		, const socket_settings& sockets = socket_settings() )
 		: io_service_()
-		, acceptor_( io_service_ )
 		, threads_count_( threads_count )
+		, sharded_( sharded )
 		, signals_( io_service_ )
 		, file_provider_( file_dir )
-		, request_handler_( file_provider_ )
+		, request_handler_( file_provider_, mode )
 		, connection_counter_( 0 )
 		, sent_data_( 0 )
+		, stopped_( false )
+		, socket_tuner_( sockets )
 	{
-		boost::packaged_task< void > pt(
-			boost::bind( &filelogic::file_provider::attach, &file_provider_ ) );
-
-		boost::unique_future< void > attach_to_dir(
-			boost::move< boost::unique_future< void > >( pt.get_future() ) );
+		if ( mode == protocol::cache_reply_mode && cache.capacity )
+		{
+			file_provider_.enable_cache( cache );
+		}
+		else if ( mode == protocol::mmap_reply_mode )
+		{
+			file_provider_.enable_mapping();
+		}
 
-		boost::thread task( boost::move( pt ) );
-		task.detach();
+		file_provider_.enable_index( index_file );
+		if ( watch_files )
+		{
+			file_provider_.enable_watching();
+		}
+		file_provider_.start_attach();
 
 		// system signals
 		signals_.add(SIGINT);
@@ -57,32 +183,87 @@ public:
 		signals_.async_wait(
 			boost::bind( &server::handle_stop, this ) );
 
-		// bind, listen
-		acceptor_.open( endpoint.protocol() );
-		acceptor_.set_option( boost::asio::ip::tcp::acceptor::reuse_address( true ) );
-		acceptor_.bind( endpoint );
-		acceptor_.listen();
+		// served by the thread handling signals, io threads are not disturbed by scrapes
+		if ( stats_port )
+		{
+			stats_endpoint_.reset( new stats_endpoint( io_service_
+				, boost::asio::ip::tcp::endpoint( boost::asio::ip::address_v4::loopback(), stats_port )
+				, stats_ ) );
+		}
 
-		attach_to_dir.wait();
+		// sharded: shard per thread, otherwise all threads share one shard
+		const unsigned int shards_count = sharded_ ? threads_count_ : 1;
+		for ( unsigned int idx = 0; idx < shards_count; idx++ )
+		{
+			shards_.push_back( new detail::server_shard( endpoint, sharded_, socket_tuner_ ) );
+			pools_.push_back( boost::shared_ptr< connection_pool_type >( new connection_pool_type(
+				shards_.back().get_io_service(), request_handler_, *this, connection_pool_size ) ) );
+		}
+
+		// the rest of the directory is indexed while clients are served
+		file_provider_.wait_until_serving();
 
 		// accepting
-		start_accept();
+		for ( size_t idx = 0; idx < shards_.size(); idx++ )
+		{
+			start_accept( idx );
+		}
 	}
 
 	void run()
 	{
-		for ( unsigned int idx = 0;  idx < threads_count_; idx++ )
+		if ( sharded_ )
 		{
-			threads_.create_thread(
-				boost::bind( &boost::asio::io_service::run, &io_service_ ) );
+			const unsigned int cpu_count = boost::thread::hardware_concurrency();
+
+			for ( unsigned int idx = 0;  idx < threads_count_; idx++ )
+			{
+				threads_.create_thread(
+					boost::bind( &detail::server_shard::run_pinned, &shards_[ idx ], idx % cpu_count ) );
+			}
 		}
+		else
+		{
+			for ( unsigned int idx = 0;  idx < threads_count_; idx++ )
+			{
+				threads_.create_thread(
+					boost::bind( &boost::asio::io_service::run, &shards_.front().get_io_service() ) );
+			}
+		}
+
+		// system signals are handled here
+		io_service_.run();
 
 		threads_.join_all();
+
+		if ( const filelogic::file_cache* cache = file_provider_.get_cache() )
+		{
+			std::cout << "Cache hits " << cache->get_hits() <<
+				" misses " << cache->get_misses() <<
+				" size " << cache->get_size() << " bytes" << std::endl;
+		}
+
+		boost::uint64_t pool_hits = 0;
+		boost::uint64_t pool_misses = 0;
+		for ( size_t idx = 0; idx < pools_.size(); idx++ )
+		{
+			pool_hits += pools_[ idx ]->get_hits();
+			pool_misses += pools_[ idx ]->get_misses();
+		}
+
+		std::cout << "Connection pool hits " << pool_hits << " misses " << pool_misses << std::endl;
+		std::cout << "Chunk buffer slab hits " << connection_type::chunk_slab().get_hits() <<
+			" misses " << connection_type::chunk_slab().get_misses() << std::endl;
+
+		latency_.get_merged().print( std::cout );
+		stats_.get_snapshot().write_text( std::cout );
 	}
 
 	void checkin()
 	{
-		std::cout << "checkin" << std::endl;
+		PERF_LOG_DEBUG( "checkin" );
+
+		stats_.add( connections_opened_counter, 1 );
 
 		const int cntr = connection_counter_.fetch_add( 1 );
 
@@ -96,7 +277,9 @@ public:
 
 	void checkout()
 	{
-		std::cout << "checkout" << std::endl;
+		PERF_LOG_DEBUG( "checkout" );
+
+		stats_.add( connections_closed_counter, 1 );
 
 		if ( connection_counter_.fetch_sub( 1 ) == 1 )
 		{
@@ -109,79 +292,158 @@ public:
 	void update_sent_data( size_t size )
 	{
 		sent_data_ += size;
+
+		stats_.add( replies_sent_counter, 1 );
+		stats_.add( bytes_sent_counter, size );
+		stats_.add( queue_depth_counter, -1 );
+	}
+
+	void request_received()
+	{
+		stats_.add( requests_received_counter, 1 );
+		stats_.add( queue_depth_counter, 1 );
+	}
+
+	void parse_failed()
+	{
+		stats_.add( parse_errors_counter, 1 );
+	}
+
+	void record_file_open( const boost::chrono::nanoseconds& latency )
+	{
+		stats_.record_file_open( latency );
+	}
+
+	// the options the first connection has got are logged
+	const socket_settings& tune_socket( int fd )
+	{
+		std::string report;
+		if ( socket_tuner_.apply( fd, report ) )
+		{
+			PERF_LOG_INFO( "socket options " << report );
+		}
+
+		return socket_tuner_.get_settings();
+	}
+
+	void record_reply_write()
+	{
+		stats_.add( reply_writes_counter, 1 );
+	}
+
+	void record_zerocopy_send()
+	{
+		stats_.add( zerocopy_sends_counter, 1 );
+	}
+
+	void record_zerocopy_copied( size_t count )
+	{
+		stats_.add( zerocopy_copied_counter, count );
+	}
+
+	void replies_dropped( size_t count )
+	{
+		stats_.add( queue_depth_counter, -boost::int64_t( count ) );
+	}
+
+	void record_latency( const boost::chrono::nanoseconds& latency )
+	{
+		latency_.record( latency );
+	}
+
+	const latency_recorder& get_latency() const
+	{
+		return latency_;
+	}
+
+	const server_stats& get_stats() const
+	{
+		return stats_;
+	}
+
+	// where the first shard listens, with the port the system has picked when 0 was given
+	boost::asio::ip::tcp::endpoint get_local_endpoint()
+	{
+		return shards_.front().get_acceptor().local_endpoint();
 	}
 
 private:
 
-	void start_accept()
+	void start_accept( size_t shard_idx )
 	{
-		std::cout << "start accept new client" << std::endl;
+		PERF_LOG_DEBUG( "start accept new client" );
 
-		connection_ptr new_connection(
-			new connection_type(
-					io_service_
-					, request_handler_
-					, *this ) );
+		connection_ptr new_connection = pools_[ shard_idx ]->acquire();
 
-		acceptor_.async_accept(
+		shards_[ shard_idx ].get_acceptor().async_accept(
 			new_connection->connected_socket(),
 			boost::bind( &server::handle_accept, this
+			, shard_idx
 			, new_connection
 			, boost::asio::placeholders::error ) );
 	}
 
-	void handle_accept( connection_ptr new_connection
+	void handle_accept( size_t shard_idx
+		, connection_ptr new_connection
 		, const boost::system::error_code& error )
 	{
 		if ( !error )
 		{
-			std::cout << "accept new client" << std::endl;
+			PERF_LOG_DEBUG( "accept new client" );
+
+			stats_.add( accepts_counter, 1 );
 
 			new_connection->start();
 		}
+		else if ( error != boost::asio::error::operation_aborted )
+		{
+			stats_.add( accept_errors_counter, 1 );
+		}
 
-		start_accept();
+		start_accept( shard_idx );
 	}
 
 	void handle_stop()
 	{
-		std::cout << "server stopped" << std::endl;
-		io_service_.stop();
-
-		const boost::uint64_t bytes_in_mb = 1024 * 1024;
-		const boost::uint64_t sent_data_b = sent_data_.load();
-		const boost::uint64_t sent_data_bits = sent_data_b * std::numeric_limits< char >::digits;
-		const double sent_data_mb = double( sent_data_b ) / bytes_in_mb;
-
-		std::cout << "Sent " << sent_data_b << " bytes" <<
-			" : " << sent_data_mb << " MB. " << std::endl;
-
-		const boost::chrono::duration< double > interval_sec = stop_ - start_;
-		const boost::chrono::duration< double, boost::ratio< 60l > > interval_min( interval_sec );
+		// connections destroyed after stop check out again
+		if ( stopped_.exchange( true ) )
+		{
+			return;
+		}
 
-		std::cout << "Used time: " << interval_sec << " : " <<
-			interval_min << std::endl;
+		PERF_LOG_INFO( "server stopped" );
+		io_service_.stop();
 
-		const double sent_data_mb_per_s = sent_data_mb / interval_sec.count();
-		const double sent_data_mbit_per_s = double( sent_data_bits ) / ( bytes_in_mb * interval_sec.count() );
+		for ( size_t idx = 0; idx < shards_.size(); idx++ )
+		{
+			shards_[ idx ].stop();
+		}
 
-		std::cout << "Transfer rate " <<
-			sent_data_mbit_per_s << " Mbit/s" <<
-			" : " << sent_data_mb_per_s << " MB/s" << std::endl;
+		detail::print_transfer_rate( sent_data_.load(), stop_ - start_ );
 	}
 
 private:
 	boost::asio::io_service io_service_;
-	boost::asio::ip::tcp::acceptor acceptor_;
 	unsigned int threads_count_;
+	const bool sharded_;
 	boost::thread_group threads_;
 	boost::asio::signal_set signals_;
 	filelogic::file_provider file_provider_;
 	protocol::request_handler< filelogic::file_provider > request_handler_;
 	boost::atomic< int > connection_counter_;
 	boost::atomic< boost::uint64_t > sent_data_;
+	boost::atomic< bool > stopped_;
+	socket_tuner socket_tuner_;
 	boost::chrono::steady_clock::time_point start_;
 	boost::chrono::steady_clock::time_point stop_;
+	latency_recorder latency_;
+	server_stats stats_;
+	boost::scoped_ptr< stats_endpoint > stats_endpoint_;
+	boost::ptr_vector< detail::server_shard > shards_;
+	// pool per shard, declared after the shards so it is destroyed first and free
+	// connections are deleted while their io_service is alive; connections in use
+	// keep their pool themselves
+	std::vector< boost::shared_ptr< connection_pool_type > > pools_;
 };
 
 }
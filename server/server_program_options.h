@@ -2,11 +2,37 @@
 #define SERVER_SERVER_PROGRAM_OPTIONS_H_
 
 #include "program_options.h"
+#include "reply.h"
+#include "file_cache.h"
+#include "logger.h"
+#include "socket_tuning.h"
 #include <boost/thread.hpp>
 
 namespace perf
 {
 
+enum server_engine
+{
+	// boost::asio reactor shared by all threads
+	asio_server_engine,
+	// io_uring ring per thread
+	uring_server_engine
+};
+
+inline server_engine server_engine_from_string( const std::string& engine )
+{
+	if ( engine == "asio" )
+	{
+		return asio_server_engine;
+	}
+	else if ( engine == "uring" )
+	{
+		return uring_server_engine;
+	}
+
+	throw std::invalid_argument( "unknown server engine: " + engine );
+}
+
 class server_program_options
 {
 public:
@@ -18,13 +44,33 @@ public:
 		, unsigned short port = 12345
 		, size_t files_count = 100
 		, size_t file_size = 1024
-		, size_t threads_count = boost::thread::hardware_concurrency() * 2 )
+		, size_t threads_count = boost::thread::hardware_concurrency() * 2
+		, const std::string& reply_mode = "copy"
+		, size_t cache_size = 256 * 1024 * 1024
+		, const std::string& cache_policy = "lru"
+		, const std::string& engine = "asio"
+		, size_t connection_pool_size = 32
+		, unsigned short stats_port = 0
+		, const std::string& log_level = "info" )
 		: help_()
 		, host_( ip_address )
 		, port_( port )
 		, files_count_( files_count )
 		, file_size_( file_size )
 		, threads_count_( threads_count )
+		, reply_mode_( reply_mode )
+		, cache_size_( cache_size )
+		, cache_policy_( cache_policy )
+		, engine_( engine )
+		, sharded_()
+		, latency_csv_()
+		, connection_pool_( connection_pool_size )
+		, stats_port_( stats_port )
+		, log_level_( log_level )
+		, index_file_()
+		, keep_files_()
+		, watch_files_()
+		, socket_tuning_()
 	{
 		po::options_description desc( "Allowed options" );
 
@@ -34,6 +80,19 @@ public:
 		desc << file_size_;
 		desc << files_count_;
 		desc << threads_count_;
+		desc << reply_mode_;
+		desc << cache_size_;
+		desc << cache_policy_;
+		desc << engine_;
+		desc << sharded_;
+		desc << latency_csv_;
+		desc << connection_pool_;
+		desc << stats_port_;
+		desc << log_level_;
+		desc << index_file_;
+		desc << keep_files_;
+		desc << watch_files_;
+		desc << socket_tuning_;
 
 		help_.process( argc, argv, desc );
 		host_.process( argc, argv, desc );
@@ -41,6 +100,21 @@ public:
 		file_size_.process( argc, argv, desc );
 		files_count_.process( argc, argv, desc );
 		threads_count_.process( argc, argv, desc );
+		reply_mode_.process( argc, argv, desc );
+		cache_size_.process( argc, argv, desc );
+		cache_policy_.process( argc, argv, desc );
+		engine_.process( argc, argv, desc );
+		sharded_.process( argc, argv, desc );
+		latency_csv_.process( argc, argv, desc );
+		connection_pool_.process( argc, argv, desc );
+		stats_port_.process( argc, argv, desc );
+		log_level_.process( argc, argv, desc );
+		index_file_.process( argc, argv, desc );
+		keep_files_.process( argc, argv, desc );
+		watch_files_.process( argc, argv, desc );
+		socket_tuning_.process( argc, argv, desc );
+
+		check_engine_options();
 	}
 
 	boost::asio::ip::address get_ip_appdress() const
@@ -68,6 +142,102 @@ public:
 		return threads_count_.get_threads_size();
 	}
 
+	protocol::reply_mode get_reply_mode() const
+	{
+		return protocol::reply_mode_from_string( reply_mode_.get_reply_mode() );
+	}
+
+	server_engine get_engine() const
+	{
+		return server_engine_from_string( engine_.get_engine() );
+	}
+
+	bool is_sharded() const
+	{
+		return sharded_.is_sharded();
+	}
+
+	const std::string& get_latency_csv() const
+	{
+		return latency_csv_.get_file_name();
+	}
+
+	size_t get_connection_pool_size() const
+	{
+		return connection_pool_.get_pool_size();
+	}
+
+	unsigned short get_stats_port() const
+	{
+		return stats_port_.get_port();
+	}
+
+	log_level get_log_level() const
+	{
+		return log_level_from_string( log_level_.get_log_level() );
+	}
+
+	const std::string& get_index_file() const
+	{
+		return index_file_.get_file_name();
+	}
+
+	bool is_keep_files() const
+	{
+		return keep_files_.is_keep_files();
+	}
+
+	bool is_watch_files() const
+	{
+		return watch_files_.is_watch_files();
+	}
+
+	socket_settings get_socket_settings() const
+	{
+		socket_settings settings;
+		settings.send_buffer = socket_tuning_.get_send_buffer();
+		settings.receive_buffer = socket_tuning_.get_receive_buffer();
+		settings.no_delay = socket_tuning_.is_no_delay();
+		settings.quick_ack = socket_tuning_.is_quick_ack();
+		settings.busy_poll_us = socket_tuning_.get_busy_poll();
+		settings.not_sent_lowat = socket_tuning_.get_not_sent_lowat();
+		settings.zerocopy = socket_tuning_.is_zerocopy();
+
+		return settings;
+	}
+
+	filelogic::cache_settings get_cache_settings() const
+	{
+		return filelogic::cache_settings(
+			cache_size_.get_cache_size()
+			, filelogic::cache_policy_from_string( cache_policy_.get_cache_policy() ) );
+	}
+
+private:
+
+	// the uring engine has a ring of its own per thread, no acceptor shards, no
+	// connection pool and no stats listener; asking it for them is an error
+	void check_engine_options() const
+	{
+		if ( get_engine() != uring_server_engine )
+		{
+			return;
+		}
+
+		if ( is_sharded() )
+		{
+			throw std::invalid_argument( "--sharded is not supported by the uring engine" );
+		}
+		if ( get_stats_port() )
+		{
+			throw std::invalid_argument( "--stats_port is not supported by the uring engine" );
+		}
+		if ( connection_pool_.is_set() )
+		{
+			throw std::invalid_argument( "--connection_pool is not supported by the uring engine" );
+		}
+	}
+
 private:
 
 	po_help help_;
@@ -76,6 +246,19 @@ private:
 	po_server_files_count files_count_;
 	po_file_size file_size_;
 	po_threads_count threads_count_;
+	po_reply_mode reply_mode_;
+	po_cache_size cache_size_;
+	po_cache_policy cache_policy_;
+	po_engine engine_;
+	po_sharded sharded_;
+	po_latency_csv latency_csv_;
+	po_connection_pool connection_pool_;
+	po_stats_port stats_port_;
+	po_log_level log_level_;
+	po_index_file index_file_;
+	po_keep_files keep_files_;
+	po_watch_files watch_files_;
+	po_socket_tuning socket_tuning_;
 };
 
 }
@@ -0,0 +1,256 @@
+#ifndef SERVER_SERVER_STATS_H_
+#define SERVER_SERVER_STATS_H_
+
+#include <ostream>
+#include <algorithm>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/chrono/include.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace perf
+{
+
+enum server_counter
+{
+	requests_received_counter
+	, replies_sent_counter
+	, bytes_sent_counter
+	, accepts_counter
+	, accept_errors_counter
+	, connections_opened_counter
+	, connections_closed_counter
+	, parse_errors_counter
+	, file_opens_counter
+	, file_open_ns_counter
+	// sendmsg calls writing reply headers and bodies, replies_sent over it is the batch size
+	, reply_writes_counter
+	// reply bodies sent with MSG_ZEROCOPY, and sends of them the kernel has copied after all
+	, zerocopy_sends_counter
+	, zerocopy_copied_counter
+	// requests read and not replied yet, goes down on the thread which sends the reply
+	, queue_depth_counter
+	, server_counters_count
+};
+
+inline const char* server_counter_name( server_counter counter )
+{
+	static const char* const names[ server_counters_count ] = {
+		"requests_received"
+		, "replies_sent"
+		, "bytes_sent"
+		, "accepts"
+		, "accept_errors"
+		, "connections_opened"
+		, "connections_closed"
+		, "parse_errors"
+		, "file_opens"
+		, "file_open_ns"
+		, "reply_writes"
+		, "zerocopy_sends"
+		, "zerocopy_copied"
+		, "queue_depth" };
+
+	return names[ counter ];
+}
+
+// sums of the counters of all threads taken at one moment; counters of different
+// threads are not read at once, so the sums are only consistent between scrapes
+struct server_stats_snapshot
+{
+	server_stats_snapshot()
+		: file_open_max_ns( 0 )
+		, uptime( 0 )
+	{
+		std::fill( values, values + server_counters_count, 0 );
+	}
+
+	boost::int64_t get( server_counter counter ) const
+	{
+		return values[ counter ];
+	}
+
+	boost::int64_t get_open_connections() const
+	{
+		return get( connections_opened_counter ) - get( connections_closed_counter );
+	}
+
+	double get_accept_rate() const
+	{
+		return uptime.count() > 0 ? get( accepts_counter ) / uptime.count() : 0.0;
+	}
+
+	double get_file_open_avg_us() const
+	{
+		const boost::int64_t opens = get( file_opens_counter );
+
+		return opens ? get( file_open_ns_counter ) / 1000.0 / opens : 0.0;
+	}
+
+	// one "name value" pair per line
+	void write_text( std::ostream& out ) const
+	{
+		out << "uptime_s " << uptime.count() << "\n";
+		for ( int idx = 0; idx < server_counters_count; ++idx )
+		{
+			out << server_counter_name( server_counter( idx ) ) << " " << values[ idx ] << "\n";
+		}
+		out << "open_connections " << get_open_connections() << "\n";
+		out << "accepts_per_s " << get_accept_rate() << "\n";
+		out << "file_open_avg_us " << get_file_open_avg_us() << "\n";
+		out << "file_open_max_us " << file_open_max_ns / 1000.0 << "\n";
+	}
+
+	void write_json( std::ostream& out ) const
+	{
+		out << "{\"uptime_s\": " << uptime.count();
+		for ( int idx = 0; idx < server_counters_count; ++idx )
+		{
+			out << ", \"" << server_counter_name( server_counter( idx ) ) << "\": " << values[ idx ];
+		}
+		out << ", \"open_connections\": " << get_open_connections();
+		out << ", \"accepts_per_s\": " << get_accept_rate();
+		out << ", \"file_open_avg_us\": " << get_file_open_avg_us();
+		out << ", \"file_open_max_us\": " << file_open_max_ns / 1000.0;
+		out << "}\n";
+	}
+
+	boost::int64_t values[ server_counters_count ];
+	boost::uint64_t file_open_max_ns;
+	boost::chrono::duration< double > uptime;
+};
+
+// counters are kept per thread and written by their thread alone, so updating one
+// is a plain load and store without lock or locked instruction; get_snapshot sums
+// them up while the threads go on counting
+class server_stats
+	: private boost::noncopyable
+{
+public:
+
+	server_stats()
+		: id_( next_id() )
+		, start_( boost::chrono::steady_clock::now() )
+	{
+	}
+
+	void add( server_counter counter, boost::int64_t delta )
+	{
+		add( local(), counter, delta );
+	}
+
+	void record_file_open( const boost::chrono::nanoseconds& latency )
+	{
+		const boost::int64_t latency_ns = std::max< boost::int64_t >( latency.count(), 0 );
+
+		thread_counters& counters = local();
+		add( counters, file_opens_counter, 1 );
+		add( counters, file_open_ns_counter, latency_ns );
+
+		if ( boost::uint64_t( latency_ns ) > counters.file_open_max_ns.load( boost::memory_order_relaxed ) )
+		{
+			counters.file_open_max_ns.store( latency_ns, boost::memory_order_relaxed );
+		}
+	}
+
+	server_stats_snapshot get_snapshot() const
+	{
+		server_stats_snapshot snapshot;
+		snapshot.uptime = boost::chrono::steady_clock::now() - start_;
+
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		for ( size_t thread_idx = 0; thread_idx < counters_.size(); ++thread_idx )
+		{
+			const thread_counters& counters = counters_[ thread_idx ];
+			for ( int idx = 0; idx < server_counters_count; ++idx )
+			{
+				snapshot.values[ idx ] += counters.values[ idx ].load( boost::memory_order_relaxed );
+			}
+
+			snapshot.file_open_max_ns = std::max< boost::uint64_t >(
+				snapshot.file_open_max_ns, counters.file_open_max_ns.load( boost::memory_order_relaxed ) );
+		}
+
+		return snapshot;
+	}
+
+private:
+
+	// takes a cache line of its own, so threads do not write to each other's lines
+	struct thread_counters
+	{
+		thread_counters()
+			: file_open_max_ns( 0 )
+		{
+			for ( int idx = 0; idx < server_counters_count; ++idx )
+			{
+				values[ idx ].store( 0, boost::memory_order_relaxed );
+			}
+		}
+
+		boost::atomic< boost::int64_t > values[ server_counters_count ];
+		boost::atomic< boost::uint64_t > file_open_max_ns;
+		char padding[ 64 ];
+	};
+
+	// as in latency_recorder, a slot left by a destroyed instance is told by its id
+	struct thread_slot
+	{
+		boost::uint64_t owner_id;
+		thread_counters* counters;
+	};
+
+	static boost::uint64_t next_id()
+	{
+		static boost::atomic< boost::uint64_t > id( 0 );
+
+		return ++id;
+	}
+
+	static void add( thread_counters& counters, server_counter counter, boost::int64_t delta )
+	{
+		boost::atomic< boost::int64_t >& value = counters.values[ counter ];
+		value.store( value.load( boost::memory_order_relaxed ) + delta, boost::memory_order_relaxed );
+	}
+
+	thread_counters& local()
+	{
+		thread_slot* slot = slot_.get();
+		if ( !slot || slot->owner_id != id_ )
+		{
+			slot = register_thread();
+		}
+
+		return *slot->counters;
+	}
+
+	thread_slot* register_thread()
+	{
+		boost::lock_guard< boost::mutex > lock( mutex_ );
+
+		counters_.push_back( new thread_counters() );
+
+		thread_slot* slot = new thread_slot;
+		slot->owner_id = id_;
+		slot->counters = &counters_.back();
+		slot_.reset( slot );
+
+		return slot;
+	}
+
+private:
+
+	const boost::uint64_t id_;
+	const boost::chrono::steady_clock::time_point start_;
+	boost::thread_specific_ptr< thread_slot > slot_;
+	mutable boost::mutex mutex_;
+	boost::ptr_vector< thread_counters > counters_;
+};
+
+}
+
+#endif // SERVER_SERVER_STATS_H_
@@ -0,0 +1,172 @@
+#ifndef SERVER_STATS_ENDPOINT_H_
+#define SERVER_STATS_ENDPOINT_H_
+
+#include "server_stats.h"
+#include "logger.h"
+
+#include <string>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+namespace perf
+{
+
+namespace detail
+{
+
+// reads one request line and answers with the stats: "json" gives a json object,
+// anything else or an empty line the text form; the connection is closed after that
+class stats_session
+	: public boost::enable_shared_from_this< stats_session >
+	, private boost::noncopyable
+{
+public:
+	typedef boost::shared_ptr< stats_session > ptr;
+
+	enum { max_request_length = 256 };
+
+	stats_session( boost::asio::io_service& io_service, const server_stats& stats )
+		: socket_( io_service )
+		, stats_( stats )
+		, request_( max_request_length )
+	{
+	}
+
+	boost::asio::ip::tcp::socket& get_socket()
+	{
+		return socket_;
+	}
+
+	void start()
+	{
+		boost::asio::async_read_until(
+			socket_
+			, request_
+			, '\n'
+			, boost::bind(
+				&stats_session::handle_read_request, shared_from_this()
+				, boost::asio::placeholders::error ) );
+	}
+
+private:
+
+	void handle_read_request( const boost::system::error_code& err )
+	{
+		// a scraper which shuts its side down right away gets the text form
+		if ( err && err != boost::asio::error::eof )
+		{
+			return;
+		}
+
+		std::istream request_stream( &request_ );
+		std::string format;
+		request_stream >> format;
+
+		std::ostringstream out;
+		const server_stats_snapshot snapshot = stats_.get_snapshot();
+		if ( format == "json" )
+		{
+			snapshot.write_json( out );
+		}
+		else
+		{
+			snapshot.write_text( out );
+		}
+		reply_ = out.str();
+
+		boost::asio::async_write(
+			socket_
+			, boost::asio::buffer( reply_ )
+			, boost::bind(
+				&stats_session::handle_write_reply, shared_from_this()
+				, boost::asio::placeholders::error ) );
+	}
+
+	void handle_write_reply( const boost::system::error_code& )
+	{
+		boost::system::error_code non_err_code;
+		socket_.shutdown( boost::asio::ip::tcp::socket::shutdown_both, non_err_code );
+	}
+
+private:
+	boost::asio::ip::tcp::socket socket_;
+	const server_stats& stats_;
+	boost::asio::streambuf request_;
+	std::string reply_;
+};
+
+}
+
+// read-only listener serving server_stats snapshots, meant to be scraped while a
+// benchmark runs, e.g. echo json | nc 127.0.0.1 <port>; runs on an io_service
+// apart from the one serving files
+class stats_endpoint
+	: private boost::noncopyable
+{
+public:
+
+	stats_endpoint(
+		boost::asio::io_service& io_service
+		, const boost::asio::ip::tcp::endpoint& endpoint
+		, const server_stats& stats )
+		: io_service_( io_service )
+		, acceptor_( io_service )
+		, stats_( stats )
+	{
+		acceptor_.open( endpoint.protocol() );
+		acceptor_.set_option( boost::asio::ip::tcp::acceptor::reuse_address( true ) );
+		acceptor_.bind( endpoint );
+		acceptor_.listen();
+
+		PERF_LOG_INFO( "stats are served on port " << acceptor_.local_endpoint().port() );
+
+		start_accept();
+	}
+
+	boost::asio::ip::tcp::endpoint get_local_endpoint() const
+	{
+		return acceptor_.local_endpoint();
+	}
+
+private:
+
+	void start_accept()
+	{
+		detail::stats_session::ptr session( new detail::stats_session( io_service_, stats_ ) );
+
+		acceptor_.async_accept(
+			session->get_socket()
+			, boost::bind( &stats_endpoint::handle_accept, this
+				, session
+				, boost::asio::placeholders::error ) );
+	}
+
+	void handle_accept( detail::stats_session::ptr session, const boost::system::error_code& err )
+	{
+		if ( err == boost::asio::error::operation_aborted )
+		{
+			return;
+		}
+
+		if ( !err )
+		{
+			session->start();
+		}
+
+		start_accept();
+	}
+
+private:
+	boost::asio::io_service& io_service_;
+	boost::asio::ip::tcp::acceptor acceptor_;
+	const server_stats& stats_;
+};
+
+}
+
+#endif // SERVER_STATS_ENDPOINT_H_
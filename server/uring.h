@@ -0,0 +1,282 @@
+#ifndef SERVER_URING_H_
+#define SERVER_URING_H_
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/noncopyable.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/asio/error.hpp>
+
+namespace perf
+{
+namespace uring
+{
+namespace detail
+{
+
+inline void throw_errno( const char* what )
+{
+	throw boost::system::system_error(
+		boost::system::error_code( errno, boost::asio::error::get_system_category() )
+		, what );
+}
+
+inline unsigned load_acquire( const unsigned* p )
+{
+	return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+inline void store_release( unsigned* p, unsigned value )
+{
+	__atomic_store_n( p, value, __ATOMIC_RELEASE );
+}
+
+}
+
+// minimal io_uring wrapper over the raw syscalls: one submission and one completion queue
+// mapped into the process, sqes are queued by get_sqe and handed to the kernel in batches
+class ring
+	: private boost::noncopyable
+{
+public:
+
+	explicit ring( unsigned entries )
+		: fd_( -1 )
+		, sq_ptr_( MAP_FAILED )
+		, cq_ptr_( MAP_FAILED )
+		, sqes_( static_cast< io_uring_sqe* >( MAP_FAILED ) )
+		, sq_ring_size_( 0 )
+		, cq_ring_size_( 0 )
+		, sqes_size_( 0 )
+		, sqe_tail_( 0 )
+		, sqe_head_( 0 )
+	{
+		memset( &params_, 0, sizeof( params_ ) );
+
+		fd_ = syscall( __NR_io_uring_setup, entries, &params_ );
+		if ( fd_ < 0 )
+		{
+			detail::throw_errno( "io_uring_setup" );
+		}
+
+		try
+		{
+			map_rings();
+		}
+		catch ( ... )
+		{
+			unmap_rings();
+			::close( fd_ );
+			throw;
+		}
+	}
+
+	~ring()
+	{
+		unmap_rings();
+		::close( fd_ );
+	}
+
+	// returns 0 when all entries are queued and not submitted yet
+	io_uring_sqe* get_sqe()
+	{
+		if ( sqe_tail_ - detail::load_acquire( sq_head_ ) >= *sq_ring_entries_ )
+		{
+			return 0;
+		}
+
+		io_uring_sqe* sqe = &sqes_[ sqe_tail_ & *sq_ring_mask_ ];
+		++sqe_tail_;
+		memset( sqe, 0, sizeof( *sqe ) );
+
+		return sqe;
+	}
+
+	// submits queued sqes and waits for at least wait_nr completions in the same syscall
+	unsigned submit_and_wait( unsigned wait_nr )
+	{
+		const unsigned to_submit = flush_sq();
+		const unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+
+		for ( ;; )
+		{
+			const int res = syscall( __NR_io_uring_enter, fd_, to_submit, wait_nr, flags, 0, 0 );
+			if ( res >= 0 )
+			{
+				return res;
+			}
+
+			if ( errno != EINTR )
+			{
+				detail::throw_errno( "io_uring_enter" );
+			}
+		}
+	}
+
+	unsigned submit()
+	{
+		return submit_and_wait( 0 );
+	}
+
+	io_uring_cqe* peek_cqe()
+	{
+		const unsigned head = *cq_head_;
+		if ( head == detail::load_acquire( cq_tail_ ) )
+		{
+			return 0;
+		}
+
+		return &cqes_[ head & *cq_ring_mask_ ];
+	}
+
+	void cqe_seen()
+	{
+		detail::store_release( cq_head_, *cq_head_ + 1 );
+	}
+
+	void register_buffers( const iovec* buffers, unsigned count )
+	{
+		if ( syscall( __NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers, count ) < 0 )
+		{
+			detail::throw_errno( "io_uring_register buffers" );
+		}
+	}
+
+	void register_files( const int* fds, unsigned count )
+	{
+		if ( syscall( __NR_io_uring_register, fd_, IORING_REGISTER_FILES, fds, count ) < 0 )
+		{
+			detail::throw_errno( "io_uring_register files" );
+		}
+	}
+
+private:
+
+	unsigned flush_sq()
+	{
+		const unsigned to_submit = sqe_tail_ - sqe_head_;
+		unsigned tail = *sq_tail_;
+
+		for ( ; sqe_head_ != sqe_tail_; ++sqe_head_, ++tail )
+		{
+			sq_array_[ tail & *sq_ring_mask_ ] = sqe_head_ & *sq_ring_mask_;
+		}
+
+		detail::store_release( sq_tail_, tail );
+
+		return to_submit;
+	}
+
+	void map_rings()
+	{
+		sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof( unsigned );
+		cq_ring_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof( io_uring_cqe );
+
+		const bool single_mmap = params_.features & IORING_FEAT_SINGLE_MMAP;
+		if ( single_mmap )
+		{
+			sq_ring_size_ = cq_ring_size_ = std::max( sq_ring_size_, cq_ring_size_ );
+		}
+
+		sq_ptr_ = ::mmap( 0, sq_ring_size_, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING );
+		if ( sq_ptr_ == MAP_FAILED )
+		{
+			detail::throw_errno( "mmap sq ring" );
+		}
+
+		if ( single_mmap )
+		{
+			cq_ptr_ = sq_ptr_;
+		}
+		else
+		{
+			cq_ptr_ = ::mmap( 0, cq_ring_size_, PROT_READ | PROT_WRITE
+				, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING );
+			if ( cq_ptr_ == MAP_FAILED )
+			{
+				detail::throw_errno( "mmap cq ring" );
+			}
+		}
+
+		sqes_size_ = params_.sq_entries * sizeof( io_uring_sqe );
+		sqes_ = static_cast< io_uring_sqe* >( ::mmap( 0, sqes_size_, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES ) );
+		if ( sqes_ == MAP_FAILED )
+		{
+			detail::throw_errno( "mmap sqes" );
+		}
+
+		char* sq = static_cast< char* >( sq_ptr_ );
+		sq_head_ = reinterpret_cast< unsigned* >( sq + params_.sq_off.head );
+		sq_tail_ = reinterpret_cast< unsigned* >( sq + params_.sq_off.tail );
+		sq_ring_mask_ = reinterpret_cast< unsigned* >( sq + params_.sq_off.ring_mask );
+		sq_ring_entries_ = reinterpret_cast< unsigned* >( sq + params_.sq_off.ring_entries );
+		sq_array_ = reinterpret_cast< unsigned* >( sq + params_.sq_off.array );
+
+		char* cq = static_cast< char* >( cq_ptr_ );
+		cq_head_ = reinterpret_cast< unsigned* >( cq + params_.cq_off.head );
+		cq_tail_ = reinterpret_cast< unsigned* >( cq + params_.cq_off.tail );
+		cq_ring_mask_ = reinterpret_cast< unsigned* >( cq + params_.cq_off.ring_mask );
+		cqes_ = reinterpret_cast< io_uring_cqe* >( cq + params_.cq_off.cqes );
+	}
+
+	void unmap_rings()
+	{
+		if ( sqes_ != MAP_FAILED )
+		{
+			::munmap( sqes_, sqes_size_ );
+		}
+
+		if ( cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_ )
+		{
+			::munmap( cq_ptr_, cq_ring_size_ );
+		}
+
+		if ( sq_ptr_ != MAP_FAILED )
+		{
+			::munmap( sq_ptr_, sq_ring_size_ );
+		}
+	}
+
+private:
+
+	int fd_;
+	io_uring_params params_;
+
+	void* sq_ptr_;
+	void* cq_ptr_;
+	io_uring_sqe* sqes_;
+	size_t sq_ring_size_;
+	size_t cq_ring_size_;
+	size_t sqes_size_;
+
+	unsigned* sq_head_;
+	unsigned* sq_tail_;
+	unsigned* sq_ring_mask_;
+	unsigned* sq_ring_entries_;
+	unsigned* sq_array_;
+
+	unsigned* cq_head_;
+	unsigned* cq_tail_;
+	unsigned* cq_ring_mask_;
+	io_uring_cqe* cqes_;
+
+	// sqes handed out by get_sqe but not yet published to the kernel
+	unsigned sqe_tail_;
+	unsigned sqe_head_;
+};
+
+}
+}
+
+#endif // SERVER_URING_H_
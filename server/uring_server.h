@@ -0,0 +1,716 @@
+#ifndef SERVER_URING_SERVER_H_
+#define SERVER_URING_SERVER_H_
+
+#include "uring.h"
+#include "server.h"
+#include "file_provider.h"
+#include "request_handler.h"
+#include "latency_histogram.h"
+#include "reply.h"
+#include "variable_record.h"
+
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <iostream>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/chrono/include.hpp>
+
+namespace perf
+{
+namespace detail
+{
+
+// one ring per thread: accepts on the shared listening socket and drives
+// its connections through recv header -> recv body -> send reply -> (read file -> send)*
+template< class request_handler, class observer >
+class uring_worker
+	: private boost::noncopyable
+{
+public:
+
+	enum { ring_entries = 1024, chunk_size = 64 * 1024, fixed_buffers_count = 64 };
+
+	uring_worker(
+		int listen_fd
+		, const request_handler& req_handler
+		, observer& observ )
+		: ring_( ring_entries )
+		, request_handler_( req_handler )
+		, observer_( observ )
+		, fixed_buffers_( size_t( chunk_size ) * fixed_buffers_count )
+		, in_flight_( 0 )
+		, stopping_( false )
+		, accept_paused_( false )
+	{
+		// listening socket is the only registered file, accept uses index 0
+		ring_.register_files( &listen_fd, 1 );
+
+		std::vector< iovec > iovecs( fixed_buffers_count );
+		for ( int idx = 0; idx < fixed_buffers_count; ++idx )
+		{
+			iovecs[ idx ].iov_base = &fixed_buffers_[ idx * chunk_size ];
+			iovecs[ idx ].iov_len = chunk_size;
+			free_fixed_buffers_.push_back( idx );
+		}
+		ring_.register_buffers( &iovecs[ 0 ], iovecs.size() );
+
+		timeout_.tv_sec = 0;
+		timeout_.tv_nsec = 100 * 1000 * 1000;
+	}
+
+	~uring_worker()
+	{
+		for ( typename connections_type::iterator it = connections_.begin(); it != connections_.end(); ++it )
+		{
+			::close( ( *it )->fd );
+			delete *it;
+		}
+	}
+
+	void run()
+	{
+		post_accept();
+		post_timeout();
+
+		while ( in_flight_ )
+		{
+			ring_.submit_and_wait( 1 );
+
+			while ( io_uring_cqe* cqe = ring_.peek_cqe() )
+			{
+				const boost::uint64_t user_data = cqe->user_data;
+				const int res = cqe->res;
+				ring_.cqe_seen();
+				--in_flight_;
+
+				handle_completion( user_data, res );
+			}
+		}
+	}
+
+private:
+
+	enum operation { accept_op, timeout_op, cancel_op, recv_op, send_op, read_op, operation_mask = 7 };
+
+	enum connection_state { reading_header, reading_body, sending_reply, sending_file };
+
+	struct connection
+	{
+		int fd;
+		connection_state state;
+		protocol::variable_record record;
+		protocol::request request;
+		protocol::reply rep;
+		// received bytes of header or body, sent bytes of reply or file chunk
+		size_t transferred;
+		iovec iov[ protocol::reply::max_buffers_count ];
+		msghdr msg;
+		int send_flags;
+		off_t file_offset;
+		int fixed_buffer;
+		// TCP_QUICKACK is set again after every receive
+		bool quick_ack;
+		std::vector< char > chunk;
+		size_t chunk_length;
+		boost::chrono::steady_clock::time_point request_start;
+	};
+
+	typedef boost::unordered_set< connection* > connections_type;
+
+	io_uring_sqe* get_sqe()
+	{
+		io_uring_sqe* sqe = ring_.get_sqe();
+		if ( !sqe )
+		{
+			// submission queue is full, hand the batch to the kernel
+			ring_.submit();
+			sqe = ring_.get_sqe();
+		}
+
+		++in_flight_;
+
+		return sqe;
+	}
+
+	static boost::uint64_t make_user_data( connection* conn, operation op )
+	{
+		return reinterpret_cast< boost::uint64_t >( conn ) | op;
+	}
+
+	void handle_completion( boost::uint64_t user_data, int res )
+	{
+		connection* conn = reinterpret_cast< connection* >( user_data & ~boost::uint64_t( operation_mask ) );
+
+		switch ( user_data & operation_mask )
+		{
+		case accept_op:
+			handle_accept( res );
+			break;
+		case timeout_op:
+			handle_timeout();
+			break;
+		case recv_op:
+			handle_recv( *conn, res );
+			break;
+		case send_op:
+			handle_send( *conn, res );
+			break;
+		case read_op:
+			handle_read( *conn, res );
+			break;
+		default:
+			break;
+		}
+	}
+
+	void post_accept()
+	{
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = 0;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->user_data = make_user_data( 0, accept_op );
+	}
+
+	void handle_accept( int res )
+	{
+		if ( stopping_ )
+		{
+			if ( res >= 0 )
+			{
+				::close( res );
+			}
+			return;
+		}
+
+		if ( res >= 0 )
+		{
+			connection* conn = new connection();
+			conn->fd = res;
+			conn->fixed_buffer = -1;
+			conn->quick_ack = observer_.tune_socket( res ).quick_ack;
+			connections_.insert( conn );
+			observer_.checkin();
+
+			start_read_header( *conn );
+		}
+		else if ( is_out_of_resources( -res ) )
+		{
+			// accepting again at once would fail the same way and spin; it resumes
+			// when a connection of the worker closes or on the next timeout
+			PERF_LOG_WARNING( "accept " << strerror( -res ) << ", accepting paused" );
+			accept_paused_ = true;
+			return;
+		}
+		else
+		{
+			PERF_LOG_ERROR( "accept " << strerror( -res ) );
+		}
+
+		post_accept();
+	}
+
+	static bool is_out_of_resources( int error )
+	{
+		return error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+	}
+
+	void resume_accept()
+	{
+		if ( accept_paused_ && !stopping_ )
+		{
+			accept_paused_ = false;
+			post_accept();
+		}
+	}
+
+	void post_timeout()
+	{
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = reinterpret_cast< boost::uint64_t >( &timeout_ );
+		sqe->len = 1;
+		sqe->user_data = make_user_data( 0, timeout_op );
+	}
+
+	void handle_timeout()
+	{
+		if ( !stopping_ && observer_.is_stopped() )
+		{
+			begin_stop();
+		}
+
+		if ( !stopping_ )
+		{
+			resume_accept();
+			post_timeout();
+		}
+	}
+
+	void begin_stop()
+	{
+		stopping_ = true;
+
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = make_user_data( 0, accept_op );
+		sqe->user_data = make_user_data( 0, cancel_op );
+
+		// pending recv and send complete with an error and release their connections
+		for ( typename connections_type::iterator it = connections_.begin(); it != connections_.end(); ++it )
+		{
+			::shutdown( ( *it )->fd, SHUT_RDWR );
+		}
+	}
+
+	void close_connection( connection& conn )
+	{
+		release_fixed_buffer( conn );
+		::close( conn.fd );
+		connections_.erase( &conn );
+		delete &conn;
+
+		observer_.checkout();
+		resume_accept();
+	}
+
+	void post_recv( connection& conn, char* buffer, size_t length )
+	{
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = conn.fd;
+		sqe->addr = reinterpret_cast< boost::uint64_t >( buffer );
+		sqe->len = length;
+		sqe->user_data = make_user_data( &conn, recv_op );
+	}
+
+	void start_read_header( connection& conn )
+	{
+		conn.state = reading_header;
+		conn.transferred = 0;
+
+		post_recv( conn, conn.record.get_header_buff(), protocol::variable_record::header_length );
+	}
+
+	void handle_recv( connection& conn, int res )
+	{
+		if ( res <= 0 || stopping_ )
+		{
+			close_connection( conn );
+			return;
+		}
+
+		conn.transferred += res;
+
+		if ( conn.quick_ack )
+		{
+			detail::rearm_quick_ack( conn.fd );
+		}
+
+		if ( conn.state == reading_header )
+		{
+			if ( conn.transferred < protocol::variable_record::header_length )
+			{
+				post_recv( conn
+					, conn.record.get_header_buff() + conn.transferred
+					, protocol::variable_record::header_length - conn.transferred );
+				return;
+			}
+
+			if ( !conn.record.deserialize_header() )
+			{
+				PERF_LOG_ERROR( "deserialize header" );
+				close_connection( conn );
+				return;
+			}
+
+			conn.state = reading_body;
+			conn.transferred = 0;
+			conn.request_start = boost::chrono::steady_clock::now();
+		}
+
+		if ( conn.transferred < conn.record.get_body_length() )
+		{
+			post_recv( conn
+				, conn.record.get_body_buff() + conn.transferred
+				, conn.record.get_body_length() - conn.transferred );
+			return;
+		}
+
+		handle_request( conn );
+	}
+
+	void handle_request( connection& conn )
+	{
+		if ( !conn.record.deserialize_body( conn.request ) )
+		{
+			PERF_LOG_ERROR( "deserialize body" );
+			close_connection( conn );
+			return;
+		}
+
+		request_handler_.make_reply( conn.request, conn.rep );
+		conn.rep.format = conn.record.get_header_format();
+
+		const protocol::reply_buffers buffers = conn.rep.get_buffers();
+		memset( &conn.msg, 0, sizeof( conn.msg ) );
+		conn.msg.msg_iov = conn.iov;
+		conn.msg.msg_iovlen = buffers.size();
+		for ( size_t idx = 0; idx < buffers.size(); ++idx )
+		{
+			conn.iov[ idx ].iov_base = const_cast< void* >( boost::asio::buffer_cast< const void* >( buffers[ idx ] ) );
+			conn.iov[ idx ].iov_len = boost::asio::buffer_size( buffers[ idx ] );
+		}
+
+		// file body follows the header, let the kernel merge them into full segments
+		conn.send_flags = MSG_NOSIGNAL | ( conn.rep.has_file_descriptor() ? MSG_MORE : 0 );
+		conn.state = sending_reply;
+		post_sendmsg( conn );
+	}
+
+	void post_sendmsg( connection& conn )
+	{
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = conn.fd;
+		sqe->addr = reinterpret_cast< boost::uint64_t >( &conn.msg );
+		sqe->len = 1;
+		sqe->msg_flags = conn.send_flags;
+		sqe->user_data = make_user_data( &conn, send_op );
+	}
+
+	void post_send( connection& conn, const char* buffer, size_t length )
+	{
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = conn.fd;
+		sqe->addr = reinterpret_cast< boost::uint64_t >( buffer );
+		sqe->len = length;
+		sqe->msg_flags = conn.send_flags;
+		sqe->user_data = make_user_data( &conn, send_op );
+	}
+
+	void handle_send( connection& conn, int res )
+	{
+		if ( res < 0 || stopping_ )
+		{
+			close_connection( conn );
+			return;
+		}
+
+		if ( conn.state == sending_reply )
+		{
+			// skip fully sent iovecs, then shift into the partially sent one
+			size_t sent = res;
+			while ( conn.msg.msg_iovlen && sent >= conn.msg.msg_iov->iov_len )
+			{
+				sent -= conn.msg.msg_iov->iov_len;
+				++conn.msg.msg_iov;
+				--conn.msg.msg_iovlen;
+			}
+
+			if ( conn.msg.msg_iovlen )
+			{
+				conn.msg.msg_iov->iov_base = static_cast< char* >( conn.msg.msg_iov->iov_base ) + sent;
+				conn.msg.msg_iov->iov_len -= sent;
+				post_sendmsg( conn );
+			}
+			else if ( conn.rep.has_file_descriptor() )
+			{
+				conn.state = sending_file;
+				conn.file_offset = conn.rep.header.offset;
+				acquire_fixed_buffer( conn );
+				post_read_chunk( conn );
+			}
+			else
+			{
+				handle_reply_sent( conn );
+			}
+		}
+		else
+		{
+			conn.transferred += res;
+
+			if ( conn.transferred < conn.chunk_length )
+			{
+				post_send( conn
+					, chunk_data( conn ) + conn.transferred
+					, conn.chunk_length - conn.transferred );
+			}
+			else
+			{
+				conn.file_offset += conn.chunk_length;
+				post_read_chunk( conn );
+			}
+		}
+	}
+
+	void post_read_chunk( connection& conn )
+	{
+		const size_t left = conn.rep.header.offset + conn.rep.header.file_size - conn.file_offset;
+		if ( !left )
+		{
+			release_fixed_buffer( conn );
+			conn.rep.file_descriptor.reset();
+			handle_reply_sent( conn );
+			return;
+		}
+
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = conn.fixed_buffer >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->fd = conn.rep.file_descriptor->get();
+		sqe->off = conn.file_offset;
+		sqe->addr = reinterpret_cast< boost::uint64_t >( chunk_data( conn ) );
+		sqe->len = std::min< size_t >( left, chunk_size );
+		sqe->buf_index = conn.fixed_buffer >= 0 ? conn.fixed_buffer : 0;
+		sqe->user_data = make_user_data( &conn, read_op );
+	}
+
+	void handle_read( connection& conn, int res )
+	{
+		if ( res <= 0 || stopping_ )
+		{
+			// error or file was truncated after its size had been taken
+			close_connection( conn );
+			return;
+		}
+
+		conn.chunk_length = res;
+		conn.transferred = 0;
+
+		const bool last_chunk = conn.file_offset + conn.chunk_length >= conn.rep.header.offset + conn.rep.header.file_size;
+		conn.send_flags = MSG_NOSIGNAL | ( last_chunk ? 0 : MSG_MORE );
+		post_send( conn, chunk_data( conn ), conn.chunk_length );
+	}
+
+	void handle_reply_sent( connection& conn )
+	{
+		observer_.update_sent_data( conn.rep.header.file_size );
+		observer_.record_latency( boost::chrono::steady_clock::now() - conn.request_start );
+		start_read_header( conn );
+	}
+
+	char* chunk_data( connection& conn )
+	{
+		return conn.fixed_buffer >= 0 ?
+			&fixed_buffers_[ conn.fixed_buffer * chunk_size ]
+			: &conn.chunk[ 0 ];
+	}
+
+	void acquire_fixed_buffer( connection& conn )
+	{
+		if ( !free_fixed_buffers_.empty() )
+		{
+			conn.fixed_buffer = free_fixed_buffers_.back();
+			free_fixed_buffers_.pop_back();
+		}
+		else if ( conn.chunk.empty() )
+		{
+			// more files in flight than registered buffers
+			conn.chunk.resize( chunk_size );
+		}
+	}
+
+	void release_fixed_buffer( connection& conn )
+	{
+		if ( conn.fixed_buffer >= 0 )
+		{
+			free_fixed_buffers_.push_back( conn.fixed_buffer );
+			conn.fixed_buffer = -1;
+		}
+	}
+
+private:
+
+	uring::ring ring_;
+	const request_handler& request_handler_;
+	observer& observer_;
+	std::vector< char > fixed_buffers_;
+	std::vector< int > free_fixed_buffers_;
+	connections_type connections_;
+	__kernel_timespec timeout_;
+	size_t in_flight_;
+	bool stopping_;
+	// no accept is posted after it failed for lack of descriptors or memory
+	bool accept_paused_;
+};
+
+}
+
+// same workload as perf::server, but every socket and file operation goes through io_uring
+class uring_server
+	: private boost::noncopyable
+{
+	typedef protocol::request_handler< filelogic::file_provider > request_handler_type;
+	typedef detail::uring_worker< request_handler_type, uring_server > worker_type;
+
+public:
+
+	uring_server(
+		const boost::asio::ip::tcp::endpoint& endpoint
+		, const boost::filesystem::path& file_dir
+		, unsigned int threads_count
+		, protocol::reply_mode mode = protocol::copy_reply_mode
+		, const filelogic::cache_settings& cache = filelogic::cache_settings()
+		, const std::string& index_file = std::string()
+		, bool watch_files = false
+		, const socket_settings& sockets = socket_settings() )
+		: io_service_()
+		, acceptor_( io_service_ )
+		, threads_count_( threads_count )
+		, file_provider_( file_dir )
+		, request_handler_( file_provider_, mode )
+		, connection_counter_( 0 )
+		, sent_data_( 0 )
+		, stopped_( false )
+		, socket_tuner_( sockets )
+	{
+		if ( mode == protocol::cache_reply_mode && cache.capacity )
+		{
+			file_provider_.enable_cache( cache );
+		}
+		else if ( mode == protocol::mmap_reply_mode )
+		{
+			file_provider_.enable_mapping();
+		}
+
+		// bind, listen; accepting itself is done by the rings
+		acceptor_.open( endpoint.protocol() );
+		acceptor_.set_option( boost::asio::ip::tcp::acceptor::reuse_address( true ) );
+		socket_tuner_.apply_listening( acceptor_.native_handle() );
+		acceptor_.bind( endpoint );
+		acceptor_.listen();
+
+		file_provider_.enable_index( index_file );
+		if ( watch_files )
+		{
+			file_provider_.enable_watching();
+		}
+		file_provider_.attach();
+	}
+
+	void run()
+	{
+		// system signals are taken by this thread only, workers inherit the mask
+		sigset_t signals;
+		sigemptyset( &signals );
+		sigaddset( &signals, SIGINT );
+		sigaddset( &signals, SIGTERM );
+		pthread_sigmask( SIG_BLOCK, &signals, 0 );
+
+		boost::ptr_vector< worker_type > workers;
+		for ( unsigned int idx = 0; idx < threads_count_; idx++ )
+		{
+			workers.push_back( new worker_type( acceptor_.native_handle(), request_handler_, *this ) );
+			threads_.create_thread( boost::bind( &worker_type::run, &workers.back() ) );
+		}
+
+		const timespec wait_interval = { 0, 100 * 1000 * 1000 };
+		while ( !is_stopped() )
+		{
+			if ( sigtimedwait( &signals, 0, &wait_interval ) > 0 )
+			{
+				stop();
+			}
+		}
+
+		threads_.join_all();
+
+		PERF_LOG_INFO( "server stopped" );
+		detail::print_transfer_rate( sent_data_.load(), stop_ - start_ );
+		latency_.get_merged().print( std::cout );
+	}
+
+	void checkin()
+	{
+		const int cntr = connection_counter_.fetch_add( 1 );
+
+		if ( !cntr )
+		{
+			// handle first connection
+			start_ = boost::chrono::steady_clock::now();
+		}
+	}
+
+	void checkout()
+	{
+		if ( connection_counter_.fetch_sub( 1 ) == 1 )
+		{
+			// handle last connection
+			stop();
+		}
+	}
+
+	void update_sent_data( size_t size )
+	{
+		sent_data_ += size;
+	}
+
+	// the options the first connection has got are logged
+	const socket_settings& tune_socket( int fd )
+	{
+		std::string report;
+		if ( socket_tuner_.apply( fd, report ) )
+		{
+			PERF_LOG_INFO( "socket options " << report );
+		}
+
+		return socket_tuner_.get_settings();
+	}
+
+	void record_latency( const boost::chrono::nanoseconds& latency )
+	{
+		latency_.record( latency );
+	}
+
+	const latency_recorder& get_latency() const
+	{
+		return latency_;
+	}
+
+	bool is_stopped() const
+	{
+		return stopped_.load();
+	}
+
+private:
+
+	void stop()
+	{
+		if ( !stopped_.exchange( true ) )
+		{
+			stop_ = boost::chrono::steady_clock::now();
+		}
+	}
+
+private:
+	boost::asio::io_service io_service_;
+	boost::asio::ip::tcp::acceptor acceptor_;
+	unsigned int threads_count_;
+	boost::thread_group threads_;
+	filelogic::file_provider file_provider_;
+	request_handler_type request_handler_;
+	boost::atomic< int > connection_counter_;
+	boost::atomic< boost::uint64_t > sent_data_;
+	boost::atomic< bool > stopped_;
+	socket_tuner socket_tuner_;
+	boost::chrono::steady_clock::time_point start_;
+	boost::chrono::steady_clock::time_point stop_;
+	latency_recorder latency_;
+};
+
+}
+
+#endif // SERVER_URING_SERVER_H_